@@ -1,236 +1,572 @@
 // In this program we calculate the shortest route of a trip to solve the
-// Travelling Salesman Problem (TSP).
+// Travelling Salesman Problem (TSP). The solver itself is libtsp (tsp.h); this
+// file is its command line front end.
 #include <inttypes.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-#define MAX_CITIES 64 // The maximum number of cities we will visit.
-#define NO_PATH                                                                \
-  UINT64_MAX // We assign the a very large number to indicate that there is no
-             // path between 2 cities.
-
-// A function to get index of each city in the cities array. It is a helping
-// function to make sure that every city will only be included and thus visited
-// once.
-int get_city_index(char *cities[], int city_count, const char *city_name) {
-  for (int i = 0; i < city_count; i++) {
-    if (strcmp(cities[i], city_name) ==
-        0) { // We loop through the cities array until we find a duplicate.
-      return i;
-    }
+#include "arena.h"
+#include "batch.h"
+#include "output.h"
+#include "parser.h"
+#include "serve.h"
+#include "tsp.h"
+
+// A function to print the error for a failed load or solve to err. Returns 1,
+// the exit code of a failed run.
+static int report_error(const struct tsp_context *ctx, enum tsp_status status,
+                        const struct tsp_options *options, FILE *err) {
+  size_t error_line = tsp_error_line(ctx);
+  if (status == TSP_OPEN_ERROR) {
+    fprintf(err, "Error opening the file\n"); // Error handling.
+  } else if (status == TSP_PARSE_ERROR && error_line > 0) {
+    fprintf(err, "Error reading file (line %zu)\n", error_line);
+  } else if (status == TSP_PARSE_ERROR) {
+    fprintf(err, "Error reading file\n");
+  } else if (status == TSP_EMPTY) {
+    fprintf(err, "Error: The input file is empty or contains no valid "
+                 "data.\n"); // Handle empty files.
+  } else if (status == TSP_PLUGIN_ERROR) {
+    fprintf(err, "Error: Could not load cost plugin %s: %s\n", options->cost,
+            tsp_error_message(ctx));
+  } else if (status == TSP_TOO_MANY_CITIES) {
+    // The DP keeps the visited cities in a 64-bit mask.
+    fprintf(err, "Error: Too many cities (maximum is %d).\n",
+            TSP_DP_MAX_CITIES);
+  } else {
+    fprintf(err, "Error: Out of memory.\n");
   }
-  return -1;
-}
-
-// A function to determine the minimum-cost path. We divide the problem into sub
-// problems by simulating all possible visits, then summing the costs to find
-// the best route. We store minimum distances in a db table to avoid recomputing
-// the same distances.
-uint64_t tsp_dp(int current, uint64_t visited, int city_count,
-                uint64_t di[MAX_CITIES][MAX_CITIES], uint64_t **dp,
-                int **next_city) {
-  if (visited == (1ULL << city_count) -
-                     1) { // This is a binary representation of cities visited
-                          // (bitmask). If all cities have been visited, then it
-                          // will assign all cities with 1 and since we exclude
-                          // the cost to return to the first city, we return 0.
-    return 0;
-  }
-
-  if (dp[current][visited] != NO_PATH) {
-    return dp[current]
-             [visited]; // If the solution has already be computed and the
-                        // distance is stored in dp array, we get the distance
-                        // value instead of recalculating it again.
-  }
-
-  uint64_t min_cost = NO_PATH; // Initialize minimum cost.
-  int best_next_city = -1;     // Initialize the best next city cost.
-
-  for (int next = 0; next < city_count;
-       next++) { // We loop through all the cities we can visit, simulating all
-                 // possible routes to find the minimum cost.
-    if (!(visited & (1ULL << next)) &&
-        di[current][next] !=
-            NO_PATH) { // If we have not visited the next city and there is a
-                       // path to it, we calculate the cost and update next city
-                       // to visited city.
-      uint64_t cost =
-          di[current][next] +
-          tsp_dp(next,
-                 visited |
-                     (1ULL << next), // We recursively do the same for the next
-                                     // city until all possible routes have been
-                                     // covered and we sum the cost.
-                 city_count, di, dp, next_city);
-
-      // We find the minimum cost route and according to this the next city that
-      // we will visit. Doing this for all routes, we can compare all costs to
-      // find the minimum.
-      if (cost < min_cost) {
-        min_cost = cost;
-        best_next_city = next;
-      }
-    }
+  return 1;
+}
+
+// A function to print the error bound of quantized distances to err, if the
+// loaded instance uses them.
+static void report_quantization(const struct tsp_context *ctx, FILE *err) {
+  uint64_t scale, max_error;
+  if (tsp_quantization(ctx, &scale, &max_error)) {
+    fprintf(err,
+            "Note: distances quantized in steps of %" PRIu64
+            ", each within %" PRIu64 " of the exact value.\n",
+            scale, max_error);
   }
-  // Finally we fill the dp array with the minimum cost routes and we get the
-  // minimum cost. Since we recursively call this function, min_cost will be
-  // updated to the minimum cost, while next_city will be filled with the best
-  // route.
-  dp[current][visited] = min_cost;
-  next_city[current][visited] = best_next_city;
-  return min_cost;
-}
-
-// A function to compute and print the results of tsp solution.
-void solve_tsp(int city_count, uint64_t di[MAX_CITIES][MAX_CITIES],
-               char *cities[]) {
-  // Dynamically allocate the dp and next_city tables.
-  uint64_t **dp = malloc(
-      city_count *
-      sizeof(
-          uint64_t *)); // An array to store the city paths and their distances.
-                        // It will help store the minimum cost paths.
-  int **next_city = malloc(
-      city_count *
-      sizeof(int *)); // A similar array to store the possible next cities to
-                      // vist. It will help determine all possible paths.
-  for (int i = 0; i < city_count; i++) {
-    // We allocate enough memory for every single city in the arrays.
-    dp[i] = malloc((1ULL << city_count) * sizeof(uint64_t));
-    next_city[i] = malloc((1ULL << city_count) * sizeof(int));
-    for (uint64_t j = 0; j < (1ULL << city_count); j++) {
-      dp[i][j] = NO_PATH; // We initialize all possible combination distances to
-                          // NO PATH.
-      next_city[i][j] = -1; // We initialize next city routes to -1.
-    }
+}
+
+// The command line options of a solver run.
+struct options {
+  struct tsp_options solver; // --engine, --closure, --quantize, --matrix,
+                             // --road, --cost and --cost-args.
+  const char *updates; // Changes to apply between solves (--updates=<file>).
+  int batch; // The file name is a manifest or a directory (--batch).
+  int serve; // The file name is a socket to serve requests on (--serve).
+  const char *cache; // A file to keep results in (--cache=<file>).
+  enum output_format format; // How results are printed (--format=<name>).
+  int progress; // Report the progress of solves on stderr (--progress).
+  int all_pairs; // Print the costs of every start and end (--all-pairs).
+};
+
+// The context of a single instance run, which SIGINT cancels. The solve then
+// returns the best route it found so far, and a second SIGINT kills the
+// process as usual.
+static struct tsp_context *volatile interruptible;
+
+static void handle_sigint(int signal) {
+  (void)signal;
+  struct tsp_context *ctx = interruptible;
+  if (ctx) {
+    tsp_cancel(ctx);
   }
+}
 
-  uint64_t result = tsp_dp(0, 1, city_count, di, dp,
-                           next_city); // We compute the minimum cost route.
+// A function to print the progress of a solve to stderr.
+static void print_progress(const struct tsp_progress *progress, void *user) {
+  (void)user;
+  fprintf(stderr, "Progress: %s %5.1f%%",
+          progress->engine == TSP_ENGINE_DP ? "dp" : "heuristic",
+          100 * progress->done);
+  if (progress->incumbent != UINT64_MAX) {
+    fprintf(stderr, ", best %" PRIu64, progress->incumbent);
+  }
+  fprintf(stderr, ", bound %" PRIu64 "\n", progress->bound);
+}
 
-  if (result == NO_PATH) {
-    printf("No valid TSP route found.\n"); // Error handling in case the file
-                                           // only contains NO PATH routes.
+// A function to compute and print the cost of the cheapest path between
+// every pair of cities.
+static int solve_all_pairs(struct tsp_context *ctx,
+                           const struct options *options) {
+  int n = tsp_city_count(ctx);
+  uint64_t *costs = NULL;
+  enum tsp_status status = TSP_TOO_MANY_CITIES;
+  if (n <= TSP_ALL_PAIRS_MAX_CITIES) {
+    costs = malloc((n > 0 ? (size_t)n * n : 1) * sizeof(uint64_t));
+    status = costs ? tsp_solve_all_pairs(ctx, costs) : TSP_NO_MEMORY;
+  }
+  int failed = 0;
+  if (status == TSP_TOO_MANY_CITIES) {
+    fprintf(stderr, "Error: Too many cities for --all-pairs (maximum is %d).\n",
+            TSP_ALL_PAIRS_MAX_CITIES);
+    failed = 1;
+  } else if (status == TSP_CANCELLED) {
+    fprintf(stderr, "Interrupted before the paths were found.\n");
+    failed = 130;
+  } else if (status != TSP_OK && status != TSP_NO_ROUTE) {
+    failed = report_error(ctx, status, &options->solver, stderr);
   } else {
-    printf("We will visit the cities in the following order:\n"); // Result.
-    int current = 0;
-    uint64_t visited = 1;
-    uint64_t total_cost = 0;
-
-    while (1) {
-      int next = next_city[current][visited]; // Initialize next city.
-      if (next == -1) {
-        break; // Make sure there is path to the next city.
-      }
-
-      printf("%s -( %" PRIu64 " )-> %s\n", cities[current], di[current][next],
-             cities[next]);
-      total_cost += di[current][next]; // Total cost = sum of all min costs.
-      visited |= (1ULL << next);
-      current = next;
+    struct out_buffer out = {0};
+    output_all_pairs(&out, options->format, ctx, costs);
+    int incomplete = out.failed;
+    if (out_flush(&out, stdout) != 0) {
+      fprintf(stderr, incomplete ? "Error: Out of memory.\n"
+                                 : "Error writing the output\n");
+      failed = 1;
     }
-
-    printf("Total cost: %" PRIu64 "\n",
-           total_cost); // We print the total cost to visit the cities.
+    out_free(&out);
   }
+  free(costs);
+  return failed;
+}
 
-  // Free dynamically allocated memory
-  for (int i = 0; i < city_count; i++) {
-    free(dp[i]);
-    free(next_city[i]);
+// A function to compute and print the results of tsp solution. The output
+// is assembled in one buffer and written with a single call.
+static int solve_tsp(struct tsp_context *ctx, const struct options *options) {
+  if (options->all_pairs) {
+    return solve_all_pairs(ctx, options);
+  }
+  enum tsp_status status = tsp_solve(ctx);
+  if (status != TSP_OK && status != TSP_NO_ROUTE &&
+      status != TSP_CANCELLED) {
+    return report_error(ctx, status, &options->solver, stderr);
+  }
+  if (status == TSP_CANCELLED) {
+    fprintf(stderr, tsp_route_length(ctx) > 0
+                        ? "Interrupted: this is the best route found so "
+                          "far.\n"
+                        : "Interrupted before a route was found.\n");
+  }
+  struct out_buffer out = {0};
+  output_result(&out, options->format, ctx, status, NULL);
+  int failed = out.failed;
+  if (out_flush(&out, stdout) != 0) {
+    fprintf(stderr, failed ? "Error: Out of memory.\n"
+                           : "Error writing the output\n");
+    failed = 1;
   }
-  free(dp);
-  free(next_city);
+  out_free(&out);
+  if (status == TSP_CANCELLED) {
+    return 130; // The exit code of a run stopped by SIGINT.
+  }
+  return failed;
 }
 
-int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: ./tsp_solver <filename>\n"); // Error handling.
+// A function to compile an instance into the binary format, so later runs can
+// map it and start solving without parsing anything.
+static int compile_instance(const char *input, const char *output) {
+  struct tsp_context *ctx = tsp_context_create();
+  if (!ctx) {
+    fprintf(stderr, "Error: Out of memory.\n");
     return 1;
   }
+  struct tsp_options options;
+  tsp_default_options(&options);
+  enum tsp_status status = tsp_load_file(ctx, input);
+  int failed = 0;
+  if (status != TSP_OK && status != TSP_EMPTY) {
+    failed = report_error(ctx, status, &options, stderr);
+  } else if (tsp_write_binary(ctx, output) != TSP_OK) {
+    fprintf(stderr, "Error writing %s\n", output);
+    failed = 1;
+  }
+  tsp_context_destroy(ctx);
+  return failed;
+}
 
-  FILE *file = fopen(argv[1], "r");
-  if (!file) {
-    fprintf(stderr, "Error opening the file\n"); // Error handling.
-    return 1;
+// A function to parse an --engine=<name> option. Returns 0 on success.
+static int parse_engine(const char *arg, enum tsp_engine *engine) {
+  const char *name = arg + strlen("--engine=");
+  if (strcmp(name, "auto") == 0) {
+    *engine = TSP_ENGINE_AUTO;
+  } else if (strcmp(name, "dp") == 0) {
+    *engine = TSP_ENGINE_DP;
+  } else if (strcmp(name, "heuristic") == 0) {
+    *engine = TSP_ENGINE_HEURISTIC;
+  } else {
+    return -1;
   }
+  return 0;
+}
 
-  char *cities[MAX_CITIES]; // We store the cities set a unique index for each
-                            // city.
-  uint64_t di[MAX_CITIES][MAX_CITIES]; // We store the distances of all cities.
-  int city_count = 0;
+// A function to parse a --format=<name> option. Returns 0 on success.
+static int parse_format(const char *arg, enum output_format *format) {
+  const char *name = arg + strlen("--format=");
+  if (strcmp(name, "text") == 0) {
+    *format = OUTPUT_TEXT;
+  } else if (strcmp(name, "json") == 0) {
+    *format = OUTPUT_JSON;
+  } else if (strcmp(name, "csv") == 0) {
+    *format = OUTPUT_CSV;
+  } else if (strcmp(name, "binary") == 0) {
+    *format = OUTPUT_BINARY;
+  } else {
+    return -1;
+  }
+  return 0;
+}
 
-  for (int i = 0; i < MAX_CITIES; i++) { // Initialize the distances to NO PATH
-    for (int j = 0; j < MAX_CITIES; j++) {
-      di[i][j] = NO_PATH;
+static void print_usage(void) {
+  fprintf(stderr, "Usage: ./tsp_solver [--engine=auto|dp|heuristic] "
+                  "[--closure] [--quantize]\n"
+                  "                    [--matrix[=dense|triangular]] "
+                  "[--road=<graph>]\n"
+                  "                    [--cost=<plugin.so> "
+                  "[--cost-args=<string>]]\n"
+                  "                    [--updates=<file>] [--cache=<file>]\n"
+                  "                    [--format=text|json|csv|binary] "
+                  "[--progress]\n"
+                  "                    [--all-pairs] <filename>\n"
+                  "       ./tsp_solver [options] --batch "
+                  "<manifest|directory>\n"
+                  "       ./tsp_solver [options] --serve <socket>\n"
+                  "       ./tsp_solver --compile <filename> <output>\n");
+}
+
+// A function to parse the options in front of the file name. Returns the
+// index of the file name, or -1 after printing what went wrong.
+static int parse_options(int argc, char *argv[], struct options *options) {
+  memset(options, 0, sizeof(*options));
+  options->solver.engine = TSP_ENGINE_AUTO;
+  int arg = 1;
+  for (; arg < argc - 1; arg++) {
+    if (strncmp(argv[arg], "--engine=", strlen("--engine=")) == 0) {
+      if (parse_engine(argv[arg], &options->solver.engine) != 0) {
+        fprintf(stderr, "Error: Unknown engine %s\n", argv[arg]);
+        return -1;
+      }
+    } else if (strcmp(argv[arg], "--closure") == 0) {
+      options->solver.closure = 1;
+    } else if (strcmp(argv[arg], "--quantize") == 0) {
+      options->solver.quantize = 1;
+    } else if (strcmp(argv[arg], "--matrix") == 0 ||
+               strcmp(argv[arg], "--matrix=dense") == 0) {
+      options->solver.matrix = TSP_MATRIX_DENSE;
+    } else if (strcmp(argv[arg], "--matrix=triangular") == 0) {
+      options->solver.matrix = TSP_MATRIX_TRIANGULAR;
+    } else if (strncmp(argv[arg], "--road=", strlen("--road=")) == 0) {
+      options->solver.road = argv[arg] + strlen("--road=");
+    } else if (strncmp(argv[arg], "--cost=", strlen("--cost=")) == 0) {
+      options->solver.cost = argv[arg] + strlen("--cost=");
+    } else if (strncmp(argv[arg], "--cost-args=", strlen("--cost-args=")) ==
+               0) {
+      options->solver.cost_args = argv[arg] + strlen("--cost-args=");
+    } else if (strncmp(argv[arg], "--updates=", strlen("--updates=")) == 0) {
+      options->updates = argv[arg] + strlen("--updates=");
+    } else if (strcmp(argv[arg], "--batch") == 0) {
+      options->batch = 1;
+    } else if (strcmp(argv[arg], "--serve") == 0) {
+      options->serve = 1;
+    } else if (strncmp(argv[arg], "--format=", strlen("--format=")) == 0) {
+      if (parse_format(argv[arg], &options->format) != 0) {
+        fprintf(stderr, "Error: Unknown format %s\n", argv[arg]);
+        return -1;
+      }
+    } else if (strncmp(argv[arg], "--cache=", strlen("--cache=")) == 0) {
+      options->cache = argv[arg] + strlen("--cache=");
+    } else if (strcmp(argv[arg], "--progress") == 0) {
+      options->progress = 1;
+    } else if (strcmp(argv[arg], "--all-pairs") == 0) {
+      options->all_pairs = 1;
+    } else {
+      break;
     }
   }
+  if (arg != argc - 1) {
+    print_usage();
+    return -1;
+  }
+  if (options->updates &&
+      (options->solver.closure || options->solver.quantize ||
+       options->solver.matrix != TSP_MATRIX_NONE)) {
+    // Those build a new matrix from the distances, which a change would
+    // invalidate.
+    fprintf(stderr, "Error: --updates cannot be combined with --closure, "
+                    "--quantize or --matrix.\n");
+    return -1;
+  }
+  if (options->updates && options->batch) {
+    fprintf(stderr, "Error: --updates cannot be combined with --batch.\n");
+    return -1;
+  }
+  if (options->serve &&
+      (options->updates || options->batch || options->solver.road)) {
+    // Requests carry the instance itself, one at a time.
+    fprintf(stderr, "Error: --serve cannot be combined with --updates, "
+                    "--batch or --road.\n");
+    return -1;
+  }
+  if (options->all_pairs &&
+      (options->batch || options->serve || options->format == OUTPUT_BINARY)) {
+    fprintf(stderr, "Error: --all-pairs cannot be combined with --batch, "
+                    "--serve or --format=binary.\n");
+    return -1;
+  }
+  if (options->progress && (options->batch || options->serve)) {
+    fprintf(stderr,
+            "Error: --progress cannot be combined with --batch or --serve.\n");
+    return -1;
+  }
+  return arg;
+}
 
-  char line[100]; // Assuming each city doesn't have many characters, we store
-                  // the characters of the line in this array to then store the
-                  // seperate cities and distances to the corresponding tables.
-  while (fgets(line, sizeof(line), file)) {
-    char city1[512], city2[512]; // Use larger buffer for temporary storage
-    uint64_t distance;
-    if (sscanf(line, "%511[^-]-%511[^:]: %" SCNu64, city1, city2, &distance) !=
-        3) {
-      fprintf(stderr, "Error reading file\n");
-      fclose(file);
-      return 1;
-    }
+// A function to solve the instance, then apply the changes of the update
+// file line by line and solve again at every `solve` line, and at the end if
+// anything changed since the last one. Text routes are separated by blank
+// lines.
+static int solve_with_updates(struct tsp_context *ctx,
+                              const struct options *options) {
+  struct arena arena;
+  arena_init(&arena, 0);
+  struct mapped_file file;
+  if (map_file(options->updates, &file, &arena) != 0) {
+    fprintf(stderr, "Error opening %s\n", options->updates);
+    arena_free(&arena);
+    return 1;
+  }
 
-    // Check for city name length exceeding the limit.
-    if (strlen(city1) >= 512 || strlen(city2) >= 512) {
-      fprintf(stderr, "Error: City name exceeds the maximum allowed length of "
-                      "511 characters.\n"); // We suppose that the user will not attempt to visit a city with 511 characters length.
-      fclose(file);
-      return 1;
+  int exit_code = solve_tsp(ctx, options);
+  int changed = 0;
+  size_t line_number = 0;
+  const char *p = file.data;
+  const char *end = file.data + file.size;
+  while (exit_code == 0 && p < end) {
+    const char *eol = memchr(p, '\n', (size_t)(end - p));
+    if (!eol) {
+      eol = end;
     }
-
-    // Check and allocate memory for city1 if it's not already in the list
-    int city1_index = get_city_index(cities, city_count, city1);
-    if (city1_index == -1) {
-      cities[city_count] = malloc(strlen(city1) + 1);
-      strcpy(cities[city_count], city1);
-      city1_index = city_count++;
+    line_number++;
+    enum tsp_status status = tsp_update(ctx, p, (size_t)(eol - p));
+    if (status == TSP_SOLVE_LINE) {
+      if (options->format == OUTPUT_TEXT) {
+        printf("\n");
+      }
+      exit_code = solve_tsp(ctx, options);
+      changed = 0;
+    } else if (status == TSP_BAD_UPDATE) {
+      fprintf(stderr, "Error reading %s (line %zu)\n", options->updates,
+              line_number);
+      exit_code = 1;
+    } else if (status != TSP_OK) {
+      exit_code = report_error(ctx, status, &options->solver, stderr);
+    } else if (eol > p) {
+      changed = 1;
     }
-
-    // Check and allocate memory for city2 if it's not already in the list
-    int city2_index = get_city_index(cities, city_count, city2);
-    if (city2_index == -1) {
-      cities[city_count] = malloc(strlen(city2) + 1);
-      strcpy(cities[city_count], city2);
-      city2_index = city_count++;
+    p = eol + 1;
+  }
+  if (exit_code == 0 && changed) {
+    if (options->format == OUTPUT_TEXT) {
+      printf("\n");
     }
+    exit_code = solve_tsp(ctx, options);
+  }
+  unmap_file(&file);
+  arena_free(&arena);
+  return exit_code;
+}
 
-    di[city1_index][city2_index] = distance;
-    di[city2_index][city1_index] = distance;
+// A function to print the result of one instance of a batch. Text output
+// names the instance on a line of its own, JSON and CSV output in a field,
+// and errors go to err with the instance's path in front. Returns 1 if the
+// instance failed.
+static int print_batch_result(const struct tsp_context *ctx, const char *path,
+                              enum tsp_status status, FILE *out, FILE *err,
+                              const struct options *options) {
+  struct out_buffer buffer = {0};
+  if (options->format == OUTPUT_TEXT) {
+    out_string(&buffer, "Instance: ");
+    out_string(&buffer, path);
+    out_string(&buffer, "\n");
   }
+  int failed = 0;
+  if (status == TSP_OK || status == TSP_NO_ROUTE) {
+    output_result(&buffer, options->format, ctx, status, path);
+  } else {
+    if (options->format == OUTPUT_BINARY) {
+      output_binary(&buffer, ctx, status); // Keeps one frame per instance.
+    }
+    fprintf(err, "%s: ", path);
+    failed = report_error(ctx, status, &options->solver, err);
+  }
+  if (options->format == OUTPUT_TEXT) {
+    out_string(&buffer, "\n"); // Instances are separated by blank lines.
+  }
+  if (buffer.failed) {
+    failed = report_error(ctx, TSP_NO_MEMORY, &options->solver, err);
+  }
+  out_flush(&buffer, out);
+  out_free(&buffer);
+  return failed;
+}
 
-  fclose(file);
+// A function to load and solve a group of instances of a batch. Every
+// instance is loaded once, into the first context that is not waiting. Those
+// tsp_solve_many can put in lanes wait there and are solved together at the
+// end; the rest are solved and printed at once, which frees their context
+// for the next instance. The contexts share one set of DP tables.
+static void solve_batch_group(struct tsp_context *const *ctxs,
+                              const char *const *paths, int count,
+                              FILE *const *outs, FILE *const *errs,
+                              int *failed, void *user) {
+  const struct options *options = user;
+  int which[BATCH_GROUP]; // The instance each waiting context holds.
+  int waiting = 0;
+  for (int i = 0; i < count; i++) {
+    struct tsp_context *ctx = ctxs[waiting];
+    enum tsp_status status = tsp_load_file(ctx, paths[i]);
+    uint64_t scale, max_error;
+    if (status == TSP_OK && tsp_quantization(ctx, &scale, &max_error)) {
+      fprintf(errs[i], "%s: ", paths[i]);
+      report_quantization(ctx, errs[i]);
+    }
+    if (status == TSP_OK && tsp_lanes_eligible(ctx)) {
+      which[waiting++] = i;
+      continue;
+    }
+    if (status == TSP_OK) {
+      status = tsp_solve(ctx);
+    }
+    failed[i] =
+        print_batch_result(ctx, paths[i], status, outs[i], errs[i], options);
+  }
+  enum tsp_status statuses[BATCH_GROUP];
+  tsp_solve_many(ctxs, waiting, statuses);
+  for (int k = 0; k < waiting; k++) {
+    int i = which[k];
+    failed[i] = print_batch_result(ctxs[k], paths[i], statuses[k], outs[i],
+                                   errs[i], options);
+  }
+}
 
-  if (city_count > MAX_CITIES) {
-    fprintf(stderr, "Error: Too many cities (maximum is %d).\n", MAX_CITIES);
+// A function to solve every instance of a manifest or directory on all CPUs.
+// Returns 1 if any of them failed.
+static int solve_batch(const char *source, const struct options *options) {
+  struct arena arena;
+  arena_init(&arena, 0);
+  const char **paths;
+  int count;
+  if (batch_list_inputs(source, &arena, &paths, &count) != 0) {
+    fprintf(stderr, "Error opening %s\n", source);
+    arena_free(&arena);
     return 1;
   }
+  if (options->format == OUTPUT_CSV) {
+    fputs(output_csv_header(1), stdout);
+  }
+  int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int failures = batch_run(paths, count, threads, &options->solver,
+                           solve_batch_group, (void *)options);
+  if (failures < 0) {
+    fprintf(stderr, "Error: Out of memory.\n");
+  }
+  arena_free(&arena);
+  return failures != 0;
+}
 
-  if (city_count == 0) {
-    fprintf(
-        stderr,
-        "Error: The input file is empty or contains no valid data.\n"); // Handle
-                                                                        // empty
-                                                                        // files.
+// A function to load, solve and print a single instance.
+static int solve_file(const char *path, const struct options *options) {
+  // The context owns the instance and everything built from it, so a single
+  // call releases the names, edges and scratch memory.
+  struct tsp_context *ctx = tsp_context_create();
+  if (!ctx) {
+    fprintf(stderr, "Error: Out of memory.\n");
     return 1;
   }
+  tsp_set_options(ctx, &options->solver);
+  if (options->progress) {
+    tsp_set_progress(ctx, print_progress, NULL);
+  }
+  interruptible = ctx;
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_sigint;
+  action.sa_flags = SA_RESETHAND;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
 
-  solve_tsp(city_count, di, cities); // We compute and print the results.
+  int exit_code = 0;
+  enum tsp_status status = tsp_load_file(ctx, path);
+  if (status != TSP_OK) {
+    exit_code = report_error(ctx, status, &options->solver, stderr);
+  } else {
+    report_quantization(ctx, stderr);
+  }
+  if (exit_code == 0 && options->format == OUTPUT_CSV) {
+    fputs(options->all_pairs ? output_all_pairs_csv_header()
+                             : output_csv_header(0),
+          stdout);
+  }
+  if (exit_code == 0 && options->updates) {
+    exit_code = solve_with_updates(ctx, options);
+  } else if (exit_code == 0) {
+    // We compute and print the results.
+    exit_code = solve_tsp(ctx, options);
+  }
+  interruptible = NULL;
+  tsp_context_destroy(ctx);
+  return exit_code;
+}
 
-  for (int i = 0; i < city_count; i++) {
-    free(cities[i]);
+int main(int argc, char *argv[]) {
+  if (argc == 4 && strcmp(argv[1], "--compile") == 0) {
+    return compile_instance(argv[2], argv[3]);
+  }
+  struct options options;
+  int arg = parse_options(argc, argv, &options);
+  if (arg < 0) {
+    return 1;
+  }
+  if (options.cache) {
+    options.solver.cache = tsp_cache_open(options.cache, 0);
+    if (!options.solver.cache) {
+      fprintf(stderr, "Error: Could not open cache %s\n", options.cache);
+      return 1;
+    }
+  }
+  // The road graph is contracted once here and shared by every instance and
+  // thread.
+  if (options.solver.road) {
+    size_t error_line;
+    enum tsp_status status = tsp_road_open(
+        options.solver.road, &options.solver.road_graph, &error_line);
+    if (status != TSP_OK) {
+      if (status == TSP_OPEN_ERROR) {
+        fprintf(stderr, "Error opening %s\n", options.solver.road);
+      } else if (status == TSP_PARSE_ERROR) {
+        fprintf(stderr, "Error reading %s (line %zu)\n", options.solver.road,
+                error_line);
+      } else {
+        fprintf(stderr, "Error: Out of memory.\n");
+      }
+      tsp_cache_close(options.solver.cache);
+      return 1;
+    }
   }
 
-  return 0;
+  int exit_code;
+  if (options.batch) {
+    exit_code = solve_batch(argv[arg], &options);
+  } else if (options.serve) {
+    // A worker stays with a connection until it closes, so we start more
+    // workers than CPUs to keep idle clients from holding up others. Runs
+    // until the process is stopped.
+    int threads = 4 * (int)sysconf(_SC_NPROCESSORS_ONLN);
+    serve_run(argv[arg], threads, &options.solver);
+    fprintf(stderr, "Error: Could not serve on %s\n", argv[arg]);
+    exit_code = 1;
+  } else {
+    exit_code = solve_file(argv[arg], &options);
+  }
+  tsp_cache_close(options.solver.cache);
+  tsp_road_close(options.solver.road_graph);
+  return exit_code;
 }
@@ -0,0 +1,153 @@
+// All-pairs Hamiltonian paths from one sweep over the subsets.
+#include "allpairs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "distance.h"
+
+// The position of city among the cities of subset, counted from the lowest.
+static int rank(uint64_t subset, int city) {
+  return __builtin_popcountll(subset & ((1ULL << city) - 1));
+}
+
+// A function to find the cost of the path through subset from start to end.
+static uint64_t *entry(const struct all_pairs *pairs, uint64_t subset,
+                       int end, int start) {
+  int k = __builtin_popcountll(subset);
+  return pairs->costs + pairs->offsets[subset] +
+         (size_t)rank(subset, end) * k + rank(subset, start);
+}
+
+// A function to make room for the tables of city_count cities. Returns 0 on
+// success and -1 if we run out of memory.
+static int reserve(struct all_pairs *pairs, int city_count) {
+  size_t subsets = (size_t)1 << city_count;
+  size_t *offsets = realloc(pairs->offsets, subsets * sizeof(size_t));
+  if (!offsets) {
+    return -1;
+  }
+  pairs->offsets = offsets;
+  size_t total = 0;
+  for (size_t subset = 0; subset < subsets; subset++) {
+    size_t k = (size_t)__builtin_popcountll(subset);
+    offsets[subset] = total;
+    total += k * k;
+  }
+  if (total > pairs->capacity) {
+    free(pairs->costs);
+    pairs->costs = malloc(total * sizeof(uint64_t));
+    pairs->capacity = pairs->costs ? total : 0;
+    if (!pairs->costs) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// A function to relax a row of path costs with one more edge of cost step.
+// to[r] is the path to the new last city from the r-th first city, from[r]
+// the path from the same first city to the old last one.
+static void relax(uint64_t *to, const uint64_t *from, int count,
+                  uint64_t step) {
+  for (int r = 0; r < count; r++) {
+    uint64_t cost = from[r] == NO_PATH ? NO_PATH : from[r] + step;
+    to[r] = cost < to[r] ? cost : to[r];
+  }
+}
+
+int all_pairs_sweep(struct all_pairs *pairs, const uint64_t *di,
+                    int city_count, struct monitor *monitor) {
+  int n = city_count;
+  pairs->city_count = 0;
+  if (reserve(pairs, n) != 0) {
+    return -1;
+  }
+  memcpy(pairs->di, di, (size_t)n * n * sizeof(uint64_t));
+  struct tsp_progress progress = {TSP_ENGINE_DP, 0, NO_PATH, 0};
+  uint64_t subsets = 1ULL << n;
+
+  // Every subset comes after those it is built from, which are smaller
+  // numbers.
+  for (uint64_t subset = 1; subset < subsets; subset++) {
+    if (subset % MONITOR_STEPS == 0) {
+      progress.done = (double)subset / subsets;
+      if (monitor_tick(monitor, &progress, 0)) {
+        return 1;
+      }
+    }
+    int k = __builtin_popcountll(subset);
+    uint64_t *block = pairs->costs + pairs->offsets[subset];
+    if (k == 1) {
+      block[0] = 0; // A path of one city.
+      continue;
+    }
+    for (int i = 0; i < k * k; i++) {
+      block[i] = NO_PATH;
+    }
+    // The first cities of the smaller subset keep their rank, except those
+    // after the removed last city, which move down by one.
+    int last_rank = 0;
+    for (uint64_t lasts = subset; lasts; lasts &= lasts - 1, last_rank++) {
+      int last = __builtin_ctzll(lasts);
+      uint64_t smaller = subset & ~(1ULL << last);
+      const uint64_t *before = pairs->costs + pairs->offsets[smaller];
+      uint64_t *row = block + (size_t)last_rank * k;
+      int before_rank = 0;
+      for (uint64_t rest = smaller; rest; rest &= rest - 1, before_rank++) {
+        int previous = __builtin_ctzll(rest);
+        uint64_t step = di[previous * n + last];
+        if (step == NO_PATH) {
+          continue;
+        }
+        const uint64_t *from = before + (size_t)before_rank * (k - 1);
+        relax(row, from, last_rank, step);
+        relax(row + last_rank + 1, from + last_rank, k - 1 - last_rank, step);
+      }
+    }
+  }
+  pairs->city_count = n;
+  progress.done = 1;
+  monitor_tick(monitor, &progress, 1);
+  return 0;
+}
+
+uint64_t all_pairs_cost(const struct all_pairs *pairs, int start, int end) {
+  uint64_t all = (1ULL << pairs->city_count) - 1;
+  return *entry(pairs, all, end, start);
+}
+
+int all_pairs_route(const struct all_pairs *pairs, int start, int end,
+                    int *route) {
+  int n = pairs->city_count;
+  uint64_t subset = (1ULL << n) - 1;
+  uint64_t cost = *entry(pairs, subset, end, start);
+  if (cost == NO_PATH) {
+    return 0;
+  }
+  // We walk back from the end: the city before it is one whose path through
+  // the rest, plus the edge, makes up the cost.
+  route[n - 1] = end;
+  for (int position = n - 1; position > 0; position--) {
+    int last = route[position];
+    subset &= ~(1ULL << last);
+    int previous = -1;
+    for (uint64_t rest = subset; rest && previous < 0; rest &= rest - 1) {
+      int city = __builtin_ctzll(rest);
+      uint64_t step = pairs->di[city * n + last];
+      uint64_t before = *entry(pairs, subset, city, start);
+      if (step != NO_PATH && before != NO_PATH && before + step == cost) {
+        previous = city;
+        cost = before;
+      }
+    }
+    route[position - 1] = previous;
+  }
+  return n;
+}
+
+void all_pairs_free(struct all_pairs *pairs) {
+  free(pairs->offsets);
+  free(pairs->costs);
+  memset(pairs, 0, sizeof(*pairs));
+}
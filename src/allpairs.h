@@ -0,0 +1,46 @@
+// The cheapest path through every city for every pair of first and last
+// city, from one bottom-up sweep of the DP over the subsets of cities. For
+// every subset S we keep the cost of the cheapest path through S from each of
+// its cities to each other one; a path through S that ends at j is a path
+// through S - {j} followed by one edge into j, so every subset is built from
+// the subsets one smaller.
+//
+// A subset of k cities holds a k x k block, so the table has about
+// n^2 2^n / 4 costs, and the sweep takes O(n^3 2^n / 8) time: that of
+// running the fixed-start DP once per start city, but for all n^2 pairs.
+// Blocks are stored by last city, then first city, so the inner loop runs
+// over contiguous costs.
+#ifndef TSP_ALLPAIRS_H
+#define TSP_ALLPAIRS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "progress.h"
+#include "tsp.h"
+
+struct all_pairs {
+  int city_count; // The cities of the last sweep, 0 if there is none.
+  uint64_t di[TSP_ALL_PAIRS_MAX_CITIES * TSP_ALL_PAIRS_MAX_CITIES];
+  size_t *offsets; // Where the block of every subset starts.
+  uint64_t *costs;
+  size_t capacity; // Of costs; the tables only grow.
+};
+
+// Runs the sweep on the city_count x city_count distances di (NO_PATH for a
+// missing edge), which are copied. Returns 0 on success, 1 if the monitor
+// cancelled the sweep and -1 if we run out of memory.
+int all_pairs_sweep(struct all_pairs *pairs, const uint64_t *di,
+                    int city_count, struct monitor *monitor);
+
+// The cost of the cheapest path through every city from start to end, or
+// NO_PATH if there is none. With more than one city, start and end differ.
+uint64_t all_pairs_cost(const struct all_pairs *pairs, int start, int end);
+
+// Fills route with that path and returns its length, or 0 if there is none.
+int all_pairs_route(const struct all_pairs *pairs, int start, int end,
+                    int *route);
+
+void all_pairs_free(struct all_pairs *pairs);
+
+#endif
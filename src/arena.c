@@ -0,0 +1,121 @@
+// Bump allocation out of a chain of large blocks.
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void arena_init(struct arena *arena, size_t block_size) {
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->block_size = block_size ? block_size : (size_t)1 << 20;
+  arena->last = NULL;
+}
+
+static size_t align_up(size_t value, size_t align) {
+  return (value + align - 1) & ~(align - 1);
+}
+
+// A function to make room for size bytes. We first move on to blocks kept from
+// before a reset, and only allocate a new block when none of them fits.
+static struct arena_block *next_block(struct arena *arena, size_t size) {
+  struct arena_block *block = arena->current ? arena->current->next : NULL;
+  while (block && block->size < size) {
+    block = block->next;
+  }
+  if (block) {
+    // Blocks we skip over stay in the chain after the one we use.
+    block->used = 0;
+    arena->current = block;
+    return block;
+  }
+
+  size_t block_size = size > arena->block_size ? size : arena->block_size;
+  block = aligned_alloc(64, align_up(sizeof(*block) + block_size, 64));
+  if (!block) {
+    return NULL;
+  }
+  block->size = block_size;
+  block->used = 0;
+  if (arena->current) {
+    block->next = arena->current->next;
+    arena->current->next = block;
+  } else {
+    block->next = arena->first;
+    arena->first = block;
+  }
+  arena->current = block;
+  return block;
+}
+
+void *arena_alloc(struct arena *arena, size_t size, size_t align) {
+  struct arena_block *block = arena->current;
+  size_t offset = block ? align_up(block->used, align) : 0;
+  if (!block || offset > block->size || block->size - offset < size) {
+    block = next_block(arena, size);
+    if (!block) {
+      return NULL;
+    }
+    offset = 0;
+  }
+  block->used = offset + size;
+  arena->last = block->data + offset;
+  return arena->last;
+}
+
+void *arena_calloc(struct arena *arena, size_t size, size_t align) {
+  void *ptr = arena_alloc(arena, size, align);
+  if (ptr) {
+    memset(ptr, 0, size);
+  }
+  return ptr;
+}
+
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size,
+                 size_t new_size, size_t align) {
+  if (!ptr) {
+    return arena_alloc(arena, new_size, align);
+  }
+  struct arena_block *block = arena->current;
+  if (ptr == arena->last) {
+    size_t offset = (size_t)((char *)ptr - block->data);
+    if (block->size - offset >= new_size) {
+      block->used = offset + new_size; // We are on top, so just bump further.
+      return ptr;
+    }
+  }
+  void *grown = arena_alloc(arena, new_size, align);
+  if (grown) {
+    memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+  }
+  return grown;
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t len) {
+  char *copy = arena_alloc(arena, len + 1, 1);
+  if (copy) {
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+  }
+  return copy;
+}
+
+void arena_reset(struct arena *arena) {
+  if (arena->first) {
+    arena->first->used = 0;
+  }
+  arena->current = arena->first;
+  arena->last = NULL;
+}
+
+void arena_free(struct arena *arena) {
+  struct arena_block *block = arena->first;
+  while (block) {
+    struct arena_block *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->last = NULL;
+}
@@ -0,0 +1,45 @@
+// A bump allocator. Everything that lives as long as one instance (city names,
+// the name table, the parsed edges and parse scratch) is carved out of an
+// arena and released in one shot, and the arena keeps its blocks so the next
+// instance can reuse them without going back to malloc.
+#ifndef TSP_ARENA_H
+#define TSP_ARENA_H
+
+#include <stddef.h>
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size; // The number of usable bytes in data.
+  size_t used;
+  _Alignas(64) char data[];
+};
+
+struct arena {
+  struct arena_block *first;
+  struct arena_block *current;
+  size_t block_size; // The minimum size of a new block.
+  void *last;        // The most recent allocation, which we can grow in place.
+};
+
+void arena_init(struct arena *arena, size_t block_size);
+
+// Returns size bytes aligned to align (a power of two, at most 64), or NULL if
+// we run out of memory. The memory is not zeroed.
+void *arena_alloc(struct arena *arena, size_t size, size_t align);
+void *arena_calloc(struct arena *arena, size_t size, size_t align);
+
+// Resizes an allocation from old_size to new_size bytes. The most recent
+// allocation is extended in place when the block has room; anything else is
+// copied to a new allocation.
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size,
+                 size_t new_size, size_t align);
+
+char *arena_strndup(struct arena *arena, const char *str, size_t len);
+
+// Releases every allocation at once but keeps the blocks for reuse.
+void arena_reset(struct arena *arena);
+
+// Returns every block to the system.
+void arena_free(struct arena *arena);
+
+#endif
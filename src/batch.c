@@ -0,0 +1,298 @@
+// Batch mode: the instance list and the thread pool.
+#include "batch.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "parser.h"
+
+// What one instance printed, kept until every instance before it is written.
+struct batch_result {
+  char *out;
+  size_t out_len;
+  char *err;
+  size_t err_len;
+  int done;
+  int failed;
+};
+
+// Everything the threads share, guarded by lock.
+struct batch_work {
+  const char *const *paths;
+  int count;
+  batch_solve_fn solve;
+  void *user;
+  struct batch_result *results;
+  pthread_mutex_t lock;
+  int group;   // How many instances a thread takes at once.
+  int next;    // The next instance to hand out.
+  int written; // The next instance to write.
+  int failures;
+};
+
+struct batch_worker {
+  struct batch_work *work;
+  struct tsp_context *ctxs[BATCH_GROUP]; // work->group of them.
+};
+
+// A function to append a path to the list, doubling its room when full.
+static int add_path(struct arena *arena, const char ***paths, int *count,
+                    int *capacity, const char *path, size_t len) {
+  if (*count == *capacity) {
+    int grown = *capacity ? *capacity * 2 : 64;
+    const char **list =
+        arena_grow(arena, (void *)*paths, *capacity * sizeof(char *),
+                   grown * sizeof(char *), sizeof(char *));
+    if (!list) {
+      return -1;
+    }
+    *paths = list;
+    *capacity = grown;
+  }
+  char *copy = arena_strndup(arena, path, len);
+  if (!copy) {
+    return -1;
+  }
+  (*paths)[(*count)++] = copy;
+  return 0;
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// A function to list the regular files of a directory in name order.
+static int list_directory(const char *dir, struct arena *arena,
+                          const char ***paths, int *count) {
+  DIR *d = opendir(dir);
+  if (!d) {
+    return -1;
+  }
+  int capacity = 0;
+  size_t dir_len = strlen(dir);
+  char *path = NULL;
+  size_t path_capacity = 0;
+  int status = 0;
+  struct dirent *entry;
+  while (status == 0 && (entry = readdir(d)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue; // ".", ".." and hidden files.
+    }
+    size_t len = dir_len + 1 + strlen(entry->d_name);
+    if (len + 1 > path_capacity) {
+      char *grown = realloc(path, len + 1);
+      if (!grown) {
+        status = -1;
+        break;
+      }
+      path = grown;
+      path_capacity = len + 1;
+    }
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    strcpy(path + dir_len + 1, entry->d_name);
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+      status = add_path(arena, paths, count, &capacity, path, len);
+    }
+  }
+  free(path);
+  closedir(d);
+  if (status == 0 && *count > 1) {
+    qsort((void *)*paths, *count, sizeof(char *), compare_paths);
+  }
+  return status;
+}
+
+int batch_list_inputs(const char *source, struct arena *arena,
+                      const char ***paths, int *count) {
+  *paths = NULL;
+  *count = 0;
+  struct stat st;
+  if (stat(source, &st) == 0 && S_ISDIR(st.st_mode)) {
+    return list_directory(source, arena, paths, count);
+  }
+
+  struct mapped_file file;
+  if (map_file(source, &file, arena) != 0) {
+    return -1;
+  }
+  int capacity = 0;
+  int status = 0;
+  const char *p = file.data;
+  const char *end = file.data + file.size;
+  while (status == 0 && p < end) {
+    const char *eol = memchr(p, '\n', (size_t)(end - p));
+    if (!eol) {
+      eol = end;
+    }
+    size_t len = (size_t)(eol - p);
+    if (len > 0 && p[len - 1] == '\r') {
+      len--; // Accept manifests with Windows line endings.
+    }
+    if (len > 0 && p[0] != '#') {
+      status = add_path(arena, paths, count, &capacity, p, len);
+    }
+    p = eol + 1;
+  }
+  unmap_file(&file);
+  return status;
+}
+
+// A function to solve the count instances from first on and keep what they
+// printed.
+static void solve_group(struct batch_work *work, struct batch_worker *worker,
+                        int first, int count) {
+  FILE *outs[BATCH_GROUP];
+  FILE *errs[BATCH_GROUP];
+  int failed[BATCH_GROUP];
+  int opened = 1;
+  for (int k = 0; k < count; k++) {
+    struct batch_result *result = &work->results[first + k];
+    outs[k] = open_memstream(&result->out, &result->out_len);
+    errs[k] = open_memstream(&result->err, &result->err_len);
+    opened = opened && outs[k] && errs[k];
+  }
+  if (opened) {
+    work->solve(worker->ctxs, work->paths + first, count, outs, errs, failed,
+                work->user);
+  }
+  for (int k = 0; k < count; k++) {
+    struct batch_result *result = &work->results[first + k];
+    result->failed = opened ? failed[k] : 1;
+    if (outs[k]) {
+      fclose(outs[k]);
+    }
+    if (errs[k]) {
+      fclose(errs[k]);
+    }
+    if (!outs[k] || !errs[k]) {
+      free(result->out);
+      free(result->err);
+      result->out = NULL;
+      result->err = NULL;
+      result->out_len = 0;
+      result->err_len = 0;
+    }
+  }
+}
+
+// A function to write the finished instances that are next in input order.
+// Called with lock held, so only one thread writes at a time.
+static void write_results(struct batch_work *work) {
+  while (work->written < work->count && work->results[work->written].done) {
+    struct batch_result *result = &work->results[work->written];
+    if (!result->out || !result->err) {
+      fprintf(stderr, "Error: Out of memory.\n");
+    }
+    if (result->out_len > 0) {
+      fwrite(result->out, 1, result->out_len, stdout);
+      fflush(stdout);
+    }
+    if (result->err_len > 0) {
+      fwrite(result->err, 1, result->err_len, stderr);
+    }
+    free(result->out);
+    free(result->err);
+    result->out = NULL;
+    result->err = NULL;
+    work->failures += result->failed;
+    work->written++;
+  }
+}
+
+static void *batch_thread(void *arg) {
+  struct batch_worker *worker = arg;
+  struct batch_work *work = worker->work;
+  pthread_mutex_lock(&work->lock);
+  while (work->next < work->count) {
+    int first = work->next;
+    int count = work->count - first < work->group ? work->count - first
+                                                  : work->group;
+    work->next += count;
+    pthread_mutex_unlock(&work->lock);
+    solve_group(work, worker, first, count);
+    pthread_mutex_lock(&work->lock);
+    for (int k = 0; k < count; k++) {
+      work->results[first + k].done = 1;
+    }
+    write_results(work);
+  }
+  pthread_mutex_unlock(&work->lock);
+  return NULL;
+}
+
+int batch_run(const char *const *paths, int count, int threads,
+              const struct tsp_options *options, batch_solve_fn solve,
+              void *user) {
+  if (threads > BATCH_MAX_THREADS) {
+    threads = BATCH_MAX_THREADS;
+  }
+  if (threads > count) {
+    threads = count;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+  // Groups are as large as they can be while every thread still gets one.
+  int group = count / threads;
+  if (group > BATCH_GROUP) {
+    group = BATCH_GROUP;
+  }
+  if (group < 1) {
+    group = 1;
+  }
+  struct batch_work work = {.paths = paths,
+                            .count = count,
+                            .solve = solve,
+                            .user = user,
+                            .group = group};
+  work.results = calloc(count > 0 ? count : 1, sizeof(struct batch_result));
+  struct batch_worker workers[BATCH_MAX_THREADS];
+  int per_worker = group;
+  int created = 0; // Contexts, over all workers.
+  for (; work.results && created < threads * per_worker; created++) {
+    struct batch_worker *worker = &workers[created / per_worker];
+    struct tsp_context **ctx = &worker->ctxs[created % per_worker];
+    worker->work = &work;
+    *ctx = tsp_context_create();
+    if (!*ctx) {
+      break;
+    }
+    tsp_set_options(*ctx, options);
+    // A thread solves in one context at a time, so one set of DP tables
+    // does for all of them.
+    tsp_share_tables(*ctx, worker->ctxs[0]);
+  }
+  if (!work.results || created < threads * per_worker) {
+    for (int c = 0; c < created; c++) {
+      tsp_context_destroy(workers[c / per_worker].ctxs[c % per_worker]);
+    }
+    free(work.results);
+    return -1;
+  }
+  pthread_mutex_init(&work.lock, NULL);
+
+  // The first worker runs on the calling thread.
+  pthread_t handles[BATCH_MAX_THREADS];
+  int started[BATCH_MAX_THREADS] = {0};
+  for (int t = 1; t < threads; t++) {
+    started[t] =
+        pthread_create(&handles[t], NULL, batch_thread, &workers[t]) == 0;
+  }
+  batch_thread(&workers[0]);
+  for (int t = 1; t < threads; t++) {
+    if (started[t]) {
+      pthread_join(handles[t], NULL);
+    }
+  }
+  for (int c = 0; c < created; c++) {
+    tsp_context_destroy(workers[c / per_worker].ctxs[c % per_worker]);
+  }
+  pthread_mutex_destroy(&work.lock);
+  free(work.results);
+  return work.failures;
+}
@@ -0,0 +1,44 @@
+// Batch mode: many instances solved in one process. A pool of threads takes
+// the instances in turn, a few at a time, each thread with contexts of its
+// own, so its arenas, route buffers and DP tables are reused from one
+// instance to the next. The output of every instance is collected and written
+// in input order, as soon as all instances before it are done.
+#ifndef TSP_BATCH_H
+#define TSP_BATCH_H
+
+#include <stdio.h>
+
+#include "arena.h"
+#include "tsp.h"
+
+#define BATCH_MAX_THREADS 64
+#define BATCH_GROUP 32 // The most instances a thread takes at once.
+
+// Solves the count instances at paths and writes what instance i has to say
+// to outs[i] and errs[i]. ctxs has count contexts or more, the same ones for
+// every group of a thread, and they share the tables of ctxs[0] (see
+// tsp_share_tables). Taking several instances at once lets the small ones be
+// solved together (see tsp_solve_many). Sets failed[i] to 1 if instance i
+// failed and 0 if not.
+typedef void (*batch_solve_fn)(struct tsp_context *const *ctxs,
+                               const char *const *paths, int count,
+                               FILE *const *outs, FILE *const *errs,
+                               int *failed, void *user);
+
+// Lists the instances of a batch. source is either a manifest, with one path
+// per line (blank lines and lines starting with '#' are skipped), or a
+// directory, whose regular files are taken in name order. The paths are
+// allocated from arena. Returns 0 on success and -1 if source cannot be read
+// or we run out of memory.
+int batch_list_inputs(const char *source, struct arena *arena,
+                      const char ***paths, int *count);
+
+// Solves every path on threads threads, each with contexts set to options,
+// and writes the output of each instance to stdout and stderr in input order.
+// Returns the number of instances that failed, or -1 if we run out of memory
+// before starting.
+int batch_run(const char *const *paths, int count, int threads,
+              const struct tsp_options *options, batch_solve_fn solve,
+              void *user);
+
+#endif
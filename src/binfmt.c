@@ -0,0 +1,263 @@
+// Reading and writing the compiled binary instance format.
+#include "binfmt.h"
+
+#include <string.h>
+
+static uint64_t align64(uint64_t value) { return (value + 63) & ~(uint64_t)63; }
+
+int is_tspb(const char *data, size_t size) {
+  return size >= sizeof(struct tspb_header) &&
+         memcmp(data, TSPB_MAGIC, 4) == 0;
+}
+
+// A function to check that [offset, offset + length) lies inside the file.
+static int in_bounds(uint64_t offset, uint64_t length, size_t size) {
+  return offset <= size && length <= size - offset;
+}
+
+int tspb_load(const char *data, size_t size, struct arena *arena,
+              struct instance *instance) {
+  struct tspb_header h;
+  memcpy(&h, data, sizeof(h));
+  if (h.version != TSPB_VERSION || h.byte_order != TSPB_BYTE_ORDER ||
+      h.file_size != size || h.city_count > INT32_MAX) {
+    return -1;
+  }
+  uint64_t n = h.city_count;
+
+  // The name table.
+  if ((h.names_offset & 63) != 0 ||
+      !in_bounds(h.names_offset, (n + 1) * sizeof(uint64_t), size)) {
+    return -1;
+  }
+  const uint64_t *name_offsets = (const uint64_t *)(data + h.names_offset);
+  const char *name_bytes = (const char *)(name_offsets + n + 1);
+  if (!in_bounds((uint64_t)(name_bytes - data), name_offsets[n], size)) {
+    return -1;
+  }
+  struct span *cities = arena_alloc(arena, n * sizeof(struct span), 8);
+  if (!cities && n > 0) {
+    return -1;
+  }
+  for (uint64_t i = 0; i < n; i++) {
+    if (name_offsets[i] > name_offsets[i + 1]) {
+      return -1;
+    }
+    cities[i].ptr = name_bytes + name_offsets[i];
+    cities[i].len = name_offsets[i + 1] - name_offsets[i];
+  }
+
+  instance->city_count = (int)n;
+  instance->symmetric = (h.flags & TSPB_SYMMETRIC) != 0;
+  instance->cities = cities;
+
+  // The distance block. Every layout is used in place.
+  const char *block = data + h.distances_offset;
+  if ((h.distances_offset & 63) != 0) {
+    return -1;
+  }
+  switch (h.layout) {
+  case TSPB_DENSE: {
+    uint64_t stride = (n + 7) & ~(uint64_t)7;
+    if (!in_bounds(h.distances_offset, n * stride * sizeof(uint64_t), size)) {
+      return -1;
+    }
+    dense_distance_init(&instance->dense, (int)n, (const uint64_t *)block,
+                        stride);
+    instance->distance = &instance->dense.base;
+    break;
+  }
+  case TSPB_TRIANGULAR: {
+    uint64_t entries = n * (n ? n - 1 : 0) / 2;
+    if (!in_bounds(h.distances_offset, entries * sizeof(uint64_t), size)) {
+      return -1;
+    }
+    triangular_distance_init(&instance->triangular, (int)n,
+                             (const uint64_t *)block);
+    instance->distance = &instance->triangular.base;
+    break;
+  }
+  case TSPB_CSR: {
+    uint64_t m = h.edge_count;
+    uint64_t cols_offset = align64((n + 1) * sizeof(uint64_t));
+    uint64_t weights_offset = cols_offset + align64(m * sizeof(uint32_t));
+    if (!in_bounds(h.distances_offset, weights_offset + m * sizeof(uint64_t),
+                   size)) {
+      return -1;
+    }
+    const uint64_t *row_offsets = (const uint64_t *)block;
+    const uint32_t *cols = (const uint32_t *)(block + cols_offset);
+    if (row_offsets[n] != m) {
+      return -1;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+      if (row_offsets[i] > row_offsets[i + 1]) {
+        return -1;
+      }
+    }
+    for (uint64_t e = 0; e < m; e++) {
+      if (cols[e] >= n) {
+        return -1;
+      }
+    }
+    instance->graph.city_count = (int)n;
+    instance->graph.edge_count = m;
+    instance->graph.row_offsets = row_offsets;
+    instance->graph.cols = cols;
+    instance->graph.weights = (const uint64_t *)(block + weights_offset);
+    csr_distance_init(&instance->csr, &instance->graph);
+    instance->distance = &instance->csr.base;
+    break;
+  }
+  case TSPB_COORDS: {
+    uint64_t y_offset = align64(n * sizeof(double));
+    if (h.weight_type > TSPLIB_ATT || h.weight_type == TSPLIB_EXPLICIT ||
+        !in_bounds(h.distances_offset, y_offset + n * sizeof(double), size)) {
+      return -1;
+    }
+    struct tsplib_instance *tsplib = &instance->tsplib;
+    tsplib->dimension = (int)n;
+    tsplib->symmetric = 1;
+    tsplib->weight_type = (enum tsplib_weight_type)h.weight_type;
+    tsplib->x = (double *)block;
+    tsplib->y = (double *)(block + y_offset);
+    tsplib->names = cities;
+    coord_distance_init(&instance->coord, tsplib);
+    instance->distance = &instance->coord.base;
+    break;
+  }
+  default:
+    return -1;
+  }
+  return 0;
+}
+
+// The writer keeps track of the file position so it can pad to alignment.
+struct writer {
+  FILE *out;
+  uint64_t pos;
+  int failed;
+};
+
+static void write_bytes(struct writer *w, const void *data, size_t size) {
+  if (size > 0 && fwrite(data, 1, size, w->out) != size) {
+    w->failed = 1;
+  }
+  w->pos += size;
+}
+
+static void write_padding(struct writer *w) {
+  static const char zeros[64];
+  write_bytes(w, zeros, align64(w->pos) - w->pos);
+}
+
+int tspb_write(FILE *out, const struct instance *instance,
+               struct arena *arena) {
+  uint64_t n = (uint64_t)instance->city_count;
+  struct tspb_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TSPB_MAGIC, 4);
+  h.version = TSPB_VERSION;
+  h.byte_order = TSPB_BYTE_ORDER;
+  h.flags = instance->symmetric ? TSPB_SYMMETRIC : 0;
+  h.city_count = (uint32_t)n;
+
+  // We pick the layout. Coordinates stay coordinates, sparse graphs stay CSR
+  // while that is smaller than one triangle of the matrix (12 bytes per stored
+  // entry against 8 per pair), other symmetric instances keep one triangle and
+  // the rest a full matrix.
+  const struct csr_graph *graph = NULL;
+  if (instance->distance == &instance->coord.base) {
+    h.layout = TSPB_COORDS;
+    h.weight_type = (uint32_t)instance->tsplib.weight_type;
+  } else if (instance->distance == &instance->csr.base &&
+             (!instance->symmetric ||
+              3 * instance->graph.edge_count < n * (n ? n - 1 : 0))) {
+    h.layout = TSPB_CSR;
+    graph = &instance->graph;
+  } else {
+    h.layout = instance->symmetric ? TSPB_TRIANGULAR : TSPB_DENSE;
+  }
+  if (graph) {
+    h.edge_count = graph->edge_count;
+  }
+
+  // We lay the file out before writing it, so the header can be complete.
+  uint64_t name_bytes = 0;
+  for (uint64_t i = 0; i < n; i++) {
+    name_bytes += instance->cities[i].len;
+  }
+  h.names_offset = align64(sizeof(h));
+  h.distances_offset =
+      align64(h.names_offset + (n + 1) * sizeof(uint64_t) + name_bytes);
+  uint64_t stride = (n + 7) & ~(uint64_t)7;
+  switch (h.layout) {
+  case TSPB_DENSE:
+    h.file_size = h.distances_offset + n * stride * sizeof(uint64_t);
+    break;
+  case TSPB_TRIANGULAR:
+    h.file_size =
+        h.distances_offset + n * (n ? n - 1 : 0) / 2 * sizeof(uint64_t);
+    break;
+  case TSPB_CSR:
+    h.file_size = h.distances_offset +
+                  align64((n + 1) * sizeof(uint64_t)) +
+                  align64(h.edge_count * sizeof(uint32_t)) +
+                  h.edge_count * sizeof(uint64_t);
+    break;
+  default:
+    h.file_size = h.distances_offset + align64(n * sizeof(double)) +
+                  n * sizeof(double);
+    break;
+  }
+
+  struct writer w = {out, 0, 0};
+  write_bytes(&w, &h, sizeof(h));
+  write_padding(&w);
+
+  uint64_t offset = 0;
+  write_bytes(&w, &offset, sizeof(offset));
+  for (uint64_t i = 0; i < n; i++) {
+    offset += instance->cities[i].len;
+    write_bytes(&w, &offset, sizeof(offset));
+  }
+  for (uint64_t i = 0; i < n; i++) {
+    write_bytes(&w, instance->cities[i].ptr, instance->cities[i].len);
+  }
+  write_padding(&w);
+
+  if (h.layout == TSPB_COORDS) {
+    write_bytes(&w, instance->tsplib.x, n * sizeof(double));
+    write_padding(&w);
+    write_bytes(&w, instance->tsplib.y, n * sizeof(double));
+  } else if (h.layout == TSPB_CSR) {
+    write_bytes(&w, graph->row_offsets, (n + 1) * sizeof(uint64_t));
+    write_padding(&w);
+    write_bytes(&w, graph->cols, graph->edge_count * sizeof(uint32_t));
+    write_padding(&w);
+    write_bytes(&w, graph->weights, graph->edge_count * sizeof(uint64_t));
+  } else {
+    // We pull the matrix from the distance backend one row at a time.
+    int *js = arena_alloc(arena, n * sizeof(int), 64);
+    uint64_t *row = arena_alloc(arena, stride * sizeof(uint64_t), 64);
+    if ((!js || !row) && n > 0) {
+      return -1;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+      js[i] = (int)i;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+      if (h.layout == TSPB_DENSE) {
+        memset(row, 0xff, stride * sizeof(uint64_t));
+        distance_batch(instance->distance, (int)i, js, (int)n, row);
+        write_bytes(&w, row, stride * sizeof(uint64_t));
+      } else {
+        int count = (int)(n - i - 1);
+        distance_batch(instance->distance, (int)i, js + i + 1, count, row);
+        write_bytes(&w, row, (size_t)count * sizeof(uint64_t));
+      }
+    }
+  }
+
+  return w.failed || w.pos != h.file_size ? -1 : 0;
+}
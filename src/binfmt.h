@@ -0,0 +1,70 @@
+// The compiled binary instance format written by `tsp_solver --compile`.
+//
+// A file is a 64-byte header followed by the name table and the distance
+// block, each starting on a 64-byte boundary so the distances can be used
+// straight from the mapping with aligned SIMD loads. All integers are in the
+// byte order of the machine that wrote the file; byte_order lets the reader
+// reject files from a machine with the other order.
+//
+// Name table: uint64_t offsets[n + 1] into the name bytes that follow them.
+//
+// Distance block, depending on layout:
+//   TSPB_DENSE       n rows of uint64_t, each padded to a multiple of 8 entries
+//   TSPB_TRIANGULAR  the strict upper triangle, n * (n - 1) / 2 uint64_t
+//   TSPB_CSR         uint64_t row_offsets[n + 1], uint32_t cols[edge_count],
+//                    uint64_t weights[edge_count], each array 64-byte aligned
+//   TSPB_COORDS      double x[n], double y[n], each array 64-byte aligned,
+//                    with the TSPLIB weight type in weight_type
+#ifndef TSP_BINFMT_H
+#define TSP_BINFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "instance.h"
+
+#define TSPB_MAGIC "TSPB"
+#define TSPB_VERSION 1
+#define TSPB_BYTE_ORDER 0x01020304u
+
+#define TSPB_SYMMETRIC 0x1u // Distances do not depend on the direction.
+
+enum tspb_layout {
+  TSPB_DENSE,
+  TSPB_TRIANGULAR,
+  TSPB_CSR,
+  TSPB_COORDS,
+};
+
+struct tspb_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t flags;
+  uint32_t layout;
+  uint32_t city_count;
+  uint32_t weight_type; // enum tsplib_weight_type, for TSPB_COORDS.
+  uint32_t reserved;
+  uint64_t names_offset;
+  uint64_t distances_offset;
+  uint64_t edge_count; // For TSPB_CSR.
+  uint64_t file_size;
+};
+
+// Returns 1 if the buffer starts with the binary format's magic.
+int is_tspb(const char *data, size_t size);
+
+// Sets up instance to read its names and distances from the buffer, which
+// must stay mapped while the instance is in use. Returns 0 on success and -1
+// if the file is truncated, corrupt or from an unsupported version.
+int tspb_load(const char *data, size_t size, struct arena *arena,
+              struct instance *instance);
+
+// Writes instance in the binary format, choosing the most compact layout.
+// Returns 0 on success.
+int tspb_write(FILE *out, const struct instance *instance,
+               struct arena *arena);
+
+#endif
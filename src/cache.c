@@ -0,0 +1,444 @@
+// The result cache: canonical keys, the LRU and the disk store.
+#include "cache.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "distance.h"
+
+#define CACHE_MAGIC "TSPCACHE"
+#define CACHE_VERSION 1
+
+// A cached route in memory. Entries sit in a hash chain for lookups and in a
+// doubly linked list in order of use; the least recently used one is evicted.
+struct cache_entry {
+  struct cache_key key;
+  int city_count;
+  int count;
+  int *route;
+  int chain; // The next entry in the same bucket, or -1.
+  int newer;
+  int older;
+};
+
+struct cache_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t slot_count;
+  uint32_t slot_size;
+  char padding[44]; // Slots start on a cache line.
+};
+
+struct cache_slot {
+  uint64_t key_hi;
+  uint64_t key_lo;
+  uint64_t check; // A hash of the rest of the slot.
+  uint32_t city_count;
+  uint32_t count;
+  uint16_t route[CACHE_DISK_CITIES];
+};
+
+struct tsp_cache {
+  pthread_mutex_t lock;
+  struct cache_entry *entries;
+  int capacity;
+  int used;
+  int *buckets; // bucket_mask + 1 chains of entry indices, -1 when empty.
+  int bucket_mask;
+  int newest;
+  int oldest;
+
+  struct cache_slot *slots; // NULL without a disk store.
+  void *map;
+  size_t map_size;
+};
+
+// Our hash: two independent multiply-rotate streams over 64-bit words,
+// finished with the murmur3 mixer, give a 128-bit key so collisions between
+// different instances are not a practical concern.
+struct hasher {
+  uint64_t a;
+  uint64_t b;
+};
+
+static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static void hash_word(struct hasher *h, uint64_t word) {
+  h->a = rotl((h->a ^ word) * 0x9e3779b97f4a7c15ULL, 31);
+  h->b = rotl((h->b ^ word) * 0xc2b2ae3d27d4eb4fULL, 29) + h->a;
+}
+
+static void hash_bytes(struct hasher *h, const char *data, size_t len) {
+  hash_word(h, len);
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    hash_word(h, word);
+    data += 8;
+    len -= 8;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, data, len);
+  hash_word(h, tail);
+}
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// The cities for qsort, which has no context argument.
+struct named_city {
+  const char *ptr;
+  size_t len;
+  int index;
+};
+
+static int compare_names(const void *a, const void *b) {
+  const struct named_city *x = a;
+  const struct named_city *y = b;
+  size_t len = x->len < y->len ? x->len : y->len;
+  int order = memcmp(x->ptr, y->ptr, len);
+  if (order != 0) {
+    return order;
+  }
+  return x->len < y->len ? -1 : x->len > y->len;
+}
+
+// A function to hash a file by path, size and modification time. A file we
+// cannot stat hashes by path alone.
+static void hash_file(struct hasher *h, const char *path) {
+  hash_bytes(h, path, strlen(path));
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    hash_word(h, (uint64_t)st.st_size);
+    hash_word(h, (uint64_t)st.st_mtim.tv_sec);
+    hash_word(h, (uint64_t)st.st_mtim.tv_nsec);
+  }
+}
+
+// A function to hash the edges of every city in canonical order. Rows are
+// sorted by the caller's city indices, so we add up a hash of every edge,
+// which does not depend on their order.
+static void hash_graph(struct hasher *h, const struct csr_graph *graph,
+                       const int *canonical, const int *position) {
+  for (int c = 0; c < graph->city_count; c++) {
+    uint64_t begin = graph->row_offsets[canonical[c]];
+    uint64_t end = graph->row_offsets[canonical[c] + 1];
+    uint64_t sum = 0;
+    for (uint64_t e = begin; e < end; e++) {
+      sum += mix(mix((uint64_t)position[graph->cols[e]] + 1) ^
+                 graph->weights[e]);
+    }
+    hash_word(h, end - begin);
+    hash_word(h, sum);
+  }
+}
+
+// A function to hash what the distances of instance are made from.
+static void hash_source(struct hasher *h, const struct instance *instance,
+                        const struct cache_source *source,
+                        const int *canonical, const int *position) {
+  int n = instance->city_count;
+  const struct distance *d = source->distances;
+  if (source->updated) {
+    // Updates leave a matrix behind, which we hash below.
+  } else if (source->plugin) {
+    const char *args = source->plugin_args ? source->plugin_args : "";
+    hash_file(h, source->plugin);
+    hash_bytes(h, args, strlen(args));
+    d = NULL;
+  } else if (d == &instance->coord.base) {
+    hash_word(h, (uint64_t)instance->tsplib.weight_type);
+    for (int c = 0; c < n; c++) {
+      uint64_t x, y;
+      memcpy(&x, &instance->tsplib.x[canonical[c]], sizeof(x));
+      memcpy(&y, &instance->tsplib.y[canonical[c]], sizeof(y));
+      hash_word(h, x);
+      hash_word(h, y);
+    }
+    d = NULL;
+  } else if (d == &instance->csr.base) {
+    hash_graph(h, &instance->graph, canonical, position);
+    d = NULL;
+  } else if (d == &instance->road_distance.base && source->road) {
+    hash_file(h, source->road);
+    for (int c = 0; c < n; c++) {
+      hash_word(h, instance->oracle.stops[canonical[c]]);
+    }
+    d = NULL;
+  }
+  // Explicit matrices are their distances, so hashing them costs no more
+  // than reading the input did.
+  for (int c = 0; d && c < n; c++) {
+    for (int e = 0; e < n; e++) {
+      hash_word(h, distance_get(d, canonical[c], canonical[e]));
+    }
+  }
+  hash_word(h, ((uint64_t)source->closure << 1) | (source->quantize != 0));
+}
+
+int cache_key_build(const struct instance *instance, enum tsp_engine engine,
+                    const struct cache_source *source, struct arena *scratch,
+                    int *canonical, struct cache_key *key) {
+  int n = instance->city_count;
+  struct named_city *cities =
+      arena_alloc(scratch, n * sizeof(struct named_city), 64);
+  int *position = arena_alloc(scratch, n * sizeof(int), 64);
+  if (!cities || !position) {
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    cities[i].ptr = instance->cities[i].ptr;
+    cities[i].len = instance->cities[i].len;
+    cities[i].index = i;
+  }
+  qsort(cities, n, sizeof(struct named_city), compare_names);
+
+  struct hasher h = {0x243f6a8885a308d3ULL, 0x13198a2e03707344ULL};
+  hash_word(&h, CACHE_VERSION);
+  hash_word(&h, (uint64_t)n);
+  hash_word(&h, (uint64_t)engine);
+  hash_word(&h, (uint64_t)instance->symmetric);
+  for (int c = 0; c < n; c++) {
+    canonical[c] = cities[c].index;
+    position[cities[c].index] = c;
+    hash_bytes(&h, cities[c].ptr, cities[c].len);
+  }
+  hash_word(&h, (uint64_t)position[0]); // The engines start at city 0.
+  hash_source(&h, instance, source, canonical, position);
+  key->hi = mix(h.a ^ rotl(h.b, 17));
+  key->lo = mix(h.b + h.a);
+  return 0;
+}
+
+// A function to compute the checksum of a disk slot.
+static uint64_t slot_check(const struct cache_slot *slot) {
+  struct hasher h = {slot->key_hi, slot->key_lo};
+  hash_word(&h, ((uint64_t)slot->city_count << 32) | slot->count);
+  hash_bytes(&h, (const char *)slot->route, slot->count * sizeof(uint16_t));
+  return mix(h.a ^ h.b) | 1; // Never 0, the check of a slot never written.
+}
+
+static struct cache_slot *disk_slot(const struct tsp_cache *cache,
+                                    const struct cache_key *key) {
+  return &cache->slots[key->lo % CACHE_DISK_SLOTS];
+}
+
+static int find_entry(const struct tsp_cache *cache,
+                      const struct cache_key *key) {
+  int e = cache->buckets[key->lo & cache->bucket_mask];
+  while (e >= 0 && (cache->entries[e].key.hi != key->hi ||
+                    cache->entries[e].key.lo != key->lo)) {
+    e = cache->entries[e].chain;
+  }
+  return e;
+}
+
+static void unlink_use(struct tsp_cache *cache, int e) {
+  struct cache_entry *entry = &cache->entries[e];
+  if (entry->newer >= 0) {
+    cache->entries[entry->newer].older = entry->older;
+  } else {
+    cache->newest = entry->older;
+  }
+  if (entry->older >= 0) {
+    cache->entries[entry->older].newer = entry->newer;
+  } else {
+    cache->oldest = entry->newer;
+  }
+}
+
+static void mark_newest(struct tsp_cache *cache, int e) {
+  struct cache_entry *entry = &cache->entries[e];
+  entry->newer = -1;
+  entry->older = cache->newest;
+  if (cache->newest >= 0) {
+    cache->entries[cache->newest].newer = e;
+  }
+  cache->newest = e;
+  if (cache->oldest < 0) {
+    cache->oldest = e;
+  }
+}
+
+// A function to add a route to the LRU, evicting the least recently used one
+// when it is full. Called with lock held.
+static void remember(struct tsp_cache *cache, const struct cache_key *key,
+                     int city_count, const int *route, int count) {
+  int *copy = malloc((count > 0 ? count : 1) * sizeof(int));
+  if (!copy) {
+    return;
+  }
+  memcpy(copy, route, count * sizeof(int));
+  int e = find_entry(cache, key);
+  if (e >= 0) {
+    unlink_use(cache, e); // The same key: we replace its route.
+  } else {
+    if (cache->used < cache->capacity) {
+      e = cache->used++;
+    } else {
+      e = cache->oldest;
+      unlink_use(cache, e);
+      int *link =
+          &cache->buckets[cache->entries[e].key.lo & cache->bucket_mask];
+      while (*link != e) {
+        link = &cache->entries[*link].chain;
+      }
+      *link = cache->entries[e].chain;
+    }
+    int *bucket = &cache->buckets[key->lo & cache->bucket_mask];
+    cache->entries[e].key = *key;
+    cache->entries[e].chain = *bucket;
+    *bucket = e;
+  }
+  struct cache_entry *entry = &cache->entries[e];
+  free(entry->route);
+  entry->city_count = city_count;
+  entry->count = count;
+  entry->route = copy;
+  mark_newest(cache, e);
+}
+
+int cache_find(struct tsp_cache *cache, const struct cache_key *key,
+               int city_count, int *route) {
+  pthread_mutex_lock(&cache->lock);
+  int count = -1;
+  int e = find_entry(cache, key);
+  if (e >= 0 && cache->entries[e].city_count == city_count) {
+    count = cache->entries[e].count;
+    memcpy(route, cache->entries[e].route, count * sizeof(int));
+    unlink_use(cache, e);
+    mark_newest(cache, e);
+  } else if (cache->slots) {
+    struct cache_slot slot = *disk_slot(cache, key);
+    if (slot.key_hi == key->hi && slot.key_lo == key->lo &&
+        slot.city_count == (uint32_t)city_count &&
+        slot.count <= (uint32_t)city_count &&
+        slot.count <= CACHE_DISK_CITIES && slot.check == slot_check(&slot)) {
+      count = (int)slot.count;
+      for (int i = 0; i < count; i++) {
+        route[i] = slot.route[i];
+      }
+      remember(cache, key, city_count, route, count);
+    }
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return count;
+}
+
+void cache_store(struct tsp_cache *cache, const struct cache_key *key,
+                 int city_count, const int *route, int count) {
+  pthread_mutex_lock(&cache->lock);
+  remember(cache, key, city_count, route, count);
+  if (cache->slots && count <= CACHE_DISK_CITIES) {
+    struct cache_slot slot;
+    memset(&slot, 0, sizeof(slot));
+    slot.key_hi = key->hi;
+    slot.key_lo = key->lo;
+    slot.city_count = (uint32_t)city_count;
+    slot.count = (uint32_t)count;
+    for (int i = 0; i < count; i++) {
+      slot.route[i] = (uint16_t)route[i];
+    }
+    slot.check = slot_check(&slot);
+    *disk_slot(cache, key) = slot;
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// A function to map the disk store, creating or resetting the file when it
+// does not hold a store of our layout. Returns 0 on success.
+static int open_disk(struct tsp_cache *cache, const char *path) {
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  size_t size = sizeof(struct cache_header) +
+                CACHE_DISK_SLOTS * sizeof(struct cache_slot);
+  struct stat st;
+  struct cache_header header;
+  int valid = fstat(fd, &st) == 0 && (size_t)st.st_size == size &&
+              pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+              memcmp(header.magic, CACHE_MAGIC, 8) == 0 &&
+              header.version == CACHE_VERSION &&
+              header.slot_count == CACHE_DISK_SLOTS &&
+              header.slot_size == sizeof(struct cache_slot);
+  if (!valid) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.version = CACHE_VERSION;
+    header.slot_count = CACHE_DISK_SLOTS;
+    header.slot_size = sizeof(struct cache_slot);
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)size) != 0 ||
+        pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+      close(fd);
+      return -1;
+    }
+  }
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  cache->map = map;
+  cache->map_size = size;
+  cache->slots =
+      (struct cache_slot *)((char *)map + sizeof(struct cache_header));
+  return 0;
+}
+
+struct tsp_cache *tsp_cache_open(const char *path, int entries) {
+  if (entries < 1) {
+    entries = CACHE_DEFAULT_ENTRIES;
+  }
+  struct tsp_cache *cache = calloc(1, sizeof(*cache));
+  if (!cache) {
+    return NULL;
+  }
+  int buckets = 1;
+  while (buckets < 2 * entries) {
+    buckets *= 2;
+  }
+  cache->entries = calloc(entries, sizeof(struct cache_entry));
+  cache->buckets = malloc(buckets * sizeof(int));
+  if (!cache->entries || !cache->buckets ||
+      (path && open_disk(cache, path) != 0)) {
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+    return NULL;
+  }
+  memset(cache->buckets, 0xff, buckets * sizeof(int)); // All -1.
+  cache->capacity = entries;
+  cache->bucket_mask = buckets - 1;
+  cache->newest = -1;
+  cache->oldest = -1;
+  pthread_mutex_init(&cache->lock, NULL);
+  return cache;
+}
+
+void tsp_cache_close(struct tsp_cache *cache) {
+  if (!cache) {
+    return;
+  }
+  for (int e = 0; e < cache->used; e++) {
+    free(cache->entries[e].route);
+  }
+  if (cache->map) {
+    munmap(cache->map, cache->map_size);
+  }
+  pthread_mutex_destroy(&cache->lock);
+  free(cache->entries);
+  free(cache->buckets);
+  free(cache);
+}
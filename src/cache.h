@@ -0,0 +1,67 @@
+// The result cache. Identical instances are often solved again and again,
+// with the cities listed in a different order or named in different files,
+// so we key results by a hash of the instance in canonical form: the cities
+// sorted by name and what their distances are made from, in that order, plus
+// everything else the route depends on (the engine and the start city).
+// Routes are stored in canonical city order and mapped back to the caller's.
+//
+// Results live in an in-memory LRU, and optionally in a file of fixed-size
+// slots that is mapped into memory and shared by every process using it. A
+// slot holds routes of up to CACHE_DISK_CITIES cities, which covers what the
+// DP can solve; longer routes are kept in memory only. Slots are written
+// without locking between processes, so each one carries a checksum and a
+// slot that does not match it reads as a miss.
+#ifndef TSP_CACHE_H
+#define TSP_CACHE_H
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "instance.h"
+#include "tsp.h"
+
+#define CACHE_MAX_CITIES 2048 // Larger instances cost too much to hash.
+#define CACHE_DISK_CITIES 64
+#define CACHE_DISK_SLOTS 65536 // 10 MB of slots.
+#define CACHE_DEFAULT_ENTRIES 4096
+
+struct cache_key {
+  uint64_t hi;
+  uint64_t lo;
+};
+
+// What the distances the engines search on are made from. The key hashes
+// this rather than all n^2 distances, which would cost more than solving
+// many instances and would fill the lazy rows of plugins and road graphs:
+// the coordinates, the edges or the road stops of the instance, or the
+// identity of the plugin, whose costs depend on nothing but the city names,
+// its args and its file. Files are known by path, size and modification time.
+// Only matrices, and instances changed by updates, hash their distances.
+struct cache_source {
+  const struct distance *distances; // Before closure and quantization.
+  const char *plugin;      // The cost plugin file, or NULL.
+  const char *plugin_args; // NULL for none.
+  const char *road;        // The road graph file of a stop list, or NULL.
+  int updated;             // 1 once updates changed the distances.
+  int closure;
+  int quantize;
+};
+
+// Computes the key of instance as the engine sees it. canonical receives the
+// cities in canonical order (canonical[c] is the caller's index of canonical
+// city c). Returns 0 on success and -1 if we run out of memory.
+int cache_key_build(const struct instance *instance, enum tsp_engine engine,
+                    const struct cache_source *source, struct arena *scratch,
+                    int *canonical, struct cache_key *key);
+
+// Looks key up. On a hit, route receives the cached route in canonical city
+// order and we return its length (0 for an instance without a route); on a
+// miss we return -1.
+int cache_find(struct tsp_cache *cache, const struct cache_key *key,
+               int city_count, int *route);
+
+// Stores a route in canonical city order, count 0 for no route.
+void cache_store(struct tsp_cache *cache, const struct cache_key *key,
+                 int city_count, const int *route, int count);
+
+#endif
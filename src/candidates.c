@@ -0,0 +1,248 @@
+// Building candidate lists.
+#include "candidates.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A function to offer (city, cost) to a list kept sorted by cost. Lists hold
+// a handful of entries, so an insertion step is the cheapest structure.
+static void offer(int *list, uint64_t *costs, int k, int *filled, int city,
+                  uint64_t cost) {
+  if (*filled == k && cost >= costs[k - 1]) {
+    return;
+  }
+  int at = *filled < k ? (*filled)++ : k - 1;
+  while (at > 0 && costs[at - 1] > cost) {
+    list[at] = list[at - 1];
+    costs[at] = costs[at - 1];
+    at--;
+  }
+  list[at] = city;
+  costs[at] = cost;
+}
+
+static void finish_list(int *list, uint64_t *costs, int k, int filled) {
+  for (int i = filled; i < k; i++) {
+    list[i] = -1;
+    costs[i] = NO_PATH;
+  }
+}
+
+void candidates_rebuild_city(struct candidates *c, const struct distance *d,
+                             int city, int *scratch_js,
+                             uint64_t *scratch_costs) {
+  int *list = c->lists + (size_t)city * c->k;
+  uint64_t *costs = c->costs + (size_t)city * c->k;
+  int filled = 0;
+  int degree = distance_neighbors(d, city, scratch_js, scratch_costs);
+  for (int i = 0; i < degree; i++) {
+    offer(list, costs, c->k, &filled, scratch_js[i], scratch_costs[i]);
+  }
+  finish_list(list, costs, c->k, filled);
+}
+
+void candidates_update(struct candidates *c, const struct distance *d,
+                       int city, int other, int *scratch_js,
+                       uint64_t *scratch_costs) {
+  if (city == other) {
+    return;
+  }
+  int k = c->k;
+  int *list = c->lists + (size_t)city * k;
+  uint64_t *costs = c->costs + (size_t)city * k;
+  uint64_t cost = distance_get(d, city, other);
+  int filled = 0;
+  int at = -1;
+  for (; filled < k && list[filled] >= 0; filled++) {
+    if (list[filled] == other) {
+      at = filled;
+    }
+  }
+  if (at >= 0) {
+    // Cities outside a full list cost at least its last entry, so other can
+    // stay as long as it is not dearer than that.
+    if (filled == k && cost > costs[k - 1]) {
+      candidates_rebuild_city(c, d, city, scratch_js, scratch_costs);
+      return;
+    }
+    for (int i = at; i + 1 < filled; i++) {
+      list[i] = list[i + 1];
+      costs[i] = costs[i + 1];
+    }
+    filled--;
+  }
+  if (cost != NO_PATH) {
+    offer(list, costs, k, &filled, other, cost);
+  }
+  finish_list(list, costs, k, filled);
+}
+
+void candidates_remove_city(struct candidates *c, const struct distance *d,
+                            int city, int last, int *scratch_js,
+                            uint64_t *scratch_costs) {
+  int k = c->k;
+  if (city != last) {
+    memcpy(c->lists + (size_t)city * k, c->lists + (size_t)last * k,
+           k * sizeof(int));
+    memcpy(c->costs + (size_t)city * k, c->costs + (size_t)last * k,
+           k * sizeof(uint64_t));
+  }
+  c->city_count = d->city_count;
+  for (int i = 0; i < c->city_count; i++) {
+    int *list = c->lists + (size_t)i * k;
+    int stale = 0;
+    for (int m = 0; m < k; m++) {
+      stale |= list[m] == city;
+    }
+    if (stale) {
+      candidates_rebuild_city(c, d, i, scratch_js, scratch_costs);
+      continue;
+    }
+    for (int m = 0; m < k; m++) {
+      if (list[m] == last) {
+        list[m] = city;
+      }
+    }
+  }
+}
+
+// A function to find the k nearest cities of every city of a coordinate
+// instance. We drop the points into a grid of about two points per cell and
+// search rings of cells around each city until the ring is farther away than
+// the k-th best candidate so far. The search uses plain Euclidean distance on
+// the coordinates; the lists are then re-ranked with the instance's own
+// distance function.
+static int grid_candidates(struct candidates *c,
+                           const struct tsplib_instance *tsplib,
+                           const struct distance *d, struct arena *arena) {
+  int n = c->city_count;
+  int k = c->k;
+  double min_x = tsplib->x[0], max_x = tsplib->x[0];
+  double min_y = tsplib->y[0], max_y = tsplib->y[0];
+  for (int i = 1; i < n; i++) {
+    min_x = fmin(min_x, tsplib->x[i]);
+    max_x = fmax(max_x, tsplib->x[i]);
+    min_y = fmin(min_y, tsplib->y[i]);
+    max_y = fmax(max_y, tsplib->y[i]);
+  }
+  int side = (int)ceil(sqrt(n / 2.0));
+  if (side < 1) {
+    side = 1;
+  }
+  double cell_w = (max_x - min_x) / side + 1e-9;
+  double cell_h = (max_y - min_y) / side + 1e-9;
+
+  size_t cells = (size_t)side * side;
+  int *cell_start = arena_calloc(arena, (cells + 1) * sizeof(int), 64);
+  int *cell_of = arena_alloc(arena, n * sizeof(int), 64);
+  int *members = arena_alloc(arena, n * sizeof(int), 64);
+  double *near_costs = arena_alloc(arena, k * sizeof(double), 64);
+  int *near = arena_alloc(arena, k * sizeof(int), 64);
+  uint64_t *exact = arena_alloc(arena, k * sizeof(uint64_t), 64);
+  if (!cell_start || !cell_of || !members || !near_costs || !near || !exact) {
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    int cx = (int)((tsplib->x[i] - min_x) / cell_w);
+    int cy = (int)((tsplib->y[i] - min_y) / cell_h);
+    cx = cx < side ? cx : side - 1;
+    cy = cy < side ? cy : side - 1;
+    cell_of[i] = cy * side + cx;
+    cell_start[cell_of[i] + 1]++;
+  }
+  for (size_t i = 0; i < cells; i++) {
+    cell_start[i + 1] += cell_start[i];
+  }
+  for (int i = 0; i < n; i++) {
+    members[cell_start[cell_of[i]]++] = i;
+  }
+  for (size_t i = cells; i > 0; i--) {
+    cell_start[i] = cell_start[i - 1]; // Undo the shift from the fill pass.
+  }
+  cell_start[0] = 0;
+
+  for (int i = 0; i < n; i++) {
+    int cx = cell_of[i] % side;
+    int cy = cell_of[i] / side;
+    int filled = 0;
+    for (int ring = 0; ring < side; ring++) {
+      // Points in this ring are at least (ring - 1) cells away.
+      if (filled == k && ring > 1) {
+        double gap = (ring - 1) * fmin(cell_w, cell_h);
+        if (gap * gap > near_costs[k - 1]) {
+          break;
+        }
+      }
+      for (int y = cy - ring; y <= cy + ring; y++) {
+        for (int x = cx - ring; x <= cx + ring; x++) {
+          if (x < 0 || y < 0 || x >= side || y >= side ||
+              (abs(x - cx) != ring && abs(y - cy) != ring)) {
+            continue;
+          }
+          int cell = y * side + x;
+          for (int m = cell_start[cell]; m < cell_start[cell + 1]; m++) {
+            int j = members[m];
+            if (j == i) {
+              continue;
+            }
+            double dx = tsplib->x[i] - tsplib->x[j];
+            double dy = tsplib->y[i] - tsplib->y[j];
+            double sq = dx * dx + dy * dy;
+            if (filled == k && sq >= near_costs[k - 1]) {
+              continue;
+            }
+            int at = filled < k ? filled++ : k - 1;
+            while (at > 0 && near_costs[at - 1] > sq) {
+              near[at] = near[at - 1];
+              near_costs[at] = near_costs[at - 1];
+              at--;
+            }
+            near[at] = j;
+            near_costs[at] = sq;
+          }
+        }
+      }
+    }
+
+    distance_batch(d, i, near, filled, exact);
+    int *list = c->lists + (size_t)i * k;
+    uint64_t *costs = c->costs + (size_t)i * k;
+    int kept = 0;
+    for (int m = 0; m < filled; m++) {
+      offer(list, costs, k, &kept, near[m], exact[m]);
+    }
+    finish_list(list, costs, k, kept);
+  }
+  return 0;
+}
+
+int candidates_build(struct candidates *c, const struct instance *instance,
+                     int k, struct arena *arena) {
+  int n = instance->city_count;
+  if (k > n - 1) {
+    k = n > 1 ? n - 1 : 1;
+  }
+  c->city_count = n;
+  c->k = k;
+  c->lists = arena_alloc(arena, (size_t)n * k * sizeof(int), 64);
+  c->costs = arena_alloc(arena, (size_t)n * k * sizeof(uint64_t), 64);
+  if (!c->lists || !c->costs) {
+    return -1;
+  }
+
+  if (instance->distance == &instance->coord.base && n > 1) {
+    return grid_candidates(c, &instance->tsplib, instance->distance, arena);
+  }
+
+  // Sparse rows are scanned at their true degree, full rows cost n.
+  int *js = arena_alloc(arena, n * sizeof(int), 64);
+  uint64_t *costs = arena_alloc(arena, n * sizeof(uint64_t), 64);
+  if (!js || !costs) {
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    candidates_rebuild_city(c, instance->distance, i, js, costs);
+  }
+  return 0;
+}
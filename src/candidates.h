@@ -0,0 +1,45 @@
+// Candidate lists: for every city, the k cities closest to it. Heuristics only
+// try moves towards candidates, which is what lets them scale to instances
+// where looking at all n^2 pairs is out of the question.
+#ifndef TSP_CANDIDATES_H
+#define TSP_CANDIDATES_H
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "instance.h"
+
+struct candidates {
+  int city_count;
+  int k;
+  int *lists;      // city_count * k entries, nearest first, -1 when unused.
+  uint64_t *costs; // The matching distances.
+};
+
+// Builds the lists. Coordinate instances use a bucket grid, so this costs
+// about O(n k); sparse graphs pick from each city's row; other instances scan
+// every row, which is O(n^2) but no worse than the matrix they came with.
+// Returns 0 on success and -1 if we run out of memory.
+int candidates_build(struct candidates *c, const struct instance *instance,
+                     int k, struct arena *arena);
+
+// Recomputes the list of one city by scanning its whole row.
+void candidates_rebuild_city(struct candidates *c, const struct distance *d,
+                             int city, int *scratch_js,
+                             uint64_t *scratch_costs);
+
+// Brings the list of city up to date after its distance to other changed.
+// This costs O(k), unless other drops out of a full list; then some city
+// outside the list may take its place, and we rescan the row.
+void candidates_update(struct candidates *c, const struct distance *d,
+                       int city, int other, int *scratch_js,
+                       uint64_t *scratch_costs);
+
+// Renumbers the lists after city was removed and the city with index last
+// moved into its place; d must already have done the same. Lists that held
+// the removed city are rescanned, so this costs O(n k) plus a row for each.
+void candidates_remove_city(struct candidates *c, const struct distance *d,
+                            int city, int last, int *scratch_js,
+                            uint64_t *scratch_costs);
+
+#endif
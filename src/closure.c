@@ -0,0 +1,376 @@
+// Metric closure with a blocked Floyd-Warshall or with Dijkstra from every
+// city.
+#include "closure.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Everything the closure threads share. Each thread only writes the blocks or
+// rows it owns, so there is no locking.
+struct closure_work {
+  uint64_t *matrix;
+  int32_t *next_hop;
+  size_t stride;
+  int city_count;
+  int block_count;
+  int kb; // The block of intermediate cities of the current round.
+  // The adjacency lists Dijkstra runs on.
+  const uint64_t *row_offsets;
+  const int32_t *cols;
+  const uint64_t *weights;
+};
+
+struct closure_worker {
+  struct closure_work *work;
+  int id;
+  int count;
+  int status;
+};
+
+// A function to run fn on every worker, one thread per worker. The first
+// worker runs on the calling thread. Joining the threads is the barrier
+// between two Floyd-Warshall phases.
+static void run_workers(struct closure_worker *workers, int count,
+                        void *(*fn)(void *)) {
+  pthread_t threads[CLOSURE_MAX_THREADS];
+  int started[CLOSURE_MAX_THREADS] = {0};
+  for (int t = 1; t < count; t++) {
+    started[t] = pthread_create(&threads[t], NULL, fn, &workers[t]) == 0;
+  }
+  fn(&workers[0]);
+  for (int t = 1; t < count; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    } else {
+      fn(&workers[t]); // We could not start a thread, so we do the work here.
+    }
+  }
+}
+
+static int block_end(const struct closure_work *w, int block) {
+  int end = (block + 1) * CLOSURE_BLOCK;
+  return end < w->city_count ? end : w->city_count;
+}
+
+// A function to relax the block of rows ib and columns jb through every city
+// of block kb. The tiles are small enough that the three of them stay in the
+// L1/L2 cache while we sweep over them.
+static void relax_block(struct closure_work *w, int ib, int jb, int kb) {
+  size_t stride = w->stride;
+  int j_start = jb * CLOSURE_BLOCK;
+  int j_end = block_end(w, jb);
+  for (int k = kb * CLOSURE_BLOCK; k < block_end(w, kb); k++) {
+    const uint64_t *row_k = w->matrix + (size_t)k * stride;
+    for (int i = ib * CLOSURE_BLOCK; i < block_end(w, ib); i++) {
+      uint64_t *row_i = w->matrix + (size_t)i * stride;
+      int32_t *hops_i = w->next_hop + (size_t)i * stride;
+      uint64_t dik = row_i[k];
+      if (dik == NO_PATH) {
+        continue;
+      }
+      int32_t hop = hops_i[k];
+      int j = j_start;
+#ifdef __AVX2__
+      // Four entries at a time. AVX2 only compares signed 64-bit integers, so
+      // we flip the sign bits first to get the unsigned order.
+      const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+      const __m256i ik = _mm256_set1_epi64x((long long)dik);
+      const __m256i ik_biased = _mm256_xor_si256(ik, bias);
+      const __m128i hop4 = _mm_set1_epi32(hop);
+      const __m256i low_halves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+      for (; j + 4 <= j_end; j += 4) {
+        __m256i ij = _mm256_loadu_si256((const __m256i *)(row_i + j));
+        __m256i sum = _mm256_add_epi64(
+            ik, _mm256_loadu_si256((const __m256i *)(row_k + j)));
+        __m256i sum_biased = _mm256_xor_si256(sum, bias);
+        __m256i wrapped = _mm256_cmpgt_epi64(ik_biased, sum_biased);
+        __m256i shorter =
+            _mm256_cmpgt_epi64(_mm256_xor_si256(ij, bias), sum_biased);
+        __m256i take = _mm256_andnot_si256(wrapped, shorter);
+        _mm256_storeu_si256((__m256i *)(row_i + j),
+                            _mm256_blendv_epi8(ij, sum, take));
+        __m128i take4 = _mm256_castsi256_si128(
+            _mm256_permutevar8x32_epi32(take, low_halves));
+        __m128i hops = _mm_loadu_si128((const __m128i *)(hops_i + j));
+        _mm_storeu_si128((__m128i *)(hops_i + j),
+                         _mm_blendv_epi8(hops, hop4, take4));
+      }
+#endif
+      // Random weights make a branch here flip unpredictably, so we blend
+      // with masks instead. dik + dkj only wraps around when dkj is NO_PATH
+      // (or the path is longer than any uint64_t), which shows as a sum
+      // smaller than dik.
+      for (; j < j_end; j++) {
+        uint64_t dij = row_i[j];
+        uint64_t sum = dik + row_k[j];
+        uint64_t take = -(uint64_t)((sum >= dik) & (sum < dij));
+        row_i[j] = (sum & take) | (dij & ~take);
+        // The path to j now starts like the path to k.
+        hops_i[j] = (int32_t)((hop & (uint32_t)take) |
+                              (hops_i[j] & ~(uint32_t)take));
+      }
+    }
+  }
+}
+
+// The second phase of a round: the blocks in the same block row or column as
+// the diagonal block. They only depend on themselves and the diagonal block.
+static void *floyd_cross_thread(void *arg) {
+  struct closure_worker *worker = arg;
+  struct closure_work *w = worker->work;
+  for (int b = worker->id; b < w->block_count; b += worker->count) {
+    if (b != w->kb) {
+      relax_block(w, w->kb, b, w->kb);
+      relax_block(w, b, w->kb, w->kb);
+    }
+  }
+  return NULL;
+}
+
+// The last phase of a round: every other block, which only reads the blocks
+// the second phase finished.
+static void *floyd_rest_thread(void *arg) {
+  struct closure_worker *worker = arg;
+  struct closure_work *w = worker->work;
+  for (int ib = worker->id; ib < w->block_count; ib += worker->count) {
+    if (ib == w->kb) {
+      continue;
+    }
+    for (int jb = 0; jb < w->block_count; jb++) {
+      if (jb != w->kb) {
+        relax_block(w, ib, jb, w->kb);
+      }
+    }
+  }
+  return NULL;
+}
+
+static void floyd_warshall(struct closure_work *w,
+                           struct closure_worker *workers, int thread_count) {
+  for (int kb = 0; kb < w->block_count; kb++) {
+    w->kb = kb;
+    relax_block(w, kb, kb, kb);
+    run_workers(workers, thread_count, floyd_cross_thread);
+    run_workers(workers, thread_count, floyd_rest_thread);
+  }
+}
+
+// A binary min-heap of cities keyed by their tentative distance. slot[v] is
+// the position of v in the heap, -1 if v was never reached and -2 once its
+// distance is final.
+struct city_heap {
+  int *items;
+  int *slot;
+  int size;
+  const uint64_t *key;
+};
+
+static void heap_place(struct city_heap *h, int pos, int city) {
+  h->items[pos] = city;
+  h->slot[city] = pos;
+}
+
+static void heap_sift_up(struct city_heap *h, int pos) {
+  int city = h->items[pos];
+  while (pos > 0) {
+    int parent = (pos - 1) / 2;
+    if (h->key[h->items[parent]] <= h->key[city]) {
+      break;
+    }
+    heap_place(h, pos, h->items[parent]);
+    pos = parent;
+  }
+  heap_place(h, pos, city);
+}
+
+static int heap_pop(struct city_heap *h) {
+  int top = h->items[0];
+  int city = h->items[--h->size];
+  int pos = 0;
+  while (2 * pos + 1 < h->size) {
+    int child = 2 * pos + 1;
+    if (child + 1 < h->size &&
+        h->key[h->items[child + 1]] < h->key[h->items[child]]) {
+      child++;
+    }
+    if (h->key[city] <= h->key[h->items[child]]) {
+      break;
+    }
+    heap_place(h, pos, h->items[child]);
+    pos = child;
+  }
+  if (h->size > 0) {
+    heap_place(h, pos, city);
+  }
+  h->slot[top] = -2;
+  return top;
+}
+
+// A function to fill the rows of the sources this worker owns. The first hop
+// towards v is v itself when we reach it straight from the source, and the
+// first hop towards its predecessor otherwise; the predecessor is settled by
+// then, so its first hop is final.
+static void *dijkstra_thread(void *arg) {
+  struct closure_worker *worker = arg;
+  struct closure_work *w = worker->work;
+  int n = w->city_count;
+  struct city_heap heap = {malloc(n * sizeof(int)), malloc(n * sizeof(int)),
+                           0, NULL};
+  if (!heap.items || !heap.slot) {
+    worker->status = -1;
+    free(heap.items);
+    free(heap.slot);
+    return NULL;
+  }
+  for (int s = worker->id; s < n; s += worker->count) {
+    uint64_t *dist = w->matrix + (size_t)s * w->stride;
+    int32_t *hops = w->next_hop + (size_t)s * w->stride;
+    for (int v = 0; v < n; v++) {
+      dist[v] = NO_PATH;
+      hops[v] = -1;
+      heap.slot[v] = -1;
+    }
+    heap.key = dist;
+    dist[s] = 0;
+    hops[s] = s;
+    heap_place(&heap, 0, s);
+    heap.size = 1;
+    while (heap.size > 0) {
+      int u = heap_pop(&heap);
+      for (uint64_t e = w->row_offsets[u]; e < w->row_offsets[u + 1]; e++) {
+        int v = w->cols[e];
+        if (heap.slot[v] == -2 || dist[u] >= dist[v] ||
+            w->weights[e] >= dist[v] - dist[u]) {
+          continue; // Settled, or no shorter than what we have.
+        }
+        dist[v] = dist[u] + w->weights[e];
+        hops[v] = u == s ? v : hops[u];
+        if (heap.slot[v] == -1) {
+          heap.slot[v] = heap.size++;
+          heap.items[heap.slot[v]] = v;
+        }
+        heap_sift_up(&heap, heap.slot[v]);
+      }
+    }
+  }
+  free(heap.items);
+  free(heap.slot);
+  return NULL;
+}
+
+int closure_build(struct closure *c, const struct distance *d,
+                  int thread_count, struct arena *arena) {
+  int n = d->city_count;
+  size_t stride;
+  uint64_t *matrix = matrix_alloc(arena, n, &stride);
+  int32_t *next_hop =
+      arena_alloc(arena, (size_t)n * stride * sizeof(int32_t), 64);
+  uint64_t *row_offsets =
+      arena_alloc(arena, ((size_t)n + 1) * sizeof(uint64_t), 64);
+  int *js = malloc(n * sizeof(int));
+  uint64_t *ws = malloc(n * sizeof(uint64_t));
+  if (!matrix || !next_hop || !row_offsets || !js || !ws) {
+    free(js);
+    free(ws);
+    return -1;
+  }
+  memset(next_hop, 0xff, (size_t)n * stride * sizeof(int32_t)); // All -1.
+
+  // We start from the direct edges.
+  size_t edge_count = 0;
+  for (int i = 0; i < n; i++) {
+    uint64_t *row = matrix + (size_t)i * stride;
+    int32_t *hops = next_hop + (size_t)i * stride;
+    int degree = distance_neighbors(d, i, js, ws);
+    for (int k = 0; k < degree; k++) {
+      row[js[k]] = ws[k];
+      hops[js[k]] = js[k];
+    }
+    row[i] = 0;
+    hops[i] = i;
+    row_offsets[i] = edge_count;
+    edge_count += (size_t)degree;
+  }
+  row_offsets[n] = edge_count;
+
+  struct closure_work work = {matrix, next_hop, stride, n,
+                              (n + CLOSURE_BLOCK - 1) / CLOSURE_BLOCK,
+                              0, row_offsets, NULL, NULL};
+  if (thread_count > CLOSURE_MAX_THREADS) {
+    thread_count = CLOSURE_MAX_THREADS;
+  }
+
+  int status = 0;
+  if (edge_count * 8 < (size_t)n * n) {
+    // Dijkstra from every city costs O(n E log n), which beats the n^3 of
+    // Floyd-Warshall once fewer than about one pair in eight has an edge.
+    int32_t *cols = arena_alloc(arena, edge_count * sizeof(int32_t), 64);
+    uint64_t *weights = arena_alloc(arena, edge_count * sizeof(uint64_t), 64);
+    if ((!cols || !weights) && edge_count > 0) {
+      status = -1;
+    } else {
+      for (int i = 0; i < n; i++) {
+        int degree = distance_neighbors(d, i, js, ws);
+        for (int k = 0; k < degree; k++) {
+          cols[row_offsets[i] + k] = js[k];
+          weights[row_offsets[i] + k] = ws[k];
+        }
+      }
+      work.cols = cols;
+      work.weights = weights;
+      if (thread_count > n / CLOSURE_BLOCK) {
+        thread_count = n / CLOSURE_BLOCK; // Small instances stay on one thread.
+      }
+    }
+  } else if (thread_count > work.block_count) {
+    thread_count = work.block_count;
+  }
+  if (thread_count < 1) {
+    thread_count = 1;
+  }
+
+  if (status == 0) {
+    struct closure_worker workers[CLOSURE_MAX_THREADS];
+    for (int t = 0; t < thread_count; t++) {
+      workers[t] = (struct closure_worker){&work, t, thread_count, 0};
+    }
+    if (work.cols) {
+      run_workers(workers, thread_count, dijkstra_thread);
+      for (int t = 0; t < thread_count; t++) {
+        if (workers[t].status != 0) {
+          status = -1;
+        }
+      }
+    } else {
+      floyd_warshall(&work, workers, thread_count);
+    }
+  }
+  free(js);
+  free(ws);
+  if (status != 0) {
+    return -1;
+  }
+
+  dense_distance_init(&c->dense, n, matrix, stride);
+  c->original = d;
+  c->next_hop = next_hop;
+  return 0;
+}
+
+int closure_expand(const struct closure *c, int i, int j, int *path) {
+  size_t stride = c->dense.stride;
+  if (c->next_hop[(size_t)i * stride + j] < 0) {
+    return 0;
+  }
+  int count = 0;
+  while (i != j) {
+    i = c->next_hop[(size_t)i * stride + j];
+    path[count++] = i;
+  }
+  return count;
+}
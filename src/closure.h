@@ -0,0 +1,38 @@
+// The metric closure of an incomplete instance: the distance between two
+// cities becomes the length of the shortest path between them, so a route may
+// pass through cities it has already visited to reach the next one. We keep
+// the first hop of every shortest path, which lets us expand a route back into
+// the real edges it travels along.
+#ifndef TSP_CLOSURE_H
+#define TSP_CLOSURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "distance.h"
+
+#define CLOSURE_BLOCK 64 // Floyd-Warshall tiles are 64 x 64 entries.
+#define CLOSURE_MAX_THREADS 64
+
+struct closure {
+  struct dense_distance dense; // The shortest path distances.
+  const struct distance *original;
+  // next_hop[i * stride + j] is the first city after i on a shortest path
+  // from i to j, or -1 if there is no path.
+  const int32_t *next_hop;
+};
+
+// Computes the closure of d on up to thread_count threads. Sparse instances
+// run Dijkstra from every city; denser ones run a cache-blocked Floyd-Warshall
+// over the whole matrix. Either way the result takes O(n^2) memory from the
+// arena. Returns 0 on success and -1 if we run out of memory.
+int closure_build(struct closure *c, const struct distance *d,
+                  int thread_count, struct arena *arena);
+
+// Writes the cities on the shortest path from i to j, without i but with j,
+// to path and returns how many there are (0 if there is no path). path must
+// have room for city_count entries.
+int closure_expand(const struct closure *c, int i, int j, int *path);
+
+#endif
@@ -0,0 +1,138 @@
+// Building and querying CSR graphs.
+#include "csr.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int csr_from_edges(struct csr_graph *graph, int city_count,
+                   const struct edge *edges, size_t edge_count,
+                   struct arena *arena) {
+  size_t n = (size_t)city_count;
+  uint64_t *offsets = arena_calloc(arena, (n + 1) * sizeof(uint64_t), 64);
+  uint64_t *fill = arena_alloc(arena, n * sizeof(uint64_t), 64);
+  size_t entries = 2 * edge_count;
+  uint32_t *cols = arena_alloc(arena, entries * sizeof(uint32_t), 64);
+  uint64_t *weights = arena_alloc(arena, entries * sizeof(uint64_t), 64);
+  // The entries grouped by neighbour, with the city whose row they go into
+  // (a byte more, so that an empty list is not taken for a failure).
+  uint32_t *rows = malloc(entries * sizeof(uint32_t) + 1);
+  uint64_t *row_weights = malloc(entries * sizeof(uint64_t) + 1);
+  if (!offsets || !fill || !cols || !weights || !rows || !row_weights) {
+    free(rows);
+    free(row_weights);
+    return -1;
+  }
+
+  // We count the degree of every city and turn the counts into row offsets.
+  // Every edge is an entry in the rows of both of its cities, and since the
+  // graph is symmetric, a city is the neighbour in as many entries as its row
+  // holds, so the offsets also tell where the entries of each neighbour go.
+  for (size_t e = 0; e < edge_count; e++) {
+    offsets[edges[e].from + 1]++;
+    offsets[edges[e].to + 1]++;
+  }
+  for (size_t i = 0; i < n; i++) {
+    offsets[i + 1] += offsets[i];
+  }
+
+  // Two stable counting sorts put every row in neighbour order in O(E + n),
+  // however long the rows are: we group the entries by neighbour, then drop
+  // them into their rows one neighbour after another. Walking the edges in
+  // input order keeps repeated edges in input order within a row.
+  memcpy(fill, offsets, n * sizeof(uint64_t));
+  for (size_t e = 0; e < edge_count; e++) {
+    uint64_t at = fill[edges[e].to]++;
+    rows[at] = edges[e].from;
+    row_weights[at] = edges[e].distance;
+    at = fill[edges[e].from]++;
+    rows[at] = edges[e].to;
+    row_weights[at] = edges[e].distance;
+  }
+  memcpy(fill, offsets, n * sizeof(uint64_t));
+  for (size_t col = 0; col < n; col++) {
+    for (uint64_t k = offsets[col]; k < offsets[col + 1]; k++) {
+      uint64_t at = fill[rows[k]]++;
+      cols[at] = (uint32_t)col;
+      weights[at] = row_weights[k];
+    }
+  }
+  free(rows);
+  free(row_weights);
+
+  // We squeeze out repeats, keeping the last one listed.
+  uint64_t out = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t begin = offsets[i];
+    uint64_t end = offsets[i + 1];
+    offsets[i] = out;
+    for (uint64_t a = begin; a < end; a++) {
+      if (a + 1 < end && cols[a + 1] == cols[a]) {
+        continue; // A later entry for the same neighbour overrides this one.
+      }
+      cols[out] = cols[a];
+      weights[out] = weights[a];
+      out++;
+    }
+  }
+  offsets[n] = out;
+
+  graph->city_count = city_count;
+  graph->edge_count = out;
+  graph->row_offsets = offsets;
+  graph->cols = cols;
+  graph->weights = weights;
+  return 0;
+}
+
+// A function to find j in the sorted row of i with a binary search.
+static uint64_t csr_get(const struct distance *d, int i, int j) {
+  const struct csr_graph *graph = ((const struct csr_distance *)d)->graph;
+  uint64_t lo = graph->row_offsets[i];
+  uint64_t hi = graph->row_offsets[i + 1];
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (graph->cols[mid] < (uint32_t)j) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < graph->row_offsets[i + 1] && graph->cols[lo] == (uint32_t)j) {
+    return graph->weights[lo];
+  }
+  return NO_PATH;
+}
+
+static void csr_batch(const struct distance *d, int i, const int *js,
+                      int count, uint64_t *out) {
+  for (int k = 0; k < count; k++) {
+    out[k] = csr_get(d, i, js[k]);
+  }
+}
+
+// A function to list the neighbours of i: this is just the row, so a scan
+// costs the true degree of the city rather than n.
+static int csr_neighbors(const struct distance *d, int i, int *js,
+                         uint64_t *out) {
+  const struct csr_graph *graph = ((const struct csr_distance *)d)->graph;
+  int count = 0;
+  for (uint64_t e = graph->row_offsets[i]; e < graph->row_offsets[i + 1];
+       e++) {
+    if (graph->cols[e] != (uint32_t)i) { // Self loops lead nowhere new.
+      js[count] = (int)graph->cols[e];
+      out[count] = graph->weights[e];
+      count++;
+    }
+  }
+  return count;
+}
+
+static const struct distance_ops csr_ops = {csr_get, csr_batch,
+                                            csr_neighbors};
+
+void csr_distance_init(struct csr_distance *d, const struct csr_graph *graph) {
+  d->base.ops = &csr_ops;
+  d->base.city_count = graph->city_count;
+  d->base.complete = 0;
+  d->graph = graph;
+}
@@ -0,0 +1,37 @@
+// A compressed sparse row graph: the neighbours of city i are
+// cols[row_offsets[i] .. row_offsets[i + 1]), sorted by city index, with the
+// matching distances in weights. It holds only the edges the input lists, so
+// memory is O(E) instead of O(n^2).
+#ifndef TSP_CSR_H
+#define TSP_CSR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "distance.h"
+#include "parser.h"
+
+struct csr_graph {
+  int city_count;
+  size_t edge_count; // The number of stored (directed) entries.
+  const uint64_t *row_offsets;
+  const uint32_t *cols;
+  const uint64_t *weights;
+};
+
+// Distances looked up in a CSR graph. Pairs without an edge are NO_PATH.
+struct csr_distance {
+  struct distance base;
+  const struct csr_graph *graph;
+};
+
+// Builds a symmetric graph from an edge list. When an edge is listed more than
+// once, the last distance wins, as it does for the dense matrix.
+int csr_from_edges(struct csr_graph *graph, int city_count,
+                   const struct edge *edges, size_t edge_count,
+                   struct arena *arena);
+
+void csr_distance_init(struct csr_distance *d, const struct csr_graph *graph);
+
+#endif
@@ -0,0 +1,200 @@
+// Dense and coordinate-backed distance implementations.
+#include "distance.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int scan_neighbors(const struct distance *d, int i, int *js, uint64_t *out) {
+  int count = 0;
+  for (int j = 0; j < d->city_count; j++) {
+    if (j != i) {
+      js[count++] = j;
+    }
+  }
+  distance_batch(d, i, js, count, out);
+  int kept = 0;
+  for (int k = 0; k < count; k++) {
+    if (out[k] != NO_PATH) {
+      js[kept] = js[k];
+      out[kept] = out[k];
+      kept++;
+    }
+  }
+  return kept;
+}
+
+int route_feasible(const struct distance *d, int start, int symmetric) {
+  int n = d->city_count;
+  if (n <= 1 || d->complete) {
+    return 1;
+  }
+  int *queue = malloc(n * sizeof(int));
+  int *js = malloc(n * sizeof(int));
+  uint64_t *weights = malloc(n * sizeof(uint64_t));
+  char *seen = calloc(n, 1);
+  int feasible = -1;
+  if (queue && js && weights && seen) {
+    int head = 0;
+    int tail = 0;
+    int dead_ends = 0;
+    queue[tail++] = start;
+    seen[start] = 1;
+    while (head < tail) {
+      int city = queue[head++];
+      int degree = distance_neighbors(d, city, js, weights);
+      if (city != start && degree <= (symmetric ? 1 : 0)) {
+        dead_ends++;
+      }
+      for (int k = 0; k < degree; k++) {
+        if (!seen[js[k]]) {
+          seen[js[k]] = 1;
+          queue[tail++] = js[k];
+        }
+      }
+    }
+    feasible = tail == n && dead_ends <= 1;
+  }
+  free(queue);
+  free(js);
+  free(weights);
+  free(seen);
+  return feasible;
+}
+
+static uint64_t dense_get(const struct distance *d, int i, int j) {
+  const struct dense_distance *dense = (const struct dense_distance *)d;
+  return dense->matrix[(size_t)i * dense->stride + j];
+}
+
+static void dense_batch(const struct distance *d, int i, const int *js,
+                        int count, uint64_t *out) {
+  const struct dense_distance *dense = (const struct dense_distance *)d;
+  const uint64_t *row = dense->matrix + (size_t)i * dense->stride;
+  for (int k = 0; k < count; k++) {
+    out[k] = row[js[k]];
+  }
+}
+
+static const struct distance_ops dense_ops = {dense_get, dense_batch,
+                                             scan_neighbors};
+
+void dense_distance_init(struct dense_distance *d, int city_count,
+                         const uint64_t *matrix, size_t stride) {
+  d->base.ops = &dense_ops;
+  d->base.city_count = city_count;
+  d->base.complete = 0;
+  d->matrix = matrix;
+  d->stride = stride;
+}
+
+uint64_t *matrix_alloc(struct arena *arena, int city_count, size_t *stride) {
+  size_t n = (size_t)city_count;
+  *stride = (n + 7) & ~(size_t)7;
+  uint64_t *matrix = arena_alloc(arena, n * *stride * sizeof(uint64_t), 64);
+  if (matrix) {
+    memset(matrix, 0xff, n * *stride * sizeof(uint64_t)); // All NO_PATH.
+  }
+  return matrix;
+}
+
+static uint64_t triangular_get(const struct distance *d, int i, int j) {
+  const struct triangular_distance *tri =
+      (const struct triangular_distance *)d;
+  if (i == j) {
+    return 0;
+  }
+  if (i > j) {
+    int t = i;
+    i = j;
+    j = t;
+  }
+  return tri->entries[triangular_index((size_t)d->city_count, (size_t)i,
+                                       (size_t)j)];
+}
+
+static void triangular_batch(const struct distance *d, int i, const int *js,
+                             int count, uint64_t *out) {
+  for (int k = 0; k < count; k++) {
+    out[k] = triangular_get(d, i, js[k]);
+  }
+}
+
+static const struct distance_ops triangular_ops = {
+    triangular_get, triangular_batch, scan_neighbors};
+
+void triangular_distance_init(struct triangular_distance *d, int city_count,
+                              const uint64_t *entries) {
+  d->base.ops = &triangular_ops;
+  d->base.city_count = city_count;
+  d->base.complete = 0;
+  d->entries = entries;
+}
+
+static uint64_t coord_get(const struct distance *d, int i, int j) {
+  const struct coord_distance *coord = (const struct coord_distance *)d;
+  return tsplib_distance(coord->instance, i, j);
+}
+
+// A function to compute the plain Euclidean distances from city i to a batch
+// of cities. With SSE2 we handle two cities per instruction; the rounding is
+// applied afterwards since it differs between the coordinate types.
+static void euclidean_batch(const struct tsplib_instance *instance, int i,
+                            const int *js, int count, double *out) {
+  const double *x = instance->x;
+  const double *y = instance->y;
+  int k = 0;
+#ifdef __SSE2__
+  const __m128d xi = _mm_set1_pd(x[i]);
+  const __m128d yi = _mm_set1_pd(y[i]);
+  for (; k + 2 <= count; k += 2) {
+    __m128d xd = _mm_sub_pd(_mm_set_pd(x[js[k + 1]], x[js[k]]), xi);
+    __m128d yd = _mm_sub_pd(_mm_set_pd(y[js[k + 1]], y[js[k]]), yi);
+    __m128d sq = _mm_add_pd(_mm_mul_pd(xd, xd), _mm_mul_pd(yd, yd));
+    _mm_storeu_pd(out + k, _mm_sqrt_pd(sq));
+  }
+#endif
+  for (; k < count; k++) {
+    double xd = x[js[k]] - x[i];
+    double yd = y[js[k]] - y[i];
+    out[k] = sqrt(xd * xd + yd * yd);
+  }
+}
+
+static void coord_batch(const struct distance *d, int i, const int *js,
+                        int count, uint64_t *out) {
+  const struct coord_distance *coord = (const struct coord_distance *)d;
+  const struct tsplib_instance *instance = coord->instance;
+  enum tsplib_weight_type type = instance->weight_type;
+  if (type != TSPLIB_EUC_2D && type != TSPLIB_CEIL_2D) {
+    for (int k = 0; k < count; k++) {
+      out[k] = tsplib_distance(instance, i, js[k]);
+    }
+    return;
+  }
+
+  double lengths[256];
+  for (int start = 0; start < count; start += 256) {
+    int chunk = count - start < 256 ? count - start : 256;
+    euclidean_batch(instance, i, js + start, chunk, lengths);
+    for (int k = 0; k < chunk; k++) {
+      out[start + k] = type == TSPLIB_EUC_2D ? (uint64_t)(lengths[k] + 0.5)
+                                             : (uint64_t)ceil(lengths[k]);
+    }
+  }
+}
+
+static const struct distance_ops coord_ops = {coord_get, coord_batch,
+                                             scan_neighbors};
+
+void coord_distance_init(struct coord_distance *d,
+                         const struct tsplib_instance *instance) {
+  d->base.ops = &coord_ops;
+  d->base.city_count = instance->dimension;
+  d->base.complete = 1; // The coordinates give us every pair.
+  d->instance = instance;
+}
@@ -0,0 +1,106 @@
+// The distance abstraction every engine is written against. An instance is
+// either backed by a dense matrix (edge lists, EXPLICIT TSPLIB files) or by
+// node coordinates, in which case distances are computed on demand and the
+// instance only needs O(n) memory.
+#ifndef TSP_DISTANCE_H
+#define TSP_DISTANCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "parser.h"
+#include "tsplib.h"
+
+#define NO_PATH                                                                \
+  UINT64_MAX // We assign the a very large number to indicate that there is no
+             // path between 2 cities.
+
+struct distance;
+
+struct distance_ops {
+  // The distance from city i to city j, or NO_PATH.
+  uint64_t (*get)(const struct distance *d, int i, int j);
+  // The distances from city i to each of the count cities in js. This is where
+  // implementations vectorize, so engines should prefer it in loops.
+  void (*batch)(const struct distance *d, int i, const int *js, int count,
+                uint64_t *out);
+  // Writes the cities reachable from i, and their distances, to js and out and
+  // returns how many there are. Both arrays must have room for city_count
+  // entries. Sparse backends only visit the edges that exist.
+  int (*neighbors)(const struct distance *d, int i, int *js, uint64_t *out);
+};
+
+struct distance {
+  const struct distance_ops *ops;
+  int city_count;
+  int complete; // 1 if every pair of cities has a distance.
+};
+
+// A row-major city_count x city_count matrix. Missing entries hold NO_PATH.
+struct dense_distance {
+  struct distance base;
+  const uint64_t *matrix;
+  size_t stride; // The number of entries between the starts of two rows.
+};
+
+// A symmetric matrix stored as its strict upper triangle, row by row, which
+// halves the memory of a dense matrix. The diagonal is always 0.
+struct triangular_distance {
+  struct distance base;
+  const uint64_t *entries; // city_count * (city_count - 1) / 2 of them.
+};
+
+// Distances computed from node coordinates with the TSPLIB rules.
+struct coord_distance {
+  struct distance base;
+  const struct tsplib_instance *instance;
+};
+
+static inline uint64_t distance_get(const struct distance *d, int i, int j) {
+  return d->ops->get(d, i, j);
+}
+
+static inline void distance_batch(const struct distance *d, int i,
+                                  const int *js, int count, uint64_t *out) {
+  d->ops->batch(d, i, js, count, out);
+}
+
+static inline int distance_neighbors(const struct distance *d, int i, int *js,
+                                     uint64_t *out) {
+  return d->ops->neighbors(d, i, js, out);
+}
+
+// A neighbors implementation for backends that store every pair: we fetch the
+// whole row with batch and drop the missing entries.
+int scan_neighbors(const struct distance *d, int i, int *js, uint64_t *out);
+
+// A quick check for instances that obviously have no route. Every city must be
+// reachable from start, and since a route ends only once, at most one city
+// other than start may be a dead end (a single neighbour in a symmetric
+// instance, no way out in an asymmetric one). Returns 0 if there is certainly
+// no route, 1 if there may be one and -1 if we run out of memory. The cost is
+// one scan over the neighbours of every city.
+int route_feasible(const struct distance *d, int start, int symmetric);
+
+// Allocates a city_count x city_count matrix whose rows start on cache line
+// boundaries: each row is padded to a multiple of 8 entries and the padded row
+// length is stored in stride. Every entry starts out as NO_PATH.
+uint64_t *matrix_alloc(struct arena *arena, int city_count, size_t *stride);
+
+// Wraps an existing matrix without copying it.
+void dense_distance_init(struct dense_distance *d, int city_count,
+                         const uint64_t *matrix, size_t stride);
+
+void triangular_distance_init(struct triangular_distance *d, int city_count,
+                              const uint64_t *entries);
+
+// The position of (i, j), i < j, in a strict upper triangle of n cities.
+static inline size_t triangular_index(size_t n, size_t i, size_t j) {
+  return i * (2 * n - i - 1) / 2 + (j - i - 1);
+}
+
+void coord_distance_init(struct coord_distance *d,
+                         const struct tsplib_instance *instance);
+
+#endif
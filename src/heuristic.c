@@ -0,0 +1,260 @@
+// Nearest neighbour construction and 2-opt improvement.
+#include "heuristic.h"
+
+#include <stdlib.h>
+
+// A function to add two costs where NO_PATH means "no edge": any sum with a
+// missing edge is itself missing.
+static uint64_t add_cost(uint64_t a, uint64_t b) {
+  return a == NO_PATH || b == NO_PATH ? NO_PATH : a + b;
+}
+
+// A function to build the greedy route. From the current city we go to the
+// nearest unvisited candidate; when every candidate has been visited already
+// we look further. In a complete instance we scan the cities that are still
+// unvisited, which we keep in a shrinking list, so the scans get cheaper as
+// the route grows; otherwise we scan the city's neighbour list.
+static int nearest_neighbour(const struct distance *d,
+                             const struct candidates *c, int *route,
+                             struct monitor *monitor,
+                             struct tsp_progress *progress) {
+  int n = d->city_count;
+  int *unvisited = malloc(n * sizeof(int));
+  int *slot = malloc(n * sizeof(int)); // Where each city is in unvisited.
+  int *js = malloc(n * sizeof(int));
+  uint64_t *costs = malloc(n * sizeof(uint64_t));
+  int status = -1;
+  if (unvisited && slot && js && costs) {
+    status = 0;
+    for (int i = 0; i < n; i++) {
+      unvisited[i] = i;
+      slot[i] = i;
+    }
+    int remaining = n;
+    int current = 0;
+    for (int step = 0; step < n; step++) {
+      if (step % MONITOR_STEPS == 0) {
+        progress->done = 0.5 * step / n;
+        if (monitor_tick(monitor, progress, 0)) {
+          status = 1; // Cancelled before we have a route.
+          break;
+        }
+      }
+      if (step > 0) {
+        int best = -1;
+        uint64_t best_cost = NO_PATH;
+        const int *list = c->lists + (size_t)current * c->k;
+        for (int m = 0; m < c->k && list[m] >= 0; m++) {
+          if (slot[list[m]] >= 0) {
+            best = list[m]; // The list is sorted, so the first free one is
+            break;          // the nearest.
+          }
+        }
+        if (best < 0) {
+          int degree = remaining;
+          const int *scan = unvisited;
+          if (d->complete) {
+            distance_batch(d, current, unvisited, remaining, costs);
+          } else {
+            degree = distance_neighbors(d, current, js, costs);
+            scan = js;
+          }
+          for (int m = 0; m < degree; m++) {
+            if (slot[scan[m]] >= 0 && costs[m] < best_cost) {
+              best = scan[m];
+              best_cost = costs[m];
+            }
+          }
+        }
+        if (best < 0) {
+          status = 1; // We are stuck: every neighbour has been visited.
+          break;
+        }
+        current = best;
+      }
+      // We swap the city out of the unvisited list.
+      int last = unvisited[--remaining];
+      unvisited[slot[current]] = last;
+      slot[last] = slot[current];
+      slot[current] = -1;
+      route[step] = current;
+    }
+  }
+  free(unvisited);
+  free(slot);
+  free(js);
+  free(costs);
+  return status;
+}
+
+static void reverse(int *route, int *pos, int from, int to) {
+  while (from < to) {
+    int a = route[from];
+    int b = route[to];
+    route[from] = b;
+    route[to] = a;
+    pos[b] = from;
+    pos[a] = to;
+    from++;
+    to--;
+  }
+}
+
+// A function to improve the route with 2-opt. For every city a on a queue we
+// try to connect it to one of its candidates c, which removes one edge next
+// to a and one next to c and reverses the stretch in between. The route is
+// open and starts at city 0, so besides the usual move we also allow
+// reversing the whole tail, which replaces a single edge. Cities whose
+// surroundings changed go back on the queue ("don't look bits").
+static int two_opt(const struct distance *d, const struct candidates *c,
+                   int *route, struct monitor *monitor,
+                   struct tsp_progress *progress) {
+  int n = d->city_count;
+  int *pos = malloc(n * sizeof(int));
+  int *queue = malloc(n * sizeof(int));
+  char *queued = malloc(n);
+  if (!pos || !queue || !queued) {
+    free(pos);
+    free(queue);
+    free(queued);
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    pos[route[i]] = i;
+    queue[i] = route[i];
+    queued[i] = 1;
+  }
+  int head = 0;
+  int count = n;
+
+  // We keep the cost of the route up to date for the progress reports, and
+  // estimate the work left from the queue.
+  uint64_t cost = 0;
+  for (int i = 0; i + 1 < n; i++) {
+    cost = add_cost(cost, distance_get(d, route[i], route[i + 1]));
+  }
+  progress->incumbent = cost;
+  uint64_t popped = 0;
+
+  while (count > 0) {
+    if (popped % MONITOR_STEPS == 0) {
+      progress->done = 0.5 + 0.5 * (double)popped / (double)(popped + count);
+      if (monitor_tick(monitor, progress, 0)) {
+        break; // The route is complete after every move, so we keep it.
+      }
+    }
+    popped++;
+    int a = queue[head];
+    head = (head + 1) % n;
+    count--;
+    queued[a] = 0;
+
+    int improved = 0;
+    const int *list = c->lists + (size_t)a * c->k;
+    const uint64_t *list_costs = c->costs + (size_t)a * c->k;
+    for (int m = 0; m < c->k && list[m] >= 0 && !improved; m++) {
+      int city = list[m];
+      uint64_t ac = list_costs[m];
+      int i = pos[a];
+      int j = pos[city];
+      int from = 0;
+      int to = 0;
+      int touched[4];
+      int touched_count = 0;
+      if (j > i + 1 && i + 1 < n) {
+        // Replace (a, b) and (c, e) with (a, c) and (b, e), reversing b..c.
+        int b = route[i + 1];
+        uint64_t removed = distance_get(d, a, b);
+        uint64_t added = ac;
+        if (j + 1 < n) {
+          int e = route[j + 1];
+          removed = add_cost(removed, distance_get(d, city, e));
+          added = add_cost(added, distance_get(d, b, e));
+          touched[touched_count++] = e;
+        }
+        if (added < removed) {
+          from = i + 1;
+          to = j;
+          cost -= removed - added;
+          touched[touched_count++] = b;
+        }
+      } else if (j + 1 < i) {
+        // Replace (c, e) and (a, b) with (c, a) and (e, b), reversing e..a.
+        int e = route[j + 1];
+        uint64_t removed = distance_get(d, city, e);
+        uint64_t added = ac;
+        if (i + 1 < n) {
+          int b = route[i + 1];
+          removed = add_cost(removed, distance_get(d, a, b));
+          added = add_cost(added, distance_get(d, e, b));
+          touched[touched_count++] = b;
+        }
+        if (added < removed) {
+          from = j + 1;
+          to = i;
+          cost -= removed - added;
+          touched[touched_count++] = e;
+        }
+      }
+      if (from < to) {
+        reverse(route, pos, from, to);
+        touched[touched_count++] = a;
+        touched[touched_count++] = city;
+        for (int t = 0; t < touched_count; t++) {
+          if (!queued[touched[t]]) {
+            queued[touched[t]] = 1;
+            queue[(head + count) % n] = touched[t];
+            count++;
+          }
+        }
+        improved = 1;
+        progress->incumbent = cost;
+      }
+    }
+  }
+  free(pos);
+  free(queue);
+  free(queued);
+  return 0;
+}
+
+// A function to compute a lower bound for the progress reports. Every city
+// but the last leaves by an edge at least as long as its nearest candidate,
+// so the sum of those, less the largest, is one.
+static uint64_t route_bound(const struct distance *d,
+                           const struct candidates *c) {
+  uint64_t sum = 0;
+  uint64_t largest = 0;
+  for (int i = 0; i < d->city_count; i++) {
+    if (c->lists[(size_t)i * c->k] < 0) {
+      continue; // No edge leaves the city, so the route ends there.
+    }
+    uint64_t nearest = c->costs[(size_t)i * c->k];
+    sum += nearest;
+    largest = nearest > largest ? nearest : largest;
+  }
+  return sum - largest;
+}
+
+int heuristic_route(const struct distance *d, const struct candidates *c,
+                    int symmetric, int *route, struct monitor *monitor) {
+  struct tsp_progress progress = {TSP_ENGINE_HEURISTIC, 0, NO_PATH, 0};
+  if (monitor && monitor->fn) {
+    progress.bound = route_bound(d, c);
+  }
+  int status = nearest_neighbour(d, c, route, monitor, &progress);
+  if (status == 0 && symmetric && d->city_count > 3) {
+    status = two_opt(d, c, route, monitor, &progress);
+  } else if (status == 0 && monitor && monitor->fn) {
+    progress.incumbent = 0;
+    for (int i = 0; i + 1 < d->city_count; i++) {
+      progress.incumbent =
+          add_cost(progress.incumbent, distance_get(d, route[i], route[i + 1]));
+    }
+  }
+  if (status == 0 && !monitor_cancelled(monitor)) {
+    progress.done = 1;
+    monitor_tick(monitor, &progress, 1);
+  }
+  return status;
+}
@@ -0,0 +1,22 @@
+// A heuristic engine for instances too large for the DP: a nearest neighbour
+// route improved by 2-opt moves restricted to candidate lists. It runs in
+// roughly O(n k) time and O(n) memory besides the instance itself, so it
+// handles any number of cities, at the price of optimality.
+#ifndef TSP_HEURISTIC_H
+#define TSP_HEURISTIC_H
+
+#include "candidates.h"
+#include "distance.h"
+#include "progress.h"
+
+// Fills route[0 .. city_count) with an open route that starts at city 0.
+// symmetric enables 2-opt, which reverses segments and is only valid when
+// distances do not depend on direction. Returns 0 on success, 1 if no route
+// was found (in a sparse instance the greedy route can get stuck) and -1 if
+// we run out of memory. monitor, if not NULL, receives progress reports; a
+// cancellation during 2-opt keeps the route improved so far and returns 0,
+// one before the route is complete returns 1.
+int heuristic_route(const struct distance *d, const struct candidates *c,
+                    int symmetric, int *route, struct monitor *monitor);
+
+#endif
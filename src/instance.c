@@ -0,0 +1,231 @@
+// Loading instances in any of the supported formats.
+#include "instance.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "binfmt.h"
+#include "stream.h"
+
+// A function to set up the distances of a parsed edge list.
+static enum instance_status edge_list_ready(struct instance *instance,
+                                            struct arena *arena) {
+  instance->source = SOURCE_EDGE_LIST;
+  instance->city_count = instance->edges.cities.count;
+  instance->symmetric = 1;
+  instance->cities = instance->edges.cities.names;
+  // Edge lists usually name only a few neighbours per city, so we keep them as
+  // a CSR graph: O(E) memory, and neighbour scans cost the true degree.
+  if (csr_from_edges(&instance->graph, instance->city_count,
+                     instance->edges.edges, instance->edges.edge_count,
+                     arena) != 0) {
+    return INSTANCE_NO_MEMORY;
+  }
+  csr_distance_init(&instance->csr, &instance->graph);
+  instance->distance = &instance->csr.base;
+  return INSTANCE_OK;
+}
+
+// A function to load an instance from standard input or a compressed file.
+// Edge lists are parsed block by block while the reader thread is still
+// inflating the rest of the input. The other formats need the whole file in
+// one piece, so for them we collect the blocks into one arena buffer and
+// carry on as if it had been mapped.
+static enum instance_status load_stream(struct instance *instance, int fd,
+                                        struct arena *arena, int *parsed,
+                                        size_t *error_line) {
+  struct stream stream;
+  if (stream_open(&stream, fd) != 0) {
+    return INSTANCE_NO_MEMORY;
+  }
+  int more = stream_next(&stream);
+  if (more < 0) {
+    stream_close(&stream);
+    return INSTANCE_PARSE_ERROR;
+  }
+
+  if (more > 0 && !is_tspb(stream.data, stream.len) &&
+      !is_tsplib(stream.data, stream.len)) {
+    *parsed = 1;
+    int status =
+        parse_edge_list_stream(&stream, arena, &instance->edges, error_line);
+    stream_close(&stream);
+    return status == 0 ? INSTANCE_OK : INSTANCE_PARSE_ERROR;
+  }
+
+  char *buffer = NULL;
+  size_t size = 0;
+  size_t capacity = 0;
+  while (more > 0) {
+    if (size + stream.len > capacity) {
+      size_t grown = 2 * (size + stream.len);
+      buffer = arena_grow(arena, buffer, capacity, grown, 64);
+      capacity = grown;
+      if (!buffer) {
+        stream_close(&stream);
+        return INSTANCE_NO_MEMORY;
+      }
+    }
+    memcpy(buffer + size, stream.data, stream.len);
+    size += stream.len;
+    more = stream_next(&stream);
+  }
+  stream_close(&stream);
+  if (more < 0) {
+    return INSTANCE_PARSE_ERROR;
+  }
+  instance->file.data = buffer;
+  instance->file.size = size;
+  return INSTANCE_OK;
+}
+
+// A function to load an instance from a buffer that holds the whole input,
+// picking the reader from the contents.
+static enum instance_status load_buffer(struct instance *instance,
+                                        const char *data, size_t size,
+                                        struct arena *arena,
+                                        size_t *error_line) {
+  // A compiled instance needs no parsing at all: we point the names and the
+  // distance backend straight into the mapping.
+  if (is_tspb(data, size)) {
+    instance->source = SOURCE_BINARY;
+    return tspb_load(data, size, arena, instance) == 0 ? INSTANCE_OK
+                                                       : INSTANCE_PARSE_ERROR;
+  }
+
+  // TSPLIB files are recognised by their keyword header; anything else is read
+  // as a `City1-City2: Distance` list.
+  if (is_tsplib(data, size)) {
+    instance->source = SOURCE_TSPLIB;
+    if (parse_tsplib(data, size, arena, &instance->tsplib, error_line) != 0) {
+      return INSTANCE_PARSE_ERROR;
+    }
+    instance->city_count = instance->tsplib.dimension;
+    instance->symmetric = instance->tsplib.symmetric;
+    instance->cities = instance->tsplib.names;
+    // Coordinate instances compute their distances on demand, explicit ones
+    // are already a triangle or a dense matrix.
+    if (instance->tsplib.weight_type != TSPLIB_EXPLICIT) {
+      coord_distance_init(&instance->coord, &instance->tsplib);
+      instance->distance = &instance->coord.base;
+    } else if (instance->tsplib.triangle) {
+      triangular_distance_init(&instance->triangular, instance->city_count,
+                               instance->tsplib.triangle);
+      instance->distance = &instance->triangular.base;
+    } else {
+      dense_distance_init(&instance->dense, instance->city_count,
+                          instance->tsplib.matrix, instance->tsplib.stride);
+      instance->distance = &instance->dense.base;
+    }
+    return INSTANCE_OK;
+  }
+
+  // Big edge lists are parsed on every CPU we have.
+  int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (parse_edge_list_parallel(data, size, threads > 0 ? threads : 1, arena,
+                               &instance->edges, error_line) != 0) {
+    return INSTANCE_PARSE_ERROR;
+  }
+  return edge_list_ready(instance, arena);
+}
+
+enum instance_status instance_load(struct instance *instance, const char *path,
+                                   struct arena *arena, size_t *error_line) {
+  memset(instance, 0, sizeof(*instance));
+  *error_line = 0;
+
+  // "-" reads standard input and gzip files are inflated on the fly; both go
+  // through a stream. Everything else is mapped.
+  if (strcmp(path, "-") == 0 || is_gzip_file(path)) {
+    int fd = strcmp(path, "-") == 0 ? dup(STDIN_FILENO) : open(path, O_RDONLY);
+    if (fd < 0) {
+      return INSTANCE_OPEN_ERROR;
+    }
+    int parsed = 0;
+    enum instance_status status =
+        load_stream(instance, fd, arena, &parsed, error_line);
+    if (status != INSTANCE_OK || parsed) {
+      return status == INSTANCE_OK ? edge_list_ready(instance, arena) : status;
+    }
+  } else if (map_file(path, &instance->file, arena) != 0) {
+    return INSTANCE_OPEN_ERROR;
+  }
+  return load_buffer(instance, instance->file.data, instance->file.size, arena,
+                     error_line);
+}
+
+enum instance_status instance_load_buffer(struct instance *instance,
+                                          const char *data, size_t size,
+                                          struct arena *arena,
+                                          size_t *error_line) {
+  memset(instance, 0, sizeof(*instance));
+  *error_line = 0;
+  // Compiled instances are used in place and need their 64-byte alignment.
+  if (is_tspb(data, size) && ((uintptr_t)data & 63) != 0) {
+    char *copy = arena_alloc(arena, size, 64);
+    if (!copy) {
+      return INSTANCE_NO_MEMORY;
+    }
+    memcpy(copy, data, size);
+    data = copy;
+  }
+  return load_buffer(instance, data, size, arena, error_line);
+}
+
+enum instance_status instance_load_road_graph(struct road_graph *graph,
+                                              const char *path,
+                                              struct arena *arena,
+                                              size_t *error_line) {
+  *error_line = 0;
+  // We only need the road graph file while we contract it; the hierarchy
+  // itself lives in the arena.
+  struct mapped_file graph_file;
+  if (map_file(path, &graph_file, arena) != 0) {
+    return INSTANCE_OPEN_ERROR;
+  }
+  int status = road_graph_build(graph, graph_file.data, graph_file.size,
+                                arena, error_line);
+  unmap_file(&graph_file);
+  if (status != 0) {
+    return *error_line > 0 ? INSTANCE_PARSE_ERROR : INSTANCE_NO_MEMORY;
+  }
+  return INSTANCE_OK;
+}
+
+enum instance_status instance_load_road(struct instance *instance,
+                                        const struct road_graph *graph,
+                                        const char *stops_path,
+                                        struct arena *arena,
+                                        size_t *error_line) {
+  memset(instance, 0, sizeof(*instance));
+  *error_line = 0;
+  instance->source = SOURCE_ROAD;
+  instance->road = graph;
+
+  // The stop names point into the stop list, so that mapping stays.
+  if (map_file(stops_path, &instance->file, arena) != 0) {
+    return INSTANCE_OPEN_ERROR;
+  }
+  uint32_t *stops;
+  if (road_stops_parse(instance->file.data, instance->file.size,
+                       graph->node_count, arena,
+                       &instance->edges.cities, &stops, error_line) != 0) {
+    return *error_line > 0 ? INSTANCE_PARSE_ERROR : INSTANCE_NO_MEMORY;
+  }
+  instance->city_count = instance->edges.cities.count;
+  instance->symmetric = graph->symmetric;
+  instance->cities = instance->edges.cities.names;
+  if (road_oracle_init(&instance->oracle, graph, stops,
+                       instance->city_count, arena) != 0) {
+    return INSTANCE_NO_MEMORY;
+  }
+  road_distance_init(&instance->road_distance, &instance->oracle);
+  instance->distance = &instance->road_distance.base;
+  return INSTANCE_OK;
+}
+
+void instance_close(struct instance *instance) {
+  unmap_file(&instance->file);
+}
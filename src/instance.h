@@ -0,0 +1,84 @@
+// A loaded instance: the city names plus the distance backend that matches the
+// input format. This is what the engines and the binary writer work with.
+#ifndef TSP_INSTANCE_H
+#define TSP_INSTANCE_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "csr.h"
+#include "distance.h"
+#include "parser.h"
+#include "road.h"
+#include "tsplib.h"
+
+enum instance_source {
+  SOURCE_EDGE_LIST, // `City1-City2: Distance` lines.
+  SOURCE_TSPLIB,
+  SOURCE_BINARY, // A file written by --compile.
+  SOURCE_ROAD,   // A stop list on a road graph.
+};
+
+enum instance_status {
+  INSTANCE_OK,
+  INSTANCE_OPEN_ERROR,
+  INSTANCE_PARSE_ERROR,
+  INSTANCE_NO_MEMORY,
+};
+
+struct instance {
+  enum instance_source source;
+  int city_count;
+  int symmetric;
+  const struct span *cities;
+  const struct distance *distance;
+
+  // The storage behind cities and distance. Only the members that belong to
+  // the source format are filled in.
+  struct mapped_file file;
+  struct parsed_instance edges;
+  struct tsplib_instance tsplib;
+  struct csr_graph graph;
+  struct dense_distance dense;
+  struct triangular_distance triangular;
+  struct csr_distance csr;
+  struct coord_distance coord;
+  const struct road_graph *road; // Shared; not part of the instance.
+  struct road_oracle oracle;
+  struct road_distance road_distance;
+};
+
+// Maps and parses path, picking the reader from the file contents. On a parse
+// error the 1-based line number is stored in error_line.
+enum instance_status instance_load(struct instance *instance, const char *path,
+                                   struct arena *arena, size_t *error_line);
+
+// Loads an instance from a buffer that holds a whole input file in any of
+// the formats instance_load reads (but not gzip). City names point into the
+// buffer, so it must outlive the instance.
+enum instance_status instance_load_buffer(struct instance *instance,
+                                          const char *data, size_t size,
+                                          struct arena *arena,
+                                          size_t *error_line);
+
+// Loads the road graph at path and contracts it into graph, allocated from
+// arena. Contracting is the expensive part of a road instance, so the graph
+// is built once and shared by the instances on it.
+enum instance_status instance_load_road_graph(struct road_graph *graph,
+                                              const char *path,
+                                              struct arena *arena,
+                                              size_t *error_line);
+
+// Maps the stop list at stops_path as an instance on the contracted graph,
+// which must outlive the instance. Distances between the stops are computed
+// as the engines ask for them.
+enum instance_status instance_load_road(struct instance *instance,
+                                        const struct road_graph *graph,
+                                        const char *stops_path,
+                                        struct arena *arena,
+                                        size_t *error_line);
+
+// Releases the mapping. Everything else belongs to the arena.
+void instance_close(struct instance *instance);
+
+#endif
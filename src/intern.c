@@ -0,0 +1,166 @@
+// Open-addressing hash table for city names.
+#include "intern.h"
+
+#include <string.h>
+
+// The final mixing step of MurmurHash3, used to spread the bits of a word.
+static uint64_t mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// A function to hash a city name. We consume the name eight bytes at a time,
+// which is much faster than the classic byte-at-a-time string hashes for the
+// long names we see in real inputs.
+uint64_t hash_name(const char *name, size_t len) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * 0x100000001b3ULL);
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, name, 8);
+    h = (h ^ mix64(word)) * 0x9e3779b97f4a7c15ULL;
+    name += 8;
+    len -= 8;
+  }
+  if (len > 0) {
+    uint64_t word = 0;
+    memcpy(&word, name, len);
+    h = (h ^ mix64(word)) * 0x9e3779b97f4a7c15ULL;
+  }
+  return mix64(h);
+}
+
+// A function to find the slot that holds name, or the empty slot where it
+// should be inserted. We use linear probing, which keeps the probe sequence in
+// the same cache lines.
+static struct city_slot *find_slot(const struct city_table *table,
+                                   const char *name, size_t len,
+                                   uint32_t hash) {
+  size_t i = hash & table->slot_mask;
+  while (1) {
+    struct city_slot *slot = &table->slots[i];
+    if (slot->index == 0) {
+      return slot;
+    }
+    if (slot->hash == hash) {
+      const struct span *city = &table->names[slot->index - 1];
+      if (city->len == len && memcmp(city->ptr, name, len) == 0) {
+        return slot;
+      }
+    }
+    i = (i + 1) & table->slot_mask;
+  }
+}
+
+// A function to double the number of slots. The stored hashes let us move the
+// entries without hashing the names again.
+static int grow_slots(struct city_table *table) {
+  size_t slot_count = table->slots ? (table->slot_mask + 1) * 2 : 256;
+  struct city_slot *slots = arena_calloc(
+      table->arena, slot_count * sizeof(struct city_slot), 64);
+  if (!slots) {
+    return -1;
+  }
+  size_t mask = slot_count - 1;
+  if (table->slots) {
+    for (size_t i = 0; i <= table->slot_mask; i++) {
+      struct city_slot slot = table->slots[i];
+      if (slot.index != 0) {
+        size_t j = slot.hash & mask;
+        while (slots[j].index != 0) {
+          j = (j + 1) & mask;
+        }
+        slots[j] = slot;
+      }
+    }
+  }
+  table->slots = slots;
+  table->slot_mask = mask;
+  return 0;
+}
+
+void city_table_init(struct city_table *table, struct arena *arena) {
+  memset(table, 0, sizeof(*table));
+  table->arena = arena;
+}
+
+int city_table_intern(struct city_table *table, const char *name, size_t len) {
+  // We keep the load factor at or below one half so probe sequences stay short.
+  if (!table->slots || (size_t)(table->count + 1) * 2 > table->slot_mask + 1) {
+    if (grow_slots(table) != 0) {
+      return -1;
+    }
+  }
+
+  uint32_t hash = (uint32_t)hash_name(name, len);
+  struct city_slot *slot = find_slot(table, name, len, hash);
+  if (slot->index != 0) {
+    return (int)slot->index - 1;
+  }
+
+  if (table->count == table->capacity) {
+    int capacity = table->capacity ? table->capacity * 2 : 64;
+    struct span *grown = arena_grow(
+        table->arena, table->names, table->capacity * sizeof(struct span),
+        capacity * sizeof(struct span), _Alignof(struct span));
+    if (!grown) {
+      return -1;
+    }
+    table->names = grown;
+    table->capacity = capacity;
+  }
+  if (table->copy_names) {
+    name = arena_strndup(table->arena, name, len);
+    if (!name) {
+      return -1;
+    }
+  }
+  table->names[table->count].ptr = name;
+  table->names[table->count].len = len;
+  slot->hash = hash;
+  slot->index = (uint32_t)table->count + 1;
+  return table->count++;
+}
+
+int city_table_find(const struct city_table *table, const char *name,
+                    size_t len) {
+  if (!table->slots) {
+    return -1;
+  }
+  struct city_slot *slot =
+      find_slot(table, name, len, (uint32_t)hash_name(name, len));
+  return (int)slot->index - 1;
+}
+
+void city_table_remove(struct city_table *table, int index) {
+  const struct span *name = &table->names[index];
+  struct city_slot *slot = find_slot(table, name->ptr, name->len,
+                                     (uint32_t)hash_name(name->ptr, name->len));
+
+  // We close the gap by moving later entries of the probe sequence back,
+  // unless their own home slot lies between the gap and where they are.
+  size_t mask = table->slot_mask;
+  size_t gap = (size_t)(slot - table->slots);
+  for (size_t i = (gap + 1) & mask; table->slots[i].index != 0;
+       i = (i + 1) & mask) {
+    size_t home = table->slots[i].hash & mask;
+    if (((i - home) & mask) >= ((i - gap) & mask)) {
+      table->slots[gap] = table->slots[i];
+      gap = i;
+    }
+  }
+  table->slots[gap] = (struct city_slot){0, 0};
+
+  int last = table->count - 1;
+  if (index != last) {
+    name = &table->names[last];
+    slot = find_slot(table, name->ptr, name->len,
+                     (uint32_t)hash_name(name->ptr, name->len));
+    slot->index = (uint32_t)index + 1;
+    table->names[index] = table->names[last];
+  }
+  table->count--;
+}
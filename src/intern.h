@@ -0,0 +1,55 @@
+// City name interning. We map every distinct city name to a dense index with
+// an open-addressing hash table, so looking up both endpoints of a line costs
+// O(1) no matter how many cities the instance has.
+#ifndef TSP_INTERN_H
+#define TSP_INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// A city name inside the input buffer. Names are not NUL terminated, so we
+// always carry the length around with the pointer.
+struct span {
+  const char *ptr;
+  size_t len;
+};
+
+// A slot of the hash table. index is the city index plus one, so a zeroed slot
+// is empty.
+struct city_slot {
+  uint32_t hash;
+  uint32_t index;
+};
+
+// The interned cities in the order they were first seen, plus the table we use
+// to find them by name. Both arrays live in the arena.
+struct city_table {
+  struct arena *arena;
+  int copy_names; // Copy new names into the arena instead of pointing at them.
+  struct span *names;
+  int count;
+  int capacity;
+  struct city_slot *slots;
+  size_t slot_mask; // The number of slots minus one (always a power of two).
+};
+
+uint64_t hash_name(const char *name, size_t len);
+
+void city_table_init(struct city_table *table, struct arena *arena);
+
+// Returns the index of name, adding it as a new city if it has not been seen
+// before. The name is only copied if the table has copy_names set. Returns -1
+// if we run out of memory.
+int city_table_intern(struct city_table *table, const char *name, size_t len);
+
+// Removes the city at index. The last city takes over its index, so the
+// indices stay dense; callers renumber their own data the same way.
+void city_table_remove(struct city_table *table, int index);
+
+// Returns the index of name, or -1 if it is not in the table.
+int city_table_find(const struct city_table *table, const char *name,
+                    size_t len);
+
+#endif
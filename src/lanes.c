@@ -0,0 +1,138 @@
+// The DP for many tiny instances at once, one instance per vector lane.
+#include "lanes.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "distance.h"
+
+// The costs of the state with the cities left and city, one per lane.
+static uint64_t *state(const struct lanes *lanes, uint64_t left, int city) {
+  return lanes->costs +
+         ((size_t)left * lanes->city_count + city) * TSP_LANES;
+}
+
+static const uint64_t *distance(const struct lanes *lanes, int from, int to) {
+  return lanes->di + ((size_t)from * lanes->city_count + to) * TSP_LANES;
+}
+
+void lanes_reset(struct lanes *lanes, int city_count) {
+  lanes->city_count = city_count;
+  memset(lanes->di, 0xff,
+         (size_t)city_count * city_count * TSP_LANES * sizeof(uint64_t));
+}
+
+void lanes_set(struct lanes *lanes, int lane, const uint64_t *di) {
+  int n = lanes->city_count;
+  for (int from = 0; from < n; from++) {
+    for (int to = 0; to < n; to++) {
+      lanes->di[((size_t)from * n + to) * TSP_LANES + lane] =
+          di[from * n + to];
+    }
+  }
+}
+
+// A function to relax the costs of a state in every lane with a step to the
+// next city and the cost from there. step + rest only wraps around when one
+// of them is NO_PATH, which shows as a sum smaller than step, and we only
+// take strictly smaller costs, so ties keep the lower next city.
+static void relax(uint64_t *to, const uint64_t *step, const uint64_t *rest) {
+  int lane = 0;
+#ifdef __AVX2__
+  // AVX2 only compares signed 64-bit integers, so we flip the sign bits
+  // first to get the unsigned order.
+  const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+  for (; lane + 4 <= TSP_LANES; lane += 4) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(step + lane));
+    __m256i current = _mm256_loadu_si256((const __m256i *)(to + lane));
+    __m256i sum = _mm256_add_epi64(
+        s, _mm256_loadu_si256((const __m256i *)(rest + lane)));
+    __m256i sum_biased = _mm256_xor_si256(sum, bias);
+    __m256i wrapped =
+        _mm256_cmpgt_epi64(_mm256_xor_si256(s, bias), sum_biased);
+    __m256i shorter =
+        _mm256_cmpgt_epi64(_mm256_xor_si256(current, bias), sum_biased);
+    __m256i take = _mm256_andnot_si256(wrapped, shorter);
+    _mm256_storeu_si256((__m256i *)(to + lane),
+                        _mm256_blendv_epi8(current, sum, take));
+  }
+#endif
+  for (; lane < TSP_LANES; lane++) {
+    uint64_t sum = step[lane] + rest[lane];
+    uint64_t take = -(uint64_t)((sum >= step[lane]) & (sum < to[lane]));
+    to[lane] = (sum & take) | (to[lane] & ~take);
+  }
+}
+
+int lanes_solve(struct lanes *lanes) {
+  int n = lanes->city_count;
+  uint64_t all = (1ULL << (n - 1)) - 1; // Every city but the first left.
+  size_t entries = (size_t)(all + 1) * n * TSP_LANES;
+  if (entries > lanes->capacity) {
+    free(lanes->costs);
+    lanes->costs = aligned_alloc(64, entries * sizeof(uint64_t));
+    lanes->capacity = lanes->costs ? entries : 0;
+    if (!lanes->costs) {
+      return -1;
+    }
+  }
+  // A set comes after the sets it is built from, which are smaller numbers.
+  for (uint64_t left = 0; left <= all; left++) {
+    // The first city is only current at the start, with every city left.
+    for (int city = left == all ? 0 : 1; city < n; city++) {
+      if (city > 0 && (left >> (city - 1) & 1)) {
+        continue;
+      }
+      uint64_t *to = state(lanes, left, city);
+      uint64_t start = left == 0 ? 0 : NO_PATH;
+      for (int lane = 0; lane < TSP_LANES; lane++) {
+        to[lane] = start;
+      }
+      for (uint64_t rest = left; rest; rest &= rest - 1) {
+        int bit = __builtin_ctzll(rest);
+        relax(to, distance(lanes, city, bit + 1),
+              state(lanes, left & ~(1ULL << bit), bit + 1));
+      }
+    }
+  }
+  return 0;
+}
+
+int lanes_route(const struct lanes *lanes, int lane, int *route) {
+  int n = lanes->city_count;
+  uint64_t left = (1ULL << (n - 1)) - 1;
+  int city = 0;
+  uint64_t cost = state(lanes, left, 0)[lane];
+  if (cost == NO_PATH) {
+    return 0;
+  }
+  // We follow the lowest next city whose step and rest make up the cost,
+  // which is the one the recurrence kept.
+  int count = 0;
+  route[count++] = 0;
+  while (left) {
+    for (uint64_t rest = left; rest; rest &= rest - 1) {
+      int bit = __builtin_ctzll(rest);
+      uint64_t step = distance(lanes, city, bit + 1)[lane];
+      uint64_t after = state(lanes, left & ~(1ULL << bit), bit + 1)[lane];
+      if (step != NO_PATH && after != NO_PATH && step + after == cost) {
+        city = bit + 1;
+        cost = after;
+        left &= ~(1ULL << bit);
+        break;
+      }
+    }
+    route[count++] = city;
+  }
+  return count;
+}
+
+void lanes_free(struct lanes *lanes) {
+  free(lanes->costs);
+  lanes->costs = NULL;
+  lanes->capacity = 0;
+}
@@ -0,0 +1,47 @@
+// The DP for many tiny instances at once. TSP_LANES instances of the same
+// size are laid out side by side, structure-of-arrays: every distance and
+// every state of the DP is an array of TSP_LANES costs, one per instance,
+// so each step of the recurrence is a few vector instructions for all of
+// them (four lanes per AVX2 instruction).
+//
+// The recurrence is that of tsp_dp, filled bottom-up: the cost of the
+// cheapest path that starts at a city and visits a set of cities that are
+// left, ending anywhere, for every set and city. Ties go to the lowest next
+// city as in tsp_dp, so the routes are the same as those of tsp_solve.
+#ifndef TSP_LANES_H
+#define TSP_LANES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "tsp.h"
+
+struct lanes {
+  int city_count;
+  // The distance from one city to another, then by lane.
+  uint64_t di[TSP_LANES_MAX_CITIES * TSP_LANES_MAX_CITIES * TSP_LANES];
+  // The costs of the states: by set of cities left (cities 1 and up, since
+  // the route starts at 0), then city, then lane. The table only grows.
+  uint64_t *costs;
+  size_t capacity;
+};
+
+// Starts a new group of instances with city_count cities. Lanes without an
+// instance have no edges.
+void lanes_reset(struct lanes *lanes, int city_count);
+
+// Puts the city_count x city_count distances di (NO_PATH for a missing edge)
+// into lane.
+void lanes_set(struct lanes *lanes, int lane, const uint64_t *di);
+
+// Runs the DP on every lane. Returns 0 on success and -1 if we run out of
+// memory.
+int lanes_solve(struct lanes *lanes);
+
+// Fills route with the route of lane and returns its length, or 0 if the
+// instance has no route.
+int lanes_route(const struct lanes *lanes, int lane, int *route);
+
+void lanes_free(struct lanes *lanes);
+
+#endif
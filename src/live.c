@@ -0,0 +1,290 @@
+// Live instances and the update format.
+#include "live.h"
+
+#include <string.h>
+
+#include "parser.h"
+
+static uint64_t *entry(const struct live_instance *live, int i, int j) {
+  return live->matrix + (size_t)i * live->capacity + j;
+}
+
+// A function to point the instance at our names and distances again, after
+// a change may have moved or resized them.
+static void sync_instance(struct live_instance *live) {
+  live->instance->city_count = live->dense.base.city_count;
+  live->instance->cities = live->cities.names;
+  live->instance->distance = &live->dense.base;
+}
+
+// A function to make room for count cities. We at least double the capacity,
+// so adding cities one by one costs O(n) each on average.
+static int reserve(struct live_instance *live, int count) {
+  if (count <= live->capacity) {
+    return 0;
+  }
+  int capacity = live->capacity * 2 > count ? live->capacity * 2 : count;
+  capacity = (capacity + 7) & ~7; // Rows start on cache line boundaries.
+  size_t entries = (size_t)capacity * capacity;
+  int k = live->candidates.k;
+  uint64_t *matrix = arena_alloc(live->arena, entries * sizeof(uint64_t), 64);
+  int *lists = arena_alloc(live->arena, (size_t)capacity * k * sizeof(int), 64);
+  uint64_t *costs =
+      arena_alloc(live->arena, (size_t)capacity * k * sizeof(uint64_t), 64);
+  int *js = arena_alloc(live->arena, capacity * sizeof(int), 64);
+  uint64_t *scratch = arena_alloc(live->arena, capacity * sizeof(uint64_t), 64);
+  if (!matrix || !lists || !costs || !js || !scratch) {
+    return -1;
+  }
+  memset(matrix, 0xff, entries * sizeof(uint64_t)); // All NO_PATH.
+  int n = live->dense.base.city_count;
+  for (int i = 0; i < n; i++) {
+    memcpy(matrix + (size_t)i * capacity, entry(live, i, 0),
+           n * sizeof(uint64_t));
+  }
+  if (n > 0) {
+    memcpy(lists, live->candidates.lists, (size_t)n * k * sizeof(int));
+    memcpy(costs, live->candidates.costs, (size_t)n * k * sizeof(uint64_t));
+  }
+  live->matrix = matrix;
+  live->capacity = capacity;
+  live->candidates.lists = lists;
+  live->candidates.costs = costs;
+  live->scratch_js = js;
+  live->scratch_costs = scratch;
+  dense_distance_init(&live->dense, n, matrix, capacity);
+  return 0;
+}
+
+// A function to recompute the mask of city and its bit in every other mask.
+static void refresh_masks(struct live_instance *live, int city) {
+  int n = live->dense.base.city_count;
+  if (city >= LIVE_MASK_CITIES) {
+    return;
+  }
+  if (n > LIVE_MASK_CITIES) {
+    n = LIVE_MASK_CITIES;
+  }
+  uint64_t bit = 1ULL << city;
+  live->adjacency[city] = 0;
+  for (int j = 0; j < n; j++) {
+    if (j == city) {
+      continue;
+    }
+    if (*entry(live, city, j) != NO_PATH) {
+      live->adjacency[city] |= 1ULL << j;
+    }
+    if (*entry(live, j, city) != NO_PATH) {
+      live->adjacency[j] |= bit;
+    } else {
+      live->adjacency[j] &= ~bit;
+    }
+  }
+}
+
+int live_instance_init(struct live_instance *live, struct instance *instance,
+                       int k, struct arena *arena) {
+  const struct distance *original = instance->distance;
+  int n = instance->city_count;
+  memset(live, 0, sizeof(*live));
+  live->instance = instance;
+  live->arena = arena;
+  live->candidates.k = k;
+  city_table_init(&live->cities, arena);
+  for (int i = 0; i < n; i++) {
+    if (city_table_intern(&live->cities, instance->cities[i].ptr,
+                          instance->cities[i].len) != i) {
+      return -1;
+    }
+  }
+  live->cities.copy_names = 1; // Names from update lines are not kept.
+  if (reserve(live, n + 8) != 0) {
+    return -1;
+  }
+
+  for (int i = 0; i < n; i++) {
+    int degree =
+        distance_neighbors(original, i, live->scratch_js, live->scratch_costs);
+    for (int m = 0; m < degree; m++) {
+      *entry(live, i, live->scratch_js[m]) = live->scratch_costs[m];
+    }
+    *entry(live, i, i) = 0;
+  }
+  live->dense.base.city_count = n;
+  for (int i = 0; i < n && i < LIVE_MASK_CITIES; i++) {
+    refresh_masks(live, i);
+  }
+  live->candidates.city_count = n;
+  for (int i = 0; i < n; i++) {
+    candidates_rebuild_city(&live->candidates, &live->dense.base, i,
+                            live->scratch_js, live->scratch_costs);
+  }
+  sync_instance(live);
+  return 0;
+}
+
+void live_set_edge(struct live_instance *live, int from, int to,
+                   uint64_t distance) {
+  if (from == to) {
+    return;
+  }
+  int symmetric = live->instance->symmetric;
+  uint64_t old = *entry(live, from, to);
+  *entry(live, from, to) = distance;
+  if (symmetric) {
+    *entry(live, to, from) = distance;
+  }
+  if (from < LIVE_MASK_CITIES && to < LIVE_MASK_CITIES) {
+    for (int side = 0; side <= symmetric; side++) {
+      int a = side ? to : from;
+      int b = side ? from : to;
+      if (distance != NO_PATH) {
+        live->adjacency[a] |= 1ULL << b;
+      } else {
+        live->adjacency[a] &= ~(1ULL << b);
+      }
+      if (distance < old) {
+        live->cheaper[a] |= 1ULL << b;
+      } else if (distance > old) {
+        live->dearer[a] |= 1ULL << b;
+      }
+    }
+  }
+  candidates_update(&live->candidates, &live->dense.base, from, to,
+                    live->scratch_js, live->scratch_costs);
+  if (symmetric) {
+    candidates_update(&live->candidates, &live->dense.base, to, from,
+                      live->scratch_js, live->scratch_costs);
+  }
+}
+
+int live_add_city(struct live_instance *live, const char *name, size_t len) {
+  int city = city_table_find(&live->cities, name, len);
+  if (city >= 0) {
+    return city;
+  }
+  city = live->dense.base.city_count;
+  if (reserve(live, city + 1) != 0 ||
+      city_table_intern(&live->cities, name, len) != city) {
+    return -1;
+  }
+  // Entries outside the cities are NO_PATH already, so only the diagonal
+  // needs setting.
+  *entry(live, city, city) = 0;
+  live->dense.base.city_count = city + 1;
+  live->cities_changed = 1;
+  refresh_masks(live, city);
+  live->candidates.city_count = city + 1;
+  candidates_rebuild_city(&live->candidates, &live->dense.base, city,
+                          live->scratch_js, live->scratch_costs);
+  sync_instance(live);
+  return city;
+}
+
+void live_remove_city(struct live_instance *live, int city) {
+  int last = live->dense.base.city_count - 1;
+  if (city != last) {
+    for (int j = 0; j < last; j++) {
+      if (j != city) {
+        *entry(live, city, j) = *entry(live, last, j);
+        *entry(live, j, city) = *entry(live, j, last);
+      }
+    }
+  }
+  for (int j = 0; j <= last; j++) {
+    *entry(live, last, j) = NO_PATH;
+    *entry(live, j, last) = NO_PATH;
+  }
+  *entry(live, city, city) = 0;
+  city_table_remove(&live->cities, city);
+  live->dense.base.city_count = last;
+  live->cities_changed = 1;
+
+  if (last < LIVE_MASK_CITIES) {
+    live->adjacency[last] = 0;
+    for (int j = 0; j < last; j++) {
+      live->adjacency[j] &= ~(1ULL << last);
+    }
+  }
+  if (city != last) {
+    refresh_masks(live, city);
+  }
+  candidates_remove_city(&live->candidates, &live->dense.base, city, last,
+                         live->scratch_js, live->scratch_costs);
+  sync_instance(live);
+}
+
+void live_forget_changes(struct live_instance *live) {
+  memset(live->cheaper, 0, sizeof(live->cheaper));
+  memset(live->dearer, 0, sizeof(live->dearer));
+  live->cities_changed = 0;
+}
+
+static int starts_with(const char *line, size_t len, const char *word) {
+  size_t word_len = strlen(word);
+  return len > word_len && memcmp(line, word, word_len) == 0;
+}
+
+enum live_status live_apply_line(struct live_instance *live, const char *line,
+                                 size_t len) {
+  if (len > 0 && line[len - 1] == '\r') {
+    len--; // Accept files with Windows line endings.
+  }
+  const char *end = line + len;
+  if (len == 0) {
+    return LIVE_OK;
+  }
+  if (len == strlen("solve") && memcmp(line, "solve", len) == 0) {
+    return LIVE_SOLVE;
+  }
+
+  // `City1-City2: Distance`, exactly as in an edge list.
+  if (memchr(line, ':', len)) {
+    const char *dash;
+    const char *colon;
+    uint64_t distance;
+    if (parse_edge_line(line, end, &dash, &colon, &distance) != 0) {
+      return LIVE_BAD_LINE;
+    }
+    int from = live_add_city(live, line, (size_t)(dash - line));
+    int to = from < 0 ? -1
+                      : live_add_city(live, dash + 1,
+                                      (size_t)(colon - dash - 1));
+    if (to < 0) {
+      return LIVE_NO_MEMORY;
+    }
+    live_set_edge(live, from, to, distance);
+    return LIVE_OK;
+  }
+
+  if (starts_with(line, len, "add ")) {
+    const char *name = line + strlen("add ");
+    if (memchr(name, '-', (size_t)(end - name))) {
+      return LIVE_BAD_LINE; // Names cannot contain '-'.
+    }
+    return live_add_city(live, name, (size_t)(end - name)) < 0
+               ? LIVE_NO_MEMORY
+               : LIVE_OK;
+  }
+
+  if (starts_with(line, len, "remove ")) {
+    const char *name = line + strlen("remove ");
+    const char *dash = memchr(name, '-', (size_t)(end - name));
+    if (!dash) {
+      int city = city_table_find(&live->cities, name, (size_t)(end - name));
+      if (city < 0) {
+        return LIVE_BAD_LINE;
+      }
+      live_remove_city(live, city);
+      return LIVE_OK;
+    }
+    int from = city_table_find(&live->cities, name, (size_t)(dash - name));
+    int to = city_table_find(&live->cities, dash + 1, (size_t)(end - dash - 1));
+    if (from < 0 || to < 0) {
+      return LIVE_BAD_LINE;
+    }
+    live_set_edge(live, from, to, NO_PATH);
+    return LIVE_OK;
+  }
+  return LIVE_BAD_LINE;
+}
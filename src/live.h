@@ -0,0 +1,83 @@
+// Instances that change between solves. A live instance copies the distances
+// of a loaded instance into a matrix with room to grow, and keeps the
+// structures the engines derive from them (the DP's adjacency masks and the
+// heuristic's candidate lists) next to it. A change is applied to all of them
+// in place, so a few changed edges cost a few updates instead of a new parse.
+//
+// Changes come one per line, in the spirit of the edge list format:
+//
+//   City1-City2: 42     sets a distance, adding unknown cities
+//   remove City1-City2  removes the edge
+//   add City3           adds a city without edges
+//   remove City3        removes a city and its edges
+//   solve               asks for a route of the instance as it is now
+#ifndef TSP_LIVE_H
+#define TSP_LIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "candidates.h"
+#include "distance.h"
+#include "instance.h"
+#include "intern.h"
+
+#define LIVE_MASK_CITIES 64 // Cities covered by the adjacency masks.
+
+enum live_status {
+  LIVE_OK,
+  LIVE_SOLVE,     // A `solve` line.
+  LIVE_BAD_LINE,  // A line we cannot read, or an unknown city.
+  LIVE_NO_MEMORY,
+};
+
+struct live_instance {
+  struct instance *instance; // Kept pointing at our names and distances.
+  struct arena *arena;
+  struct city_table cities;
+  uint64_t *matrix; // capacity x capacity, NO_PATH outside the cities.
+  int capacity;
+  struct dense_distance dense;
+  // Bit j of adjacency[i] is set if there is a path from i to j, for the
+  // first LIVE_MASK_CITIES cities.
+  uint64_t adjacency[LIVE_MASK_CITIES];
+  // The changes since live_forget_changes, for engines that keep results
+  // between solves: bit j of cheaper[i] is set if the edge from i to j got
+  // cheaper or appeared, of dearer[i] if it got dearer or disappeared, for
+  // the first LIVE_MASK_CITIES cities. cities_changed is set once a city
+  // was added or removed.
+  uint64_t cheaper[LIVE_MASK_CITIES];
+  uint64_t dearer[LIVE_MASK_CITIES];
+  int cities_changed;
+  struct candidates candidates;
+  int *scratch_js; // capacity entries, for rescanning candidate rows.
+  uint64_t *scratch_costs;
+};
+
+// Copies the distances of instance, which takes O(n^2) time and memory once,
+// and builds candidate lists of length k. From then on instance describes the
+// live instance. Returns 0 on success and -1 if we run out of memory.
+int live_instance_init(struct live_instance *live, struct instance *instance,
+                       int k, struct arena *arena);
+
+// Sets the distance from one city to another, and back again on symmetric
+// instances. NO_PATH removes the edge. Costs O(k) in the usual case.
+void live_set_edge(struct live_instance *live, int from, int to,
+                   uint64_t distance);
+
+// Adds a city without edges, or returns the city that already has this name.
+// Costs O(n) to clear its row and column. Returns -1 if we run out of memory.
+int live_add_city(struct live_instance *live, const char *name, size_t len);
+
+// Removes a city. The last city takes over its index. Costs O(n k).
+void live_remove_city(struct live_instance *live, int city);
+
+// Clears the record of changes.
+void live_forget_changes(struct live_instance *live);
+
+// Applies one line of changes (without its newline).
+enum live_status live_apply_line(struct live_instance *live, const char *line,
+                                 size_t len);
+
+#endif
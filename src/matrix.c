@@ -0,0 +1,269 @@
+// Distance matrices from coordinates.
+#include "matrix.h"
+
+#include <math.h>
+#include <pthread.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Everything the threads share. Each task writes only its own rows and the
+// tiles it mirrors from them, so there is no locking.
+struct matrix_work {
+  const struct tsplib_instance *instance;
+  const double *lat; // GEO coordinates in radians, converted once per city.
+  const double *lon;
+  int city_count;
+  int block_count;
+  uint64_t *out;
+  size_t stride; // 0 for a triangle.
+};
+
+struct matrix_worker {
+  struct matrix_work *work;
+  int id;
+  int count;
+};
+
+// A function to run fn on every worker, one thread per worker. The first
+// worker runs on the calling thread.
+static void run_workers(struct matrix_worker *workers, int count,
+                        void *(*fn)(void *)) {
+  pthread_t threads[MATRIX_MAX_THREADS];
+  int started[MATRIX_MAX_THREADS] = {0};
+  for (int t = 1; t < count; t++) {
+    started[t] = pthread_create(&threads[t], NULL, fn, &workers[t]) == 0;
+  }
+  fn(&workers[0]);
+  for (int t = 1; t < count; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    } else {
+      fn(&workers[t]); // We could not start a thread, so we do the work here.
+    }
+  }
+}
+
+// The same conversion as tsplib.c, so GEO distances come out identical.
+static double geo_radians(double x) {
+  const double pi = 3.141592;
+  double degrees = (double)(int64_t)x;
+  double minutes = x - degrees;
+  return pi * (degrees + 5.0 * minutes / 3.0) / 180.0;
+}
+
+// A function to compute the GEO distances from city i to cities [j0, j1).
+static void geo_row(const struct matrix_work *w, int i, int j0, int j1,
+                    uint64_t *out) {
+  const double radius = 6378.388;
+  for (int j = j0; j < j1; j++) {
+    if (j == i) {
+      out[j - j0] = 0;
+      continue;
+    }
+    double q1 = cos(w->lon[i] - w->lon[j]);
+    double q2 = cos(w->lat[i] - w->lat[j]);
+    double q3 = cos(w->lat[i] + w->lat[j]);
+    out[j - j0] = (uint64_t)(radius * acos(0.5 * ((1.0 + q1) * q2 -
+                                                  (1.0 - q1) * q3)) +
+                             1.0);
+  }
+}
+
+#ifdef __AVX2__
+// A function to compute the distances from city i to four cities at once
+// with the rounding of the weight type. floor(v + 0.5) is TSPLIB's nint for
+// the non-negative values we have, and sqrt and division are exact in both
+// AVX and scalar code, so the results match tsplib_distance bit for bit.
+static __m256d plane_distances(enum tsplib_weight_type type, __m256d xd,
+                               __m256d yd) {
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  __m256d sq = _mm256_add_pd(_mm256_mul_pd(xd, xd), _mm256_mul_pd(yd, yd));
+  switch (type) {
+  case TSPLIB_EUC_2D:
+    return _mm256_floor_pd(_mm256_add_pd(_mm256_sqrt_pd(sq), half));
+  case TSPLIB_CEIL_2D:
+    return _mm256_ceil_pd(_mm256_sqrt_pd(sq));
+  case TSPLIB_MAN_2D:
+    return _mm256_floor_pd(_mm256_add_pd(
+        _mm256_add_pd(_mm256_andnot_pd(sign, xd), _mm256_andnot_pd(sign, yd)),
+        half));
+  case TSPLIB_MAX_2D:
+    return _mm256_max_pd(
+        _mm256_floor_pd(_mm256_add_pd(_mm256_andnot_pd(sign, xd), half)),
+        _mm256_floor_pd(_mm256_add_pd(_mm256_andnot_pd(sign, yd), half)));
+  default: { // TSPLIB_ATT
+    __m256d r = _mm256_sqrt_pd(_mm256_div_pd(sq, _mm256_set1_pd(10.0)));
+    __m256d t = _mm256_floor_pd(_mm256_add_pd(r, half));
+    __m256d up = _mm256_and_pd(_mm256_cmp_pd(t, r, _CMP_LT_OQ),
+                               _mm256_set1_pd(1.0));
+    return _mm256_add_pd(t, up);
+  }
+  }
+}
+#endif
+
+// A function to compute the distances from city i to cities [j0, j1) into
+// out[0 .. j1 - j0).
+static void distance_row(const struct matrix_work *w, int i, int j0, int j1,
+                         uint64_t *out) {
+  const struct tsplib_instance *instance = w->instance;
+  if (instance->weight_type == TSPLIB_GEO) {
+    geo_row(w, i, j0, j1, out);
+    return;
+  }
+  int j = j0;
+#ifdef __AVX2__
+  // Whole numbers below 2^52 turn into integers by adding 2^52 and taking
+  // the low bits, which AVX2 can do while it has no double to int64 convert.
+  const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+  const __m256d xi = _mm256_set1_pd(instance->x[i]);
+  const __m256d yi = _mm256_set1_pd(instance->y[i]);
+  for (; j + 4 <= j1; j += 4) {
+    __m256d xd = _mm256_sub_pd(_mm256_loadu_pd(instance->x + j), xi);
+    __m256d yd = _mm256_sub_pd(_mm256_loadu_pd(instance->y + j), yi);
+    __m256d v = plane_distances(instance->weight_type, xd, yd);
+    if (_mm256_movemask_pd(_mm256_cmp_pd(v, magic, _CMP_GE_OQ)) != 0) {
+      break; // Huge distances go the scalar way.
+    }
+    __m256i bits = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(v, magic)),
+                                    _mm256_castpd_si256(magic));
+    _mm256_storeu_si256((__m256i *)(out + (j - j0)), bits);
+  }
+#endif
+  for (; j < j1; j++) {
+    out[j - j0] = tsplib_distance(instance, i, j);
+  }
+}
+
+static int block_end(const struct matrix_work *w, int block) {
+  int end = (block + 1) * MATRIX_BLOCK;
+  return end < w->city_count ? end : w->city_count;
+}
+
+// A function to fill the rows of every block this worker owns. We compute
+// the tiles on and right of the diagonal and copy each one below it; a tile
+// is 32 KB, so the copy reads it from the cache.
+static void *dense_thread(void *arg) {
+  struct matrix_worker *worker = arg;
+  struct matrix_work *w = worker->work;
+  size_t stride = w->stride;
+  for (int ib = worker->id; ib < w->block_count; ib += worker->count) {
+    int i_start = ib * MATRIX_BLOCK;
+    int i_end = block_end(w, ib);
+    for (int jb = ib; jb < w->block_count; jb++) {
+      int j_start = jb * MATRIX_BLOCK;
+      int j_end = block_end(w, jb);
+      for (int i = i_start; i < i_end; i++) {
+        distance_row(w, i, j_start, j_end, w->out + i * stride + j_start);
+      }
+      if (jb == ib) {
+        continue;
+      }
+      for (int j = j_start; j < j_end; j++) {
+        uint64_t *row_j = w->out + j * stride;
+        for (int i = i_start; i < i_end; i++) {
+          row_j[i] = w->out[i * stride + j];
+        }
+      }
+    }
+    for (int i = i_start; i < i_end; i++) {
+      for (size_t j = (size_t)w->city_count; j < stride; j++) {
+        w->out[i * stride + j] = NO_PATH; // The padding, as matrix_alloc has.
+      }
+    }
+  }
+  return NULL;
+}
+
+// A function to fill the triangle rows of every block this worker owns.
+// Rows get shorter towards the bottom, and taking every count-th block
+// spreads the long and the short ones over the workers.
+static void *triangular_thread(void *arg) {
+  struct matrix_worker *worker = arg;
+  struct matrix_work *w = worker->work;
+  size_t n = (size_t)w->city_count;
+  for (int ib = worker->id; ib < w->block_count; ib += worker->count) {
+    for (int i = ib * MATRIX_BLOCK; i < block_end(w, ib); i++) {
+      if ((size_t)i + 1 < n) {
+        distance_row(w, i, i + 1, (int)n,
+                     w->out + triangular_index(n, i, i + 1));
+      }
+    }
+  }
+  return NULL;
+}
+
+// A function to set up the work and run fn on up to thread_count threads.
+static int build(struct matrix_work *w, const struct tsplib_instance *instance,
+                 int thread_count, struct arena *arena, void *(*fn)(void *)) {
+  int n = instance->dimension;
+  w->instance = instance;
+  w->city_count = n;
+  w->block_count = (n + MATRIX_BLOCK - 1) / MATRIX_BLOCK;
+  w->lat = NULL;
+  w->lon = NULL;
+  if (instance->weight_type == TSPLIB_GEO) {
+    double *lat = arena_alloc(arena, n * sizeof(double), 64);
+    double *lon = arena_alloc(arena, n * sizeof(double), 64);
+    if (!lat || !lon) {
+      return -1;
+    }
+    for (int i = 0; i < n; i++) {
+      lat[i] = geo_radians(instance->x[i]);
+      lon[i] = geo_radians(instance->y[i]);
+    }
+    w->lat = lat;
+    w->lon = lon;
+  }
+
+  if (thread_count > MATRIX_MAX_THREADS) {
+    thread_count = MATRIX_MAX_THREADS;
+  }
+  if (thread_count > w->block_count) {
+    thread_count = w->block_count;
+  }
+  if (thread_count < 1) {
+    thread_count = 1;
+  }
+  struct matrix_worker workers[MATRIX_MAX_THREADS];
+  for (int t = 0; t < thread_count; t++) {
+    workers[t] = (struct matrix_worker){w, t, thread_count};
+  }
+  run_workers(workers, thread_count, fn);
+  return 0;
+}
+
+int matrix_build_dense(struct dense_distance *d,
+                       const struct tsplib_instance *instance,
+                       int thread_count, struct arena *arena) {
+  int n = instance->dimension;
+  struct matrix_work w;
+  // We write every entry, so there is no point in matrix_alloc filling them.
+  w.stride = ((size_t)n + 7) & ~(size_t)7;
+  w.out = arena_alloc(arena, (size_t)n * w.stride * sizeof(uint64_t), 64);
+  if (!w.out || build(&w, instance, thread_count, arena, dense_thread) != 0) {
+    return -1;
+  }
+  dense_distance_init(d, n, w.out, w.stride);
+  d->base.complete = 1;
+  return 0;
+}
+
+int matrix_build_triangular(struct triangular_distance *d,
+                            const struct tsplib_instance *instance,
+                            int thread_count, struct arena *arena) {
+  size_t n = (size_t)instance->dimension;
+  struct matrix_work w;
+  w.stride = 0;
+  w.out = arena_alloc(arena, n * (n - 1) / 2 * sizeof(uint64_t), 64);
+  if (!w.out ||
+      build(&w, instance, thread_count, arena, triangular_thread) != 0) {
+    return -1;
+  }
+  triangular_distance_init(d, (int)n, w.out);
+  d->base.complete = 1;
+  return 0;
+}
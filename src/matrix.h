@@ -0,0 +1,31 @@
+// Distance matrices built from coordinates. Coordinate instances normally
+// compute every distance on demand; when an engine looks the same pairs up
+// many times (or the GEO formula makes each lookup expensive) it pays to
+// compute them all once. We build the matrix on every CPU, a block of rows
+// per task, with an AVX2 kernel for the plane metrics. The results match
+// tsplib_distance exactly, rounding included.
+#ifndef TSP_MATRIX_H
+#define TSP_MATRIX_H
+
+#include "arena.h"
+#include "distance.h"
+#include "tsplib.h"
+
+#define MATRIX_BLOCK 64 // Rows per task, and the side of a tile we mirror.
+#define MATRIX_MAX_THREADS 64
+
+// Builds a full matrix, rows padded as by matrix_alloc. Every coordinate
+// metric is symmetric, so we compute one triangle tile by tile and mirror each
+// tile while it is still in the cache. Returns 0 on success and -1 if we run
+// out of memory.
+int matrix_build_dense(struct dense_distance *d,
+                       const struct tsplib_instance *instance,
+                       int thread_count, struct arena *arena);
+
+// Builds the strict upper triangle, at half the memory of a full matrix.
+// Returns 0 on success and -1 if we run out of memory.
+int matrix_build_triangular(struct triangular_distance *d,
+                            const struct tsplib_instance *instance,
+                            int thread_count, struct arena *arena);
+
+#endif
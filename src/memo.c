@@ -0,0 +1,78 @@
+// The concurrent memo table.
+#include "memo.h"
+
+#include <stdlib.h>
+
+// An empty slot holds 0, so a slot holds its value plus one. TSP_COST_NO_PATH
+// (UINT64_MAX) is kept as it is, which leaves UINT64_MAX - 1 without a slot
+// value of its own.
+#define MEMO_UNKEPT (UINT64_MAX - 1)
+
+int memo_init(struct memo_table *memo, uint64_t keys) {
+  memo->block_count =
+      (size_t)((keys + MEMO_BLOCK_SLOTS - 1) / MEMO_BLOCK_SLOTS);
+  memo->blocks = calloc(memo->block_count ? memo->block_count : 1,
+                        sizeof(*memo->blocks));
+  atomic_init(&memo->used, 0);
+  return memo->blocks ? 0 : -1;
+}
+
+int memo_find(struct memo_table *memo, uint64_t key, uint64_t *value) {
+  _Atomic uint64_t *block = atomic_load_explicit(
+      &memo->blocks[key / MEMO_BLOCK_SLOTS], memory_order_acquire);
+  if (!block) {
+    return 0;
+  }
+  uint64_t slot = atomic_load_explicit(&block[key % MEMO_BLOCK_SLOTS],
+                                       memory_order_relaxed);
+  if (slot == 0) {
+    return 0;
+  }
+  *value = slot == UINT64_MAX ? UINT64_MAX : slot - 1;
+  return 1;
+}
+
+// A function to add block at, unless another thread got there first or the
+// table is full. Returns the block, or NULL.
+static _Atomic uint64_t *add_block(struct memo_table *memo, size_t at) {
+  size_t max_blocks = MEMO_MAX_BYTES / (MEMO_BLOCK_SLOTS * sizeof(uint64_t));
+  if (atomic_fetch_add_explicit(&memo->used, 1, memory_order_relaxed) >=
+      max_blocks) {
+    atomic_fetch_sub_explicit(&memo->used, 1, memory_order_relaxed);
+    return NULL; // Full.
+  }
+  _Atomic uint64_t *added = calloc(MEMO_BLOCK_SLOTS, sizeof(uint64_t));
+  _Atomic uint64_t *expected = NULL;
+  if (added && atomic_compare_exchange_strong_explicit(
+                   &memo->blocks[at], &expected, added, memory_order_acq_rel,
+                   memory_order_acquire)) {
+    return added;
+  }
+  free(added);
+  atomic_fetch_sub_explicit(&memo->used, 1, memory_order_relaxed);
+  return expected; // The block another thread added, or NULL.
+}
+
+void memo_store(struct memo_table *memo, uint64_t key, uint64_t value) {
+  if (value == MEMO_UNKEPT) {
+    return;
+  }
+  size_t at = (size_t)(key / MEMO_BLOCK_SLOTS);
+  _Atomic uint64_t *block =
+      atomic_load_explicit(&memo->blocks[at], memory_order_acquire);
+  if (!block && !(block = add_block(memo, at))) {
+    return;
+  }
+  // Threads that race on a pair store the same cost, so the last one wins.
+  atomic_store_explicit(&block[key % MEMO_BLOCK_SLOTS],
+                        value == UINT64_MAX ? UINT64_MAX : value + 1,
+                        memory_order_relaxed);
+}
+
+void memo_free(struct memo_table *memo) {
+  for (size_t i = 0; i < memo->block_count; i++) {
+    free(atomic_load_explicit(&memo->blocks[i], memory_order_relaxed));
+  }
+  free(memo->blocks);
+  memo->blocks = NULL;
+}
@@ -0,0 +1,51 @@
+// A concurrent memo from city pairs to distances. Every pair has a fixed slot
+// of its own, so a lookup is two loads and never probes. The slots come in
+// blocks that we only allocate when the first pair in them is stored: most
+// searches ask for a small share of the n^2 pairs, and those that ask for all
+// of them fill the table as they go instead of paying for it before solving.
+// A writer adds a missing block with a compare-and-swap and stores the value
+// in one atomic write, so a reader either sees a finished entry or no entry
+// at all. Once the blocks take MEMO_MAX_BYTES we stop adding blocks; lookups
+// of pairs that did not fit simply miss and are computed again.
+#ifndef TSP_MEMO_H
+#define TSP_MEMO_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEMO_BLOCK_SLOTS 4096               // 32 KB of slots per block.
+#define MEMO_MAX_BYTES ((size_t)256 << 20) // In blocks, at most.
+
+struct memo_table {
+  _Atomic(_Atomic uint64_t *) *blocks; // NULL until the block is added.
+  size_t block_count;
+  atomic_size_t used; // Blocks added so far.
+};
+
+// The key of the pair (i, j) of an instance with city_count cities.
+static inline uint64_t memo_key(int city_count, int i, int j) {
+  return (uint64_t)i * (uint64_t)city_count + (uint64_t)j;
+}
+
+// The key of the pair (i, j), i < j, when the pair (j, i) has the same
+// distance. These keys are below n (n - 1) / 2.
+static inline uint64_t memo_symmetric_key(int i, int j) {
+  return (uint64_t)j * (uint64_t)(j - 1) / 2 + (uint64_t)i;
+}
+
+// Sets up an empty table for keys below keys. Returns 0 on success and -1 if
+// we run out of memory.
+int memo_init(struct memo_table *memo, uint64_t keys);
+
+// Looks key up. Returns 1 and stores the value if it is there, 0 otherwise.
+int memo_find(struct memo_table *memo, uint64_t key, uint64_t *value);
+
+// Adds key, unless its block is missing and the table is full. A value of
+// UINT64_MAX - 1 is not kept.
+void memo_store(struct memo_table *memo, uint64_t key, uint64_t value);
+
+// Frees the table. No thread may use it any more.
+void memo_free(struct memo_table *memo);
+
+#endif
@@ -0,0 +1,384 @@
+// Result output: the buffer and the formats.
+#include "output.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void out_bytes(struct out_buffer *out, const void *data, size_t len) {
+  if (out->failed) {
+    return;
+  }
+  if (out->len + len > out->capacity) {
+    size_t capacity = out->capacity ? out->capacity * 2 : 4096;
+    while (capacity < out->len + len) {
+      capacity *= 2;
+    }
+    char *grown = realloc(out->data, capacity);
+    if (!grown) {
+      out->failed = 1;
+      return;
+    }
+    out->data = grown;
+    out->capacity = capacity;
+  }
+  memcpy(out->data + out->len, data, len);
+  out->len += len;
+}
+
+void out_string(struct out_buffer *out, const char *str) {
+  out_bytes(out, str, strlen(str));
+}
+
+void out_u64(struct out_buffer *out, uint64_t value) {
+  char digits[20];
+  int start = sizeof(digits);
+  do {
+    digits[--start] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  out_bytes(out, digits + start, sizeof(digits) - start);
+}
+
+// Little-endian integers, whatever the byte order of the machine.
+void out_le32(struct out_buffer *out, uint32_t value) {
+  unsigned char bytes[4];
+  for (int i = 0; i < 4; i++) {
+    bytes[i] = (unsigned char)(value >> (8 * i));
+  }
+  out_bytes(out, bytes, sizeof(bytes));
+}
+
+void out_le64(struct out_buffer *out, uint64_t value) {
+  unsigned char bytes[8];
+  for (int i = 0; i < 8; i++) {
+    bytes[i] = (unsigned char)(value >> (8 * i));
+  }
+  out_bytes(out, bytes, sizeof(bytes));
+}
+
+int out_flush(struct out_buffer *out, FILE *file) {
+  int failed = out->failed;
+  if (out->len > 0 && fwrite(out->data, 1, out->len, file) != out->len) {
+    failed = 1;
+  }
+  out->len = 0;
+  out->failed = 0;
+  return failed ? -1 : 0;
+}
+
+void out_free(struct out_buffer *out) {
+  free(out->data);
+  memset(out, 0, sizeof(*out));
+}
+
+// A function to tell whether the solve left a route to print: a complete one,
+// or the best one a cancelled solve had.
+static int has_route(const struct tsp_context *ctx, enum tsp_status status) {
+  return status == TSP_OK ||
+         (status == TSP_CANCELLED && tsp_route_length(ctx) > 0);
+}
+
+static void text_result(struct out_buffer *out, const struct tsp_context *ctx,
+                        enum tsp_status status) {
+  if (!has_route(ctx, status)) {
+    out_string(out, "No valid TSP route found.\n");
+    return;
+  }
+  const int *route = tsp_route(ctx);
+  const uint64_t *legs = tsp_leg_costs(ctx);
+  out_string(out, "We will visit the cities in the following order:\n");
+  for (int i = 0; i + 1 < tsp_route_length(ctx); i++) {
+    size_t from_len, to_len;
+    const char *from = tsp_city_name(ctx, route[i], &from_len);
+    const char *to = tsp_city_name(ctx, route[i + 1], &to_len);
+    out_bytes(out, from, from_len);
+    out_string(out, " -( ");
+    out_u64(out, legs[i]);
+    out_string(out, " )-> ");
+    out_bytes(out, to, to_len);
+    out_bytes(out, "\n", 1);
+  }
+  out_string(out, "Total cost: "); // The total cost to visit the cities.
+  out_u64(out, tsp_route_cost(ctx));
+  out_bytes(out, "\n", 1);
+}
+
+// A function to append a JSON string. Names are passed through as they are,
+// so they should be UTF-8; quotes, backslashes and control characters are
+// escaped.
+static void json_string(struct out_buffer *out, const char *str, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  out_bytes(out, "\"", 1);
+  size_t run = 0; // Characters we can copy as they are.
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)str[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    out_bytes(out, str + run, i - run);
+    run = i + 1;
+    if (c == '"' || c == '\\') {
+      char escape[2] = {'\\', (char)c};
+      out_bytes(out, escape, 2);
+    } else {
+      char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+      out_bytes(out, escape, 6);
+    }
+  }
+  out_bytes(out, str + run, len - run);
+  out_bytes(out, "\"", 1);
+}
+
+static void json_result(struct out_buffer *out, const struct tsp_context *ctx,
+                        enum tsp_status status, const char *instance) {
+  struct tsp_solve_stats stats;
+  tsp_solve_stats(ctx, &stats);
+  out_bytes(out, "{", 1);
+  if (instance) {
+    out_string(out, "\"instance\":");
+    json_string(out, instance, strlen(instance));
+    out_bytes(out, ",", 1);
+  }
+  out_string(out, status == TSP_OK          ? "\"status\":\"ok\""
+                 : status == TSP_CANCELLED ? "\"status\":\"cancelled\""
+                                           : "\"status\":\"no_route\"");
+  out_string(out, ",\"cities\":");
+  out_u64(out, (uint64_t)tsp_city_count(ctx));
+  out_string(out, stats.engine == TSP_ENGINE_DP ? ",\"engine\":\"dp\""
+                                                : ",\"engine\":\"heuristic\"");
+  out_string(out, stats.cached ? ",\"cached\":true" : ",\"cached\":false");
+  char time[32];
+  snprintf(time, sizeof(time), ",\"solve_ms\":%.3f",
+           stats.nanoseconds / 1e6);
+  out_string(out, time);
+  if (has_route(ctx, status)) {
+    const int *route = tsp_route(ctx);
+    const uint64_t *legs = tsp_leg_costs(ctx);
+    int count = tsp_route_length(ctx);
+    out_string(out, ",\"cost\":");
+    out_u64(out, tsp_route_cost(ctx));
+    out_string(out, ",\"tour\":[");
+    for (int i = 0; i < count; i++) {
+      if (i > 0) {
+        out_bytes(out, ",", 1);
+      }
+      out_u64(out, (uint64_t)route[i]);
+    }
+    out_string(out, "],\"names\":[");
+    for (int i = 0; i < count; i++) {
+      size_t len;
+      const char *name = tsp_city_name(ctx, route[i], &len);
+      if (i > 0) {
+        out_bytes(out, ",", 1);
+      }
+      json_string(out, name, len);
+    }
+    out_string(out, "],\"legs\":[");
+    for (int i = 0; i + 1 < count; i++) {
+      if (i > 0) {
+        out_bytes(out, ",", 1);
+      }
+      out_u64(out, legs[i]);
+    }
+    out_bytes(out, "]", 1);
+  }
+  out_string(out, "}\n");
+}
+
+// A function to append a CSV field, quoted if it holds a comma, a quote or a
+// line break.
+static void csv_field(struct out_buffer *out, const char *str, size_t len) {
+  if (!memchr(str, ',', len) && !memchr(str, '"', len) &&
+      !memchr(str, '\n', len) && !memchr(str, '\r', len)) {
+    out_bytes(out, str, len);
+    return;
+  }
+  out_bytes(out, "\"", 1);
+  for (size_t i = 0; i < len; i++) {
+    if (str[i] == '"') {
+      out_bytes(out, "\"", 1); // Quotes are doubled.
+    }
+    out_bytes(out, &str[i], 1);
+  }
+  out_bytes(out, "\"", 1);
+}
+
+const char *output_csv_header(int labelled) {
+  return labelled ? "instance,step,city,name,leg_cost\n"
+                  : "step,city,name,leg_cost\n";
+}
+
+// A function to append one row per city of the route. The leg cost is that
+// of the leg leaving the city, so the last row has none. A solve without a
+// route has no rows.
+static void csv_result(struct out_buffer *out, const struct tsp_context *ctx,
+                       enum tsp_status status, const char *instance) {
+  if (!has_route(ctx, status)) {
+    return;
+  }
+  const int *route = tsp_route(ctx);
+  const uint64_t *legs = tsp_leg_costs(ctx);
+  int count = tsp_route_length(ctx);
+  for (int i = 0; i < count; i++) {
+    if (instance) {
+      csv_field(out, instance, strlen(instance));
+      out_bytes(out, ",", 1);
+    }
+    size_t len;
+    const char *name = tsp_city_name(ctx, route[i], &len);
+    out_u64(out, (uint64_t)i);
+    out_bytes(out, ",", 1);
+    out_u64(out, (uint64_t)route[i]);
+    out_bytes(out, ",", 1);
+    csv_field(out, name, len);
+    out_bytes(out, ",", 1);
+    if (i + 1 < count) {
+      out_u64(out, legs[i]);
+    }
+    out_bytes(out, "\n", 1);
+  }
+}
+
+const char *output_all_pairs_csv_header(void) {
+  return "start,end,start_name,end_name,cost\n";
+}
+
+void output_all_pairs(struct out_buffer *out, enum output_format format,
+                      const struct tsp_context *ctx, const uint64_t *costs) {
+  int n = tsp_city_count(ctx);
+  if (format == OUTPUT_JSON) {
+    struct tsp_solve_stats stats;
+    tsp_solve_stats(ctx, &stats);
+    out_string(out, n > 0 ? "{\"status\":\"ok\",\"cities\":"
+                          : "{\"status\":\"no_route\",\"cities\":");
+    out_u64(out, (uint64_t)n);
+    char time[32];
+    snprintf(time, sizeof(time), ",\"solve_ms\":%.3f",
+             stats.nanoseconds / 1e6);
+    out_string(out, time);
+    out_string(out, ",\"names\":[");
+    for (int i = 0; i < n; i++) {
+      size_t len;
+      const char *name = tsp_city_name(ctx, i, &len);
+      if (i > 0) {
+        out_bytes(out, ",", 1);
+      }
+      json_string(out, name, len);
+    }
+    out_string(out, "],\"costs\":[");
+    for (int from = 0; from < n; from++) {
+      out_string(out, from > 0 ? ",[" : "[");
+      for (int to = 0; to < n; to++) {
+        uint64_t cost = costs[(size_t)from * n + to];
+        if (to > 0) {
+          out_bytes(out, ",", 1);
+        }
+        if (cost == UINT64_MAX) {
+          out_string(out, "null");
+        } else {
+          out_u64(out, cost);
+        }
+      }
+      out_bytes(out, "]", 1);
+    }
+    out_string(out, "]}\n");
+    return;
+  }
+  if (format == OUTPUT_TEXT) {
+    out_string(out, n > 0 ? "Cheapest paths through every city:\n"
+                          : "No valid TSP route found.\n");
+  }
+  for (int from = 0; from < n; from++) {
+    size_t from_len;
+    const char *from_name = tsp_city_name(ctx, from, &from_len);
+    for (int to = 0; to < n; to++) {
+      if (to == from && n > 1) {
+        continue;
+      }
+      size_t to_len;
+      const char *to_name = tsp_city_name(ctx, to, &to_len);
+      uint64_t cost = costs[(size_t)from * n + to];
+      if (format == OUTPUT_CSV) {
+        out_u64(out, (uint64_t)from);
+        out_bytes(out, ",", 1);
+        out_u64(out, (uint64_t)to);
+        out_bytes(out, ",", 1);
+        csv_field(out, from_name, from_len);
+        out_bytes(out, ",", 1);
+        csv_field(out, to_name, to_len);
+        out_bytes(out, ",", 1);
+        if (cost != UINT64_MAX) {
+          out_u64(out, cost);
+        }
+      } else {
+        out_bytes(out, from_name, from_len);
+        out_string(out, " -> ");
+        out_bytes(out, to_name, to_len);
+        out_string(out, ": ");
+        if (cost == UINT64_MAX) {
+          out_string(out, "no route");
+        } else {
+          out_u64(out, cost);
+        }
+      }
+      out_bytes(out, "\n", 1);
+    }
+  }
+}
+
+void output_binary(struct out_buffer *out, const struct tsp_context *ctx,
+                   enum tsp_status status) {
+  size_t start = out->len;
+  unsigned char code = (unsigned char)status;
+  out_bytes(out, &code, 1);
+  out_le32(out, 0); // The length, filled in at the end.
+  if (has_route(ctx, status)) {
+    const int *route = tsp_route(ctx);
+    const uint64_t *legs = tsp_leg_costs(ctx);
+    int count = tsp_route_length(ctx);
+    out_le32(out, (uint32_t)count);
+    out_le64(out, tsp_route_cost(ctx));
+    for (int i = 0; i < count; i++) {
+      size_t len;
+      const char *name = tsp_city_name(ctx, route[i], &len);
+      out_le32(out, (uint32_t)route[i]);
+      out_le32(out, (uint32_t)len);
+      out_bytes(out, name, len);
+    }
+    for (int i = 0; i + 1 < count; i++) {
+      out_le64(out, legs[i]);
+    }
+  } else if (status != TSP_NO_ROUTE && status != TSP_CANCELLED) {
+    const char *message = tsp_error_message(ctx);
+    out_le64(out, tsp_error_line(ctx));
+    if (status == TSP_PLUGIN_ERROR && message) {
+      out_string(out, message);
+    }
+  }
+  if (out->failed) {
+    return;
+  }
+  uint32_t len = (uint32_t)(out->len - start - 5);
+  for (int i = 0; i < 4; i++) {
+    out->data[start + 1 + i] = (char)(len >> (8 * i));
+  }
+}
+
+void output_result(struct out_buffer *out, enum output_format format,
+                   const struct tsp_context *ctx, enum tsp_status status,
+                   const char *instance) {
+  switch (format) {
+  case OUTPUT_TEXT:
+    text_result(out, ctx, status);
+    break;
+  case OUTPUT_JSON:
+    json_result(out, ctx, status, instance);
+    break;
+  case OUTPUT_CSV:
+    csv_result(out, ctx, status, instance);
+    break;
+  case OUTPUT_BINARY:
+    output_binary(out, ctx, status);
+    break;
+  }
+}
@@ -0,0 +1,74 @@
+// Result output. Routes are formatted into one growing buffer, with our own
+// integer formatting instead of a printf call per leg, and written with a
+// single call, so printing a route of a million cities takes milliseconds.
+//
+// The formats:
+//   text    the human readable output.
+//   json    one object per solve, on one line.
+//   csv     a header, then one row per city of the route.
+//   binary  the response frame of the daemon (see serve.h).
+#ifndef TSP_OUTPUT_H
+#define TSP_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tsp.h"
+
+enum output_format {
+  OUTPUT_TEXT,
+  OUTPUT_JSON,
+  OUTPUT_CSV,
+  OUTPUT_BINARY,
+};
+
+struct out_buffer {
+  char *data;
+  size_t len;
+  size_t capacity;
+  int failed; // We ran out of memory; the contents are incomplete.
+};
+
+// Appends to the buffer. Running out of memory sets failed and drops the
+// rest, so callers check once at the end.
+void out_bytes(struct out_buffer *out, const void *data, size_t len);
+void out_string(struct out_buffer *out, const char *str);
+void out_u64(struct out_buffer *out, uint64_t value); // In decimal.
+void out_le32(struct out_buffer *out, uint32_t value);
+void out_le64(struct out_buffer *out, uint64_t value);
+
+// Writes the buffer to file and empties it. Returns 0 on success and -1 if
+// the write failed or the buffer is incomplete.
+int out_flush(struct out_buffer *out, FILE *file);
+void out_free(struct out_buffer *out);
+
+// Appends the result of the last solve of ctx, which returned status (TSP_OK,
+// TSP_NO_ROUTE or TSP_CANCELLED, with the best route so far if there is
+// one). instance, if not NULL, labels the result: it becomes a
+// field of JSON objects and the first column of CSV rows.
+void output_result(struct out_buffer *out, enum output_format format,
+                   const struct tsp_context *ctx, enum tsp_status status,
+                   const char *instance);
+
+// Returns the CSV header line, with the instance column if labelled is set.
+const char *output_csv_header(int labelled);
+
+// Appends the costs of tsp_solve_all_pairs, n x n for the n cities of ctx, in
+// text, JSON or CSV. The JSON object has a row of costs per first city, with
+// null where there is no path; text and CSV have a line per pair of
+// different cities. An instance without cities has no route.
+void output_all_pairs(struct out_buffer *out, enum output_format format,
+                      const struct tsp_context *ctx, const uint64_t *costs);
+
+// Returns the CSV header line of output_all_pairs.
+const char *output_all_pairs_csv_header(void);
+
+// Appends the binary frame of the last solve: the route payload of serve.h
+// for TSP_OK and a cancelled solve with a route, an empty one for
+// TSP_NO_ROUTE or a cancelled solve without, and for other statuses the error
+// line and, for plugin errors, the message.
+void output_binary(struct out_buffer *out, const struct tsp_context *ctx,
+                   enum tsp_status status);
+
+#endif
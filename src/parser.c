@@ -0,0 +1,450 @@
+// Zero-copy parser for the `City1-City2: Distance` edge list format.
+#include "parser.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// A function to find the first occurrence of c in [p, end). We compare 16 bytes
+// at a time when SSE2 is available and fall back to memchr otherwise. Returns
+// end when the byte is not found.
+static const char *find_byte(const char *p, const char *end, char c) {
+#ifdef __SSE2__
+  const __m128i needle = _mm_set1_epi8(c);
+  while (end - p >= 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)p);
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+#endif
+  const char *hit = memchr(p, c, (size_t)(end - p));
+  return hit ? hit : end;
+}
+
+// A function to parse an unsigned decimal number. We skip the blanks that
+// follow the colon, then accumulate digits while checking for overflow.
+// Returns 0 on success.
+static int parse_u64(const char *p, const char *end, uint64_t *value) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  if (p == end || *p < '0' || *p > '9') {
+    return -1; // There has to be at least one digit.
+  }
+  uint64_t v = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    uint64_t digit = (uint64_t)(*p - '0');
+    if (v > (UINT64_MAX - digit) / 10) {
+      return -1; // The distance does not fit in 64 bits.
+    }
+    v = v * 10 + digit;
+    p++;
+  }
+  *value = v;
+  return 0;
+}
+
+int parse_edge_line(const char *p, const char *end, const char **dash,
+                    const char **colon, uint64_t *distance) {
+  // City1 runs up to the first '-' and City2 up to the following ':'.
+  *dash = find_byte(p, end, '-');
+  *colon = *dash < end ? find_byte(*dash + 1, end, ':') : end;
+  if (*dash == p || *colon == end || *colon == *dash + 1) {
+    return -1;
+  }
+  return parse_u64(*colon + 1, end, distance);
+}
+
+int map_file(const char *path, struct mapped_file *file, struct arena *arena) {
+  file->data = NULL;
+  file->size = 0;
+  file->mapped = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  if (S_ISREG(st.st_mode)) {
+    if (st.st_size == 0) {
+      close(fd); // An empty file has nothing to map.
+      return 0;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+      file->data = data;
+      file->size = (size_t)st.st_size;
+      file->mapped = 1;
+      close(fd);
+      return 0;
+    }
+  }
+
+  // Pipes and other special files cannot be mapped, so we read them whole.
+  // The buffer stays on top of the arena while it grows, so it is usually
+  // extended in place.
+  size_t capacity = 1 << 16;
+  char *buffer = arena_alloc(arena, capacity, 64);
+  size_t size = 0;
+  ssize_t n = 0;
+  while (buffer && (n = read(fd, buffer + size, capacity - size)) > 0) {
+    size += (size_t)n;
+    if (size == capacity) {
+      buffer = arena_grow(arena, buffer, capacity, capacity * 2, 64);
+      capacity *= 2;
+    }
+  }
+  close(fd);
+  if (!buffer || n < 0) {
+    return -1;
+  }
+  file->data = buffer;
+  file->size = size;
+  return 0;
+}
+
+void unmap_file(struct mapped_file *file) {
+  if (file->mapped) {
+    munmap((void *)file->data, file->size);
+  }
+  file->data = NULL;
+  file->size = 0;
+  file->mapped = 0;
+}
+
+static int push_edge(struct arena *arena, struct parsed_instance *out, int from,
+                     int to, uint64_t distance) {
+  if (out->edge_count == out->edge_capacity) {
+    size_t capacity = out->edge_capacity ? out->edge_capacity * 2 : 256;
+    struct edge *grown =
+        arena_grow(arena, out->edges, out->edge_capacity * sizeof(struct edge),
+                   capacity * sizeof(struct edge), _Alignof(struct edge));
+    if (!grown) {
+      return -1;
+    }
+    out->edges = grown;
+    out->edge_capacity = capacity;
+  }
+  struct edge *e = &out->edges[out->edge_count++];
+  e->from = (uint32_t)from;
+  e->to = (uint32_t)to;
+  e->distance = distance;
+  return 0;
+}
+
+// A function to parse every line of [data, data + size) into out, which must
+// already be initialised. We count the lines as we go so that a chunk parsed
+// on its own can report its error position relative to its start.
+static int parse_lines(const char *data, size_t size, struct arena *arena,
+                       struct parsed_instance *out, size_t *line_count,
+                       size_t *error_line) {
+  const char *p = data;
+  const char *end = data + size;
+  size_t line_number = 0;
+
+  while (p < end) {
+    const char *eol = find_byte(p, end, '\n');
+    const char *line_end = eol;
+    line_number++;
+    if (line_end > p && line_end[-1] == '\r') {
+      line_end--; // Accept files with Windows line endings.
+    }
+
+    if (line_end > p) { // Blank lines are skipped.
+      const char *dash;
+      const char *colon;
+      uint64_t distance;
+      if (parse_edge_line(p, line_end, &dash, &colon, &distance) != 0) {
+        *error_line = line_number;
+        return -1;
+      }
+
+      int city1_index = city_table_intern(&out->cities, p, (size_t)(dash - p));
+      int city2_index =
+          city_table_intern(&out->cities, dash + 1, (size_t)(colon - dash - 1));
+      if (city1_index < 0 || city2_index < 0 ||
+          push_edge(arena, out, city1_index, city2_index, distance) != 0) {
+        *error_line = line_number;
+        return -1;
+      }
+    }
+
+    p = eol + 1;
+  }
+  *line_count = line_number;
+  return 0;
+}
+
+int parse_edge_list(const char *data, size_t size, struct arena *arena,
+                    struct parsed_instance *out, size_t *error_line) {
+  memset(out, 0, sizeof(*out));
+  city_table_init(&out->cities, arena);
+  size_t line_count;
+  return parse_lines(data, size, arena, out, &line_count, error_line);
+}
+
+int parse_edge_list_stream(struct stream *stream, struct arena *arena,
+                           struct parsed_instance *out, size_t *error_line) {
+  memset(out, 0, sizeof(*out));
+  city_table_init(&out->cities, arena);
+  out->cities.copy_names = 1;
+
+  // A line can straddle two blocks. We keep the unfinished tail of a block in
+  // carry and complete it with the head of the next block.
+  char *carry = NULL;
+  size_t carry_len = 0;
+  size_t carry_capacity = 0;
+  size_t lines_before = 0;
+  int status = 0;
+  int more = 1;
+
+  while (more > 0 && status == 0) {
+    const char *data = stream->data;
+    const char *end = data + stream->len;
+    const char *first_eol = find_byte(data, end, '\n');
+    const char *last_eol = first_eol;
+    if (first_eol < end) {
+      const char *p = end;
+      while (p[-1] != '\n') {
+        p--;
+      }
+      last_eol = p - 1;
+    }
+
+    size_t head =
+        first_eol < end ? (size_t)(first_eol - data) + 1 : stream->len;
+    if (head > 0 && carry_len + head > carry_capacity) {
+      carry_capacity = 2 * (carry_len + head) + 256;
+      char *grown = realloc(carry, carry_capacity);
+      if (!grown) {
+        status = -1;
+        break;
+      }
+      carry = grown;
+    }
+    if (head > 0) {
+      memcpy(carry + carry_len, data, head);
+      carry_len += head;
+    }
+
+    size_t lines = 0;
+    if (first_eol < end) {
+      // The carried line is now complete: parse it, then every whole line of
+      // the block, and carry what follows the last newline.
+      status = parse_lines(carry, carry_len, arena, out, &lines, error_line);
+      if (status != 0) {
+        *error_line += lines_before;
+        break;
+      }
+      lines_before += lines;
+      carry_len = 0;
+      status = parse_lines(first_eol + 1, (size_t)(last_eol - first_eol), arena,
+                           out, &lines, error_line);
+      if (status != 0) {
+        *error_line += lines_before;
+        break;
+      }
+      lines_before += lines;
+      size_t tail = (size_t)(end - last_eol - 1);
+      if (tail > carry_capacity) {
+        carry_capacity = 2 * tail;
+        char *grown = realloc(carry, carry_capacity);
+        if (!grown) {
+          status = -1;
+          break;
+        }
+        carry = grown;
+      }
+      memcpy(carry, last_eol + 1, tail);
+      carry_len = tail;
+    }
+    more = stream_next(stream);
+    if (more < 0) {
+      status = -1;
+      *error_line = 0; // The input itself is broken, not one of its lines.
+    }
+  }
+
+  if (status == 0 && carry_len > 0) {
+    size_t lines;
+    status = parse_lines(carry, carry_len, arena, out, &lines, error_line);
+    if (status != 0) {
+      *error_line += lines_before;
+    }
+  }
+  free(carry);
+  return status;
+}
+
+// One chunk of a parallel parse. Each thread interns names into its own table
+// and arena, so the threads never touch shared state.
+struct parse_chunk {
+  const char *data;
+  size_t size;
+  struct arena arena;
+  struct parsed_instance result;
+  size_t line_count;
+  size_t error_line;
+  int status;
+  // Filled in by the merge: local city index to global city index, and where
+  // this chunk's edges start in the merged edge array.
+  uint32_t *remap;
+  size_t edge_offset;
+  struct edge *merged_edges;
+};
+
+static void *parse_chunk_thread(void *arg) {
+  struct parse_chunk *chunk = arg;
+  arena_init(&chunk->arena, 0);
+  memset(&chunk->result, 0, sizeof(chunk->result));
+  city_table_init(&chunk->result.cities, &chunk->arena);
+  chunk->status = parse_lines(chunk->data, chunk->size, &chunk->arena,
+                              &chunk->result, &chunk->line_count,
+                              &chunk->error_line);
+  return NULL;
+}
+
+// A function to copy a chunk's edges into the merged array, translating the
+// city indices through the chunk's remap table.
+static void *remap_chunk_thread(void *arg) {
+  struct parse_chunk *chunk = arg;
+  const struct edge *edges = chunk->result.edges;
+  struct edge *out = chunk->merged_edges + chunk->edge_offset;
+  for (size_t e = 0; e < chunk->result.edge_count; e++) {
+    out[e].from = chunk->remap[edges[e].from];
+    out[e].to = chunk->remap[edges[e].to];
+    out[e].distance = edges[e].distance;
+  }
+  return NULL;
+}
+
+// A function to run fn on every chunk, one thread per chunk. The first chunk
+// runs on the calling thread.
+static void run_chunks(struct parse_chunk *chunks, int count,
+                       void *(*fn)(void *)) {
+  pthread_t threads[PARSE_MAX_THREADS];
+  int started[PARSE_MAX_THREADS] = {0};
+  for (int t = 1; t < count; t++) {
+    started[t] = pthread_create(&threads[t], NULL, fn, &chunks[t]) == 0;
+  }
+  fn(&chunks[0]);
+  for (int t = 1; t < count; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    } else {
+      fn(&chunks[t]); // We could not start a thread, so we do the work here.
+    }
+  }
+}
+
+int parse_edge_list_parallel(const char *data, size_t size, int thread_count,
+                             struct arena *arena, struct parsed_instance *out,
+                             size_t *error_line) {
+  if (thread_count > PARSE_MAX_THREADS) {
+    thread_count = PARSE_MAX_THREADS;
+  }
+  if ((size_t)thread_count > size / PARSE_MIN_CHUNK) {
+    thread_count = (int)(size / PARSE_MIN_CHUNK);
+  }
+  if (thread_count <= 1) {
+    return parse_edge_list(data, size, arena, out, error_line);
+  }
+
+  // We split the buffer into roughly equal chunks and move every split point
+  // just past the next newline, so that no line is cut in two.
+  struct parse_chunk chunks[PARSE_MAX_THREADS];
+  const char *end = data + size;
+  const char *start = data;
+  int count = 0;
+  for (int t = 0; t < thread_count && start < end; t++) {
+    const char *split = t == thread_count - 1
+                            ? end
+                            : data + size / (size_t)thread_count * (t + 1);
+    if (split < start) {
+      split = start;
+    }
+    split = find_byte(split, end, '\n');
+    split = split < end ? split + 1 : end;
+    memset(&chunks[count], 0, sizeof(chunks[count]));
+    chunks[count].data = start;
+    chunks[count].size = (size_t)(split - start);
+    count++;
+    start = split;
+  }
+
+  run_chunks(chunks, count, parse_chunk_thread);
+
+  int status = 0;
+  size_t lines_before = 0;
+  for (int t = 0; t < count; t++) {
+    if (chunks[t].status != 0) {
+      *error_line = lines_before + chunks[t].error_line;
+      status = -1; // The first failing chunk has the first bad line.
+      break;
+    }
+    lines_before += chunks[t].line_count;
+  }
+
+  // We merge the chunks in file order, interning each chunk's cities in the
+  // order that chunk first saw them. That is exactly the order a sequential
+  // parse would have seen them in, so every city gets the same index.
+  memset(out, 0, sizeof(*out));
+  city_table_init(&out->cities, arena);
+  size_t edge_count = 0;
+  for (int t = 0; t < count && status == 0; t++) {
+    const struct city_table *local = &chunks[t].result.cities;
+    chunks[t].remap = arena_alloc(&chunks[t].arena,
+                                  (size_t)local->count * sizeof(uint32_t), 64);
+    if (!chunks[t].remap && local->count > 0) {
+      status = -1;
+      break;
+    }
+    for (int i = 0; i < local->count; i++) {
+      int index = city_table_intern(&out->cities, local->names[i].ptr,
+                                    local->names[i].len);
+      if (index < 0) {
+        status = -1;
+        break;
+      }
+      chunks[t].remap[i] = (uint32_t)index;
+    }
+    chunks[t].edge_offset = edge_count;
+    edge_count += chunks[t].result.edge_count;
+  }
+
+  if (status == 0) {
+    out->edges = arena_alloc(arena, edge_count * sizeof(struct edge), 64);
+    out->edge_count = edge_count;
+    out->edge_capacity = edge_count;
+    if (!out->edges && edge_count > 0) {
+      status = -1;
+    } else {
+      for (int t = 0; t < count; t++) {
+        chunks[t].merged_edges = out->edges;
+      }
+      run_chunks(chunks, count, remap_chunk_thread);
+    }
+  }
+
+  for (int t = 0; t < count; t++) {
+    arena_free(&chunks[t].arena);
+  }
+  return status;
+}
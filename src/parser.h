@@ -0,0 +1,74 @@
+// The input parser. We map the instance file into memory and scan it in place,
+// so city names are handed out as spans into the mapped bytes instead of being
+// copied into temporary buffers line by line.
+#ifndef TSP_PARSER_H
+#define TSP_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "intern.h"
+#include "stream.h"
+
+// An input file mapped (or, for files that cannot be mapped, read) into memory.
+struct mapped_file {
+  const char *data;
+  size_t size;
+  int mapped; // 1 if data comes from mmap, 0 if it was read into the arena.
+};
+
+// A single `City1-City2: Distance` line after the names have been turned into
+// city indices.
+struct edge {
+  uint32_t from;
+  uint32_t to;
+  uint64_t distance;
+};
+
+// Everything the parser extracts from an edge list file. The city spans point
+// into the buffer that was parsed, so that buffer must outlive the instance.
+// All arrays are allocated from the arena passed to the parser and go away when
+// it is reset.
+struct parsed_instance {
+  struct city_table cities;
+  struct edge *edges;
+  size_t edge_count;
+  size_t edge_capacity;
+};
+
+// Splits the `City1-City2: Distance` line [p, end), which must not include its
+// line ending. City1 is [p, *dash) and City2 is [*dash + 1, *colon). Returns 0
+// on success and -1 if a name is empty, the colon is missing or the distance
+// is not a number that fits in 64 bits. Everything that reads edge lines goes
+// through here so that they all accept the same lines.
+int parse_edge_line(const char *p, const char *end, const char **dash,
+                    const char **colon, uint64_t *distance);
+
+// Maps path into memory. Files that cannot be mapped (pipes, for example) are
+// read into the arena instead.
+int map_file(const char *path, struct mapped_file *file, struct arena *arena);
+void unmap_file(struct mapped_file *file);
+
+// Parses a whole `City1-City2: Distance` buffer. Returns 0 on success, or -1
+// with the 1-based number of the offending line stored in error_line.
+int parse_edge_list(const char *data, size_t size, struct arena *arena,
+                    struct parsed_instance *out, size_t *error_line);
+
+// Parses an edge list as it arrives from a stream, starting with the block
+// that is already current. The blocks are recycled, so city names are copied
+// into the arena.
+int parse_edge_list_stream(struct stream *stream, struct arena *arena,
+                           struct parsed_instance *out, size_t *error_line);
+
+#define PARSE_MAX_THREADS 64
+#define PARSE_MIN_CHUNK (1 << 20) // Smaller chunks are not worth a thread.
+
+// Parses the buffer on up to thread_count threads. The buffer is split at line
+// boundaries, every thread interns its chunk's names into its own table, and
+// the tables are merged in file order, so the result (city indices, edge order
+// and error line) is identical to parse_edge_list.
+int parse_edge_list_parallel(const char *data, size_t size, int thread_count,
+                             struct arena *arena, struct parsed_instance *out,
+                             size_t *error_line);
+
+#endif
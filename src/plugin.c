@@ -0,0 +1,130 @@
+// The cost plugin backend.
+#include "plugin.h"
+
+#include <dlfcn.h>
+
+// A function to find the memo key of the pair (a, b), which has a < b if the
+// plugin is symmetric.
+static uint64_t plugin_key(const struct plugin_distance *d, int a, int b) {
+  return d->symmetric ? memo_symmetric_key(a, b)
+                      : memo_key(d->base.city_count, a, b);
+}
+
+// A function to look up the costs from i to the count cities in js. We answer
+// what we can from the memo and hand the rest to the plugin in a single call.
+static void plugin_chunk(const struct plugin_distance *d, int i,
+                         const int *js, int count, uint64_t *out) {
+  // The memo is the one part of a plugin distance that changes as we search.
+  struct memo_table *memo = (struct memo_table *)&d->memo;
+  int32_t from[PLUGIN_BATCH];
+  int32_t to[PLUGIN_BATCH];
+  int slots[PLUGIN_BATCH];
+  uint64_t costs[PLUGIN_BATCH];
+  int missing = 0;
+  for (int k = 0; k < count; k++) {
+    int a = i;
+    int b = js[k];
+    if (d->symmetric && a > b) { // Both directions share one entry.
+      a = js[k];
+      b = i;
+    }
+    if (a == b) {
+      out[k] = 0;
+    } else if (!memo_find(memo, plugin_key(d, a, b), &out[k])) {
+      from[missing] = a;
+      to[missing] = b;
+      slots[missing++] = k;
+    }
+  }
+  if (missing == 0) {
+    return;
+  }
+  if (d->plugin->cost_batch(d->state, from, to, (size_t)missing, costs) != 0) {
+    for (int m = 0; m < missing; m++) {
+      out[slots[m]] = NO_PATH;
+    }
+    return; // We do not remember failures; the plugin may recover.
+  }
+  for (int m = 0; m < missing; m++) {
+    out[slots[m]] = costs[m];
+    memo_store(memo, plugin_key(d, from[m], to[m]), costs[m]);
+  }
+}
+
+static void plugin_batch(const struct distance *base, int i, const int *js,
+                         int count, uint64_t *out) {
+  const struct plugin_distance *d = (const struct plugin_distance *)base;
+  for (int k = 0; k < count; k += PLUGIN_BATCH) {
+    int chunk = count - k < PLUGIN_BATCH ? count - k : PLUGIN_BATCH;
+    plugin_chunk(d, i, js + k, chunk, out + k);
+  }
+}
+
+static uint64_t plugin_get(const struct distance *base, int i, int j) {
+  uint64_t cost;
+  plugin_batch(base, i, &j, 1, &cost);
+  return cost;
+}
+
+static const struct distance_ops plugin_ops = {plugin_get, plugin_batch,
+                                               scan_neighbors};
+
+int plugin_distance_open(struct plugin_distance *d, const char *path,
+                         const char *args, const struct instance *instance,
+                         struct arena *arena, const char **error) {
+  int n = instance->city_count;
+  d->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!d->handle) {
+    *error = dlerror();
+    return -1;
+  }
+  const struct tsp_cost_plugin *(*entry)(void) = NULL;
+  *(void **)&entry = dlsym(d->handle, "tsp_cost_plugin");
+  d->plugin = entry ? entry() : NULL;
+  if (!d->plugin || d->plugin->version != TSP_COST_PLUGIN_VERSION ||
+      !d->plugin->open || !d->plugin->cost_batch) {
+    *error = "not a cost plugin of this version";
+    dlclose(d->handle);
+    return -1;
+  }
+  d->symmetric = d->plugin->symmetric != 0;
+
+  // The plugin keeps pointers to the names, so they live in the arena.
+  const char **names = arena_alloc(arena, n * sizeof(char *), 8);
+  size_t *lengths = arena_alloc(arena, n * sizeof(size_t), 8);
+  if (!names || !lengths) {
+    *error = NULL;
+    dlclose(d->handle);
+    return -1;
+  }
+  // The memo starts empty and grows with the pairs the search asks for.
+  uint64_t pairs = (uint64_t)n * (uint64_t)n;
+  if (memo_init(&d->memo, d->symmetric ? pairs / 2 : pairs) != 0) {
+    *error = NULL;
+    dlclose(d->handle);
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    names[i] = instance->cities[i].ptr;
+    lengths[i] = instance->cities[i].len;
+  }
+  if (d->plugin->open(&d->state, n, names, lengths, args ? args : "") != 0) {
+    *error = "the plugin failed to open";
+    memo_free(&d->memo);
+    dlclose(d->handle);
+    return -1;
+  }
+
+  d->base.ops = &plugin_ops;
+  d->base.city_count = n;
+  d->base.complete = 0; // The plugin may leave pairs unconnected.
+  return 0;
+}
+
+void plugin_distance_close(struct plugin_distance *d) {
+  if (d->plugin->close) {
+    d->plugin->close(d->state);
+  }
+  memo_free(&d->memo);
+  dlclose(d->handle);
+}
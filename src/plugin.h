@@ -0,0 +1,35 @@
+// Distances from a cost plugin (see tsp_cost_plugin.h). The plugin is loaded
+// with dlopen and asked for costs in batches; every answer goes into a
+// concurrent memo, so the engines never see the cost of a call per lookup
+// and no full matrix is built.
+#ifndef TSP_PLUGIN_H
+#define TSP_PLUGIN_H
+
+#include "arena.h"
+#include "distance.h"
+#include "instance.h"
+#include "memo.h"
+#include "tsp_cost_plugin.h"
+
+#define PLUGIN_BATCH 256 // Pairs we hand to the plugin per call at most.
+
+struct plugin_distance {
+  struct distance base;
+  void *handle; // From dlopen.
+  const struct tsp_cost_plugin *plugin;
+  void *state; // The plugin's own.
+  int symmetric;
+  struct memo_table memo;
+};
+
+// Loads the plugin at path and opens it for the cities of instance, passing
+// args on to it. Returns 0 on success, or -1 with error set to what went
+// wrong (NULL if we ran out of memory).
+int plugin_distance_open(struct plugin_distance *d, const char *path,
+                         const char *args, const struct instance *instance,
+                         struct arena *arena, const char **error);
+
+// Closes the plugin and unloads it.
+void plugin_distance_close(struct plugin_distance *d);
+
+#endif
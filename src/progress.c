@@ -0,0 +1,30 @@
+// Progress reports and cancellation for the engines.
+#include "progress.h"
+
+#include <time.h>
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int monitor_cancelled(const struct monitor *monitor) {
+  return monitor && atomic_load_explicit(monitor->cancel,
+                                         memory_order_relaxed) != 0;
+}
+
+int monitor_tick(struct monitor *monitor, const struct tsp_progress *progress,
+                 int force) {
+  if (!monitor) {
+    return 0;
+  }
+  if (monitor->fn) {
+    uint64_t now = now_ns();
+    if (force || now - monitor->last_ns >= MONITOR_INTERVAL_NS) {
+      monitor->last_ns = now;
+      monitor->fn(progress, monitor->user);
+    }
+  }
+  return monitor_cancelled(monitor);
+}
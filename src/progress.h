@@ -0,0 +1,32 @@
+// Progress reports and cancellation for the engines. An engine calls
+// monitor_tick every few thousand steps of work; that is cheap enough for the
+// innermost loops, since the clock is only read there and the callback only
+// runs when the last report is MONITOR_INTERVAL_NS old. Cancellation is a
+// flag the engines poll at the same points.
+#ifndef TSP_PROGRESS_H
+#define TSP_PROGRESS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "tsp.h"
+
+#define MONITOR_STEPS 4096              // Steps of work between two ticks.
+#define MONITOR_INTERVAL_NS 200000000ULL // At most five reports a second.
+
+struct monitor {
+  tsp_progress_fn fn; // NULL if nobody is watching.
+  void *user;
+  atomic_int *cancel; // Set by tsp_cancel.
+  uint64_t last_ns;   // When we last called fn.
+};
+
+// Returns 1 once the solve has been cancelled. monitor may be NULL.
+int monitor_cancelled(const struct monitor *monitor);
+
+// Reports progress if the last report is old enough, or always if force is
+// set, and returns monitor_cancelled.
+int monitor_tick(struct monitor *monitor, const struct tsp_progress *progress,
+                 int force);
+
+#endif
@@ -0,0 +1,94 @@
+// The 16-bit distance matrix.
+#include "quantized.h"
+
+#include <stdlib.h>
+
+static uint64_t quantized_value(const struct quantized_distance *q,
+                                uint16_t stored) {
+  return stored == QUANTIZED_NO_PATH ? NO_PATH : stored * q->scale;
+}
+
+static uint64_t quantized_get(const struct distance *d, int i, int j) {
+  const struct quantized_distance *q = (const struct quantized_distance *)d;
+  return quantized_value(q, q->entries[(size_t)i * q->stride + j]);
+}
+
+static void quantized_batch(const struct distance *d, int i, const int *js,
+                            int count, uint64_t *out) {
+  const struct quantized_distance *q = (const struct quantized_distance *)d;
+  const uint16_t *row = q->entries + (size_t)i * q->stride;
+  for (int k = 0; k < count; k++) {
+    out[k] = quantized_value(q, row[js[k]]);
+  }
+}
+
+static const struct distance_ops quantized_ops = {
+    quantized_get, quantized_batch, scan_neighbors};
+
+int quantized_distance_build(struct quantized_distance *q,
+                             const struct distance *d, struct arena *arena) {
+  int n = d->city_count;
+  size_t stride = ((size_t)n + 31) & ~(size_t)31;
+  uint16_t *entries =
+      arena_alloc(arena, (size_t)n * stride * sizeof(uint16_t), 64);
+  int *js = malloc(n * sizeof(int));
+  uint64_t *row = malloc(n * sizeof(uint64_t));
+  if (!entries || !js || !row) {
+    free(js);
+    free(row);
+    return -1;
+  }
+  for (int j = 0; j < n; j++) {
+    js[j] = j;
+  }
+
+  // The first pass finds the longest distance, which fixes the scale.
+  uint64_t longest = 0;
+  for (int i = 0; i < n; i++) {
+    distance_batch(d, i, js, n, row);
+    for (int j = 0; j < n; j++) {
+      if (row[j] != NO_PATH && row[j] > longest) {
+        longest = row[j];
+      }
+    }
+  }
+  uint64_t scale = longest / QUANTIZED_MAX + (longest % QUANTIZED_MAX != 0);
+  if (scale == 0) {
+    scale = 1;
+  }
+
+  // The second pass rounds every distance to the nearest multiple of the
+  // scale and measures how far off that leaves us.
+  uint64_t max_error = 0;
+  for (int i = 0; i < n; i++) {
+    distance_batch(d, i, js, n, row);
+    uint16_t *out = entries + (size_t)i * stride;
+    for (int j = 0; j < n; j++) {
+      if (row[j] == NO_PATH) {
+        out[j] = QUANTIZED_NO_PATH;
+        continue;
+      }
+      uint64_t steps = row[j] / scale + (row[j] % scale >= (scale + 1) / 2);
+      if (steps > QUANTIZED_MAX) {
+        steps = QUANTIZED_MAX; // Only reachable through the rounding.
+      }
+      out[j] = (uint16_t)steps;
+      uint64_t value = steps * scale;
+      uint64_t error = value > row[j] ? value - row[j] : row[j] - value;
+      if (error > max_error) {
+        max_error = error;
+      }
+    }
+  }
+  free(js);
+  free(row);
+
+  q->base.ops = &quantized_ops;
+  q->base.city_count = n;
+  q->base.complete = d->complete;
+  q->entries = entries;
+  q->stride = stride;
+  q->scale = scale;
+  q->max_error = max_error;
+  return 0;
+}
@@ -0,0 +1,35 @@
+// A compressed copy of a distance matrix: every distance is stored as a
+// 16-bit multiple of one global scale, so four entries fit where one uint64_t
+// did and a 64-byte cache line holds 32 of them instead of 8. Engines search on
+// the compressed copy, and the costs we print are looked up again in the
+// exact distances.
+#ifndef TSP_QUANTIZED_H
+#define TSP_QUANTIZED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "distance.h"
+
+#define QUANTIZED_NO_PATH UINT16_MAX // The stored value for NO_PATH.
+#define QUANTIZED_MAX (UINT16_MAX - 1)
+
+struct quantized_distance {
+  struct distance base;
+  const uint16_t *entries; // Row-major, rows padded to 32 entries.
+  size_t stride;
+  uint64_t scale; // A stored q stands for q * scale.
+  // The largest difference between an exact distance and the one we return.
+  // A route of m legs is therefore off by at most m * max_error.
+  uint64_t max_error;
+};
+
+// Builds the compressed matrix from every row of d. The scale is the smallest
+// one that fits the longest distance into QUANTIZED_MAX steps, and every
+// distance is rounded to the nearest step, so max_error is at most scale / 2.
+// Returns 0 on success and -1 if we run out of memory.
+int quantized_distance_build(struct quantized_distance *q,
+                             const struct distance *d, struct arena *arena);
+
+#endif
@@ -0,0 +1,873 @@
+// Road graphs: DIMACS parsing, contraction and the stop-to-stop oracle.
+#include "road.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// An arc of the graph being contracted.
+struct ch_arc {
+  uint32_t node;
+  uint64_t weight;
+};
+
+// A growable list of arcs. During contraction these are the arcs between the
+// nodes that are still left; once a node is contracted its lists are frozen,
+// and they are exactly its upward arcs.
+struct ch_list {
+  struct ch_arc *arcs;
+  int count;
+  int capacity;
+};
+
+// A binary min-heap with lazy deletion: instead of decreasing a key we push
+// the node again and skip the stale entry when it comes out.
+struct road_heap {
+  struct road_heap_entry *items;
+  size_t size;
+  size_t capacity; // 0 for a fixed array that must never grow.
+};
+
+struct ch_builder {
+  int node_count;
+  struct ch_list *out;
+  struct ch_list *in;
+  char *contracted;
+  char *stale; // 1 if a neighbour was contracted since we ranked the node.
+  char *target; // The nodes the current witness search is looking for.
+  int *deleted_neighbors;
+  // The witness search scratch space.
+  uint64_t *dist;
+  uint32_t *touched;
+  int touched_count;
+  struct road_heap heap;
+};
+
+static int heap_push(struct road_heap *h, uint64_t key, uint32_t node) {
+  if (h->capacity > 0 && h->size == h->capacity) {
+    size_t capacity = 2 * h->capacity;
+    struct road_heap_entry *items =
+        realloc(h->items, capacity * sizeof(*items));
+    if (!items) {
+      return -1;
+    }
+    h->items = items;
+    h->capacity = capacity;
+  }
+  size_t pos = h->size++;
+  while (pos > 0 && h->items[(pos - 1) / 2].key > key) {
+    h->items[pos] = h->items[(pos - 1) / 2];
+    pos = (pos - 1) / 2;
+  }
+  h->items[pos] = (struct road_heap_entry){key, node};
+  return 0;
+}
+
+static struct road_heap_entry heap_pop(struct road_heap *h) {
+  struct road_heap_entry top = h->items[0];
+  struct road_heap_entry last = h->items[--h->size];
+  size_t pos = 0;
+  while (2 * pos + 1 < h->size) {
+    size_t child = 2 * pos + 1;
+    if (child + 1 < h->size && h->items[child + 1].key < h->items[child].key) {
+      child++;
+    }
+    if (last.key <= h->items[child].key) {
+      break;
+    }
+    h->items[pos] = h->items[child];
+    pos = child;
+  }
+  if (h->size > 0) {
+    h->items[pos] = last;
+  }
+  return top;
+}
+
+static struct ch_arc *list_find(struct ch_list *list, uint32_t node) {
+  for (int k = 0; k < list->count; k++) {
+    if (list->arcs[k].node == node) {
+      return &list->arcs[k];
+    }
+  }
+  return NULL;
+}
+
+static int list_append(struct ch_list *list, uint32_t node, uint64_t weight) {
+  if (list->count == list->capacity) {
+    int capacity = list->capacity ? 2 * list->capacity : 4;
+    struct ch_arc *arcs = realloc(list->arcs, capacity * sizeof(*arcs));
+    if (!arcs) {
+      return -1;
+    }
+    list->arcs = arcs;
+    list->capacity = capacity;
+  }
+  list->arcs[list->count++] = (struct ch_arc){node, weight};
+  return 0;
+}
+
+static void list_remove(struct ch_list *list, uint32_t node) {
+  for (int k = 0; k < list->count; k++) {
+    if (list->arcs[k].node == node) {
+      list->arcs[k] = list->arcs[--list->count];
+      return;
+    }
+  }
+}
+
+// A function to add the arc from -> to, or to shorten it if it is already
+// there with a larger weight.
+static int add_arc(struct ch_builder *b, uint32_t from, uint32_t to,
+                   uint64_t weight) {
+  struct ch_arc *arc = list_find(&b->out[from], to);
+  if (arc) {
+    if (weight < arc->weight) {
+      arc->weight = weight;
+      list_find(&b->in[to], from)->weight = weight;
+    }
+    return 0;
+  }
+  if (list_append(&b->out[from], to, weight) != 0 ||
+      list_append(&b->in[to], from, weight) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static uint64_t add_weights(uint64_t a, uint64_t b) {
+  return b >= NO_PATH - a ? NO_PATH : a + b;
+}
+
+// A function to run a Dijkstra search from source that avoids skip. It stops
+// once the targets are settled or past limit, and gives up after settle_limit
+// nodes. If it finds a path to a target that is no longer than the shortcut
+// through skip would be, that path is a witness and the shortcut is not
+// needed. Giving up early only costs us an unnecessary shortcut, never a
+// wrong distance.
+static int witness_search(struct ch_builder *b, uint32_t source, uint32_t skip,
+                          int targets, uint64_t limit, int settle_limit) {
+  for (int k = 0; k < b->touched_count; k++) {
+    b->dist[b->touched[k]] = NO_PATH;
+  }
+  b->touched_count = 0;
+  b->heap.size = 0;
+  b->dist[source] = 0;
+  b->touched[b->touched_count++] = source;
+  if (heap_push(&b->heap, 0, source) != 0) {
+    return -1;
+  }
+  int settled = 0;
+  while (b->heap.size > 0) {
+    struct road_heap_entry e = heap_pop(&b->heap);
+    if (e.key > b->dist[e.node]) {
+      continue; // A stale entry.
+    }
+    if (e.key > limit || ++settled > settle_limit) {
+      break;
+    }
+    if (b->target[e.node] && --targets == 0) {
+      break;
+    }
+    const struct ch_list *out = &b->out[e.node];
+    for (int k = 0; k < out->count; k++) {
+      uint32_t next = out->arcs[k].node;
+      uint64_t d = add_weights(e.key, out->arcs[k].weight);
+      if (next == skip || d >= b->dist[next]) {
+        continue;
+      }
+      if (b->dist[next] == NO_PATH) {
+        b->touched[b->touched_count++] = next;
+      }
+      b->dist[next] = d;
+      if (heap_push(&b->heap, d, next) != 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+// A function to find the shortcuts that contracting v needs: for every pair
+// of arcs u -> v -> w without a witness, u -> w. With apply set we add them,
+// otherwise we only count them, with cheaper witness searches: a miscount
+// only makes the ranking a little worse. Returns the count, or -1 if we run
+// out of memory.
+static int contract_node(struct ch_builder *b, uint32_t v, int apply) {
+  const struct ch_list *in = &b->in[v];
+  const struct ch_list *out = &b->out[v];
+  int shortcuts = 0;
+  for (int i = 0; i < in->count; i++) {
+    uint32_t u = in->arcs[i].node;
+    uint64_t limit = 0;
+    int targets = 0;
+    for (int o = 0; o < out->count; o++) {
+      uint64_t via = add_weights(in->arcs[i].weight, out->arcs[o].weight);
+      if (out->arcs[o].node != u) {
+        limit = via > limit ? via : limit;
+        targets++;
+      }
+    }
+    if (targets == 0) {
+      continue; // The only way on leads straight back to u.
+    }
+    for (int o = 0; o < out->count; o++) {
+      b->target[out->arcs[o].node] = out->arcs[o].node != u;
+    }
+    int status =
+        witness_search(b, u, v, targets, limit,
+                       apply ? ROAD_WITNESS_LIMIT : ROAD_ESTIMATE_LIMIT);
+    for (int o = 0; o < out->count; o++) {
+      b->target[out->arcs[o].node] = 0;
+    }
+    if (status != 0) {
+      return -1;
+    }
+    for (int o = 0; o < out->count; o++) {
+      uint32_t w = out->arcs[o].node;
+      uint64_t via = add_weights(in->arcs[i].weight, out->arcs[o].weight);
+      if (w == u || b->dist[w] <= via) {
+        continue;
+      }
+      shortcuts++;
+      if (apply && add_arc(b, u, w, via) != 0) {
+        return -1;
+      }
+    }
+  }
+  return shortcuts;
+}
+
+// A function to rank a node for contraction: twice the edge difference
+// (shortcuts added minus arcs removed), plus the number of neighbours already
+// contracted so that the contraction spreads evenly over the graph. Lower
+// goes first.
+static int node_priority(struct ch_builder *b, uint32_t v, uint64_t *key) {
+  int shortcuts = contract_node(b, v, 0);
+  if (shortcuts < 0) {
+    return -1;
+  }
+  int64_t difference =
+      (int64_t)shortcuts - b->in[v].count - b->out[v].count;
+  int64_t priority = 2 * difference + b->deleted_neighbors[v];
+  *key = (uint64_t)(priority + INT32_MAX);
+  return 0;
+}
+
+// A function to contract every node, cheapest first. Priorities go stale as
+// the graph changes, so when a node whose neighbourhood changed reaches the
+// top of the queue we rank it again, and put it back if it is no longer the
+// cheapest.
+static int contract_all(struct ch_builder *b) {
+  size_t node_count = (size_t)(uint32_t)b->node_count;
+  struct road_heap queue = {malloc(node_count * sizeof(*queue.items)), 0,
+                            node_count};
+  if (!queue.items) {
+    return -1;
+  }
+  int status = 0;
+  for (int v = 0; v < b->node_count && status == 0; v++) {
+    uint64_t key;
+    status = node_priority(b, v, &key);
+    if (status == 0) {
+      status = heap_push(&queue, key, v);
+    }
+  }
+  while (queue.size > 0 && status == 0) {
+    struct road_heap_entry e = heap_pop(&queue);
+    uint32_t v = e.node;
+    if (b->stale[v]) {
+      uint64_t key;
+      b->stale[v] = 0;
+      if (node_priority(b, v, &key) != 0) {
+        status = -1;
+        break;
+      }
+      if (queue.size > 0 && key > queue.items[0].key) {
+        status = heap_push(&queue, key, v);
+        continue;
+      }
+    }
+    if (contract_node(b, v, 1) < 0) {
+      status = -1;
+      break;
+    }
+    // v's own lists now hold its upward arcs; we only unhook it from the
+    // nodes that are left.
+    b->contracted[v] = 1;
+    for (int k = 0; k < b->out[v].count; k++) {
+      uint32_t w = b->out[v].arcs[k].node;
+      list_remove(&b->in[w], v);
+      b->deleted_neighbors[w]++;
+      b->stale[w] = 1;
+    }
+    for (int k = 0; k < b->in[v].count; k++) {
+      uint32_t u = b->in[v].arcs[k].node;
+      list_remove(&b->out[u], v);
+      b->deleted_neighbors[u]++;
+      b->stale[u] = 1;
+    }
+  }
+  free(queue.items);
+  return status;
+}
+
+// A function to copy frozen lists into arena CSR arrays.
+static int lists_to_csr(const struct ch_list *lists, int node_count,
+                        struct arena *arena, const uint64_t **offsets_out,
+                        const uint32_t **nodes_out,
+                        const uint64_t **weights_out) {
+  size_t total = 0;
+  for (int v = 0; v < node_count; v++) {
+    total += (size_t)lists[v].count;
+  }
+  uint64_t *offsets =
+      arena_alloc(arena, ((size_t)node_count + 1) * sizeof(uint64_t), 64);
+  uint32_t *nodes = arena_alloc(arena, total * sizeof(uint32_t), 64);
+  uint64_t *weights = arena_alloc(arena, total * sizeof(uint64_t), 64);
+  if (!offsets || ((!nodes || !weights) && total > 0)) {
+    return -1;
+  }
+  size_t at = 0;
+  for (int v = 0; v < node_count; v++) {
+    offsets[v] = at;
+    for (int k = 0; k < lists[v].count; k++) {
+      nodes[at] = lists[v].arcs[k].node;
+      weights[at] = lists[v].arcs[k].weight;
+      at++;
+    }
+  }
+  offsets[node_count] = at;
+  *offsets_out = offsets;
+  *nodes_out = nodes;
+  *weights_out = weights;
+  return 0;
+}
+
+static const char *skip_blanks(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  return p;
+}
+
+// A function to read an unsigned number. Returns the position after it, or
+// NULL if there is none or it does not fit in a uint64_t.
+static const char *read_u64(const char *p, const char *end, uint64_t *value) {
+  p = skip_blanks(p, end);
+  if (p == end || *p < '0' || *p > '9') {
+    return NULL;
+  }
+  uint64_t v = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    uint64_t digit = (uint64_t)(*p - '0');
+    if (v > (UINT64_MAX - digit) / 10) {
+      return NULL;
+    }
+    v = v * 10 + digit;
+    p++;
+  }
+  *value = v;
+  return p;
+}
+
+// A function to find the end of the line at p, without the "\r" of a CRLF.
+static const char *line_end(const char *p, const char *end,
+                            const char **next) {
+  const char *eol = memchr(p, '\n', (size_t)(end - p));
+  *next = eol ? eol + 1 : end;
+  eol = eol ? eol : end;
+  if (eol > p && eol[-1] == '\r') {
+    eol--;
+  }
+  return eol;
+}
+
+static void builder_free(struct ch_builder *b) {
+  for (int v = 0; v < b->node_count && b->out && b->in; v++) {
+    free(b->out[v].arcs);
+    free(b->in[v].arcs);
+  }
+  free(b->out);
+  free(b->in);
+  free(b->contracted);
+  free(b->stale);
+  free(b->target);
+  free(b->deleted_neighbors);
+  free(b->dist);
+  free(b->touched);
+  free(b->heap.items);
+}
+
+// A function to read the DIMACS lines into the builder.
+static int read_dimacs(struct ch_builder *b, const char *data, size_t size,
+                       size_t *error_line) {
+  const char *p = data;
+  const char *end = data + size;
+  size_t line = 0;
+  while (p < end) {
+    const char *next;
+    const char *eol = line_end(p, end, &next);
+    line++;
+    const char *q = skip_blanks(p, eol);
+    if (q == eol || *q == 'c') {
+      // A blank line or a comment.
+    } else if (*q == 'p' && b->node_count == 0) {
+      uint64_t nodes;
+      uint64_t arcs;
+      q = skip_blanks(q + 1, eol);
+      if (eol - q < 2 || memcmp(q, "sp", 2) != 0 ||
+          !(q = read_u64(q + 2, eol, &nodes)) ||
+          !(q = read_u64(q, eol, &arcs)) || skip_blanks(q, eol) != eol ||
+          nodes == 0 || nodes > INT32_MAX) {
+        *error_line = line;
+        return -1;
+      }
+      b->node_count = (int)nodes;
+      b->out = calloc(nodes, sizeof(*b->out));
+      b->in = calloc(nodes, sizeof(*b->in));
+      if (!b->out || !b->in) {
+        *error_line = 0;
+        return -1;
+      }
+    } else if (*q == 'a' && b->node_count > 0) {
+      uint64_t from;
+      uint64_t to;
+      uint64_t weight;
+      if (!(q = read_u64(q + 1, eol, &from)) ||
+          !(q = read_u64(q, eol, &to)) ||
+          !(q = read_u64(q, eol, &weight)) || skip_blanks(q, eol) != eol ||
+          from == 0 || to == 0 ||
+          from > (uint64_t)b->node_count || to > (uint64_t)b->node_count ||
+          weight == NO_PATH) {
+        *error_line = line;
+        return -1;
+      }
+      if (from != to && add_arc(b, (uint32_t)(from - 1), (uint32_t)(to - 1),
+                                weight) != 0) {
+        *error_line = 0;
+        return -1;
+      }
+    } else {
+      *error_line = line;
+      return -1;
+    }
+    p = next;
+  }
+  if (b->node_count == 0) {
+    *error_line = line > 0 ? line : 1; // There was no "p" line.
+    return -1;
+  }
+  return 0;
+}
+
+int road_graph_build(struct road_graph *graph, const char *data, size_t size,
+                     struct arena *arena, size_t *error_line) {
+  struct ch_builder b;
+  memset(&b, 0, sizeof(b));
+  *error_line = 0;
+  if (read_dimacs(&b, data, size, error_line) != 0) {
+    builder_free(&b);
+    return -1;
+  }
+
+  // Road graphs usually list every street in both directions; if this one
+  // does, with the same weights, stop-to-stop distances are symmetric too.
+  int symmetric = 1;
+  for (int u = 0; u < b.node_count && symmetric; u++) {
+    for (int k = 0; k < b.out[u].count && symmetric; k++) {
+      struct ch_arc *twin = list_find(&b.out[b.out[u].arcs[k].node], u);
+      symmetric = twin && twin->weight == b.out[u].arcs[k].weight;
+    }
+  }
+
+  int n = b.node_count;
+  size_t node_count = (size_t)(uint32_t)n;
+  b.contracted = calloc(node_count, 1);
+  b.stale = calloc(node_count, 1);
+  b.target = calloc(node_count, 1);
+  b.deleted_neighbors = calloc(node_count, sizeof(int));
+  b.dist = malloc(node_count * sizeof(uint64_t));
+  b.touched = malloc(node_count * sizeof(uint32_t));
+  b.heap.capacity = 64;
+  b.heap.items = malloc(b.heap.capacity * sizeof(*b.heap.items));
+  int status = -1;
+  if (b.contracted && b.stale && b.target && b.deleted_neighbors && b.dist &&
+      b.touched &&
+      b.heap.items) {
+    for (int v = 0; v < n; v++) {
+      b.dist[v] = NO_PATH;
+    }
+    status = contract_all(&b);
+  }
+  if (status == 0) {
+    graph->node_count = n;
+    graph->symmetric = symmetric;
+    status = lists_to_csr(b.out, n, arena, &graph->up_offsets,
+                          &graph->up_heads, &graph->up_weights);
+  }
+  if (status == 0) {
+    status = lists_to_csr(b.in, n, arena, &graph->down_offsets,
+                          &graph->down_tails, &graph->down_weights);
+  }
+  builder_free(&b);
+  return status;
+}
+
+int road_stops_parse(const char *data, size_t size, int node_count,
+                     struct arena *arena, struct city_table *cities,
+                     uint32_t **stops, size_t *error_line) {
+  city_table_init(cities, arena);
+  uint32_t *nodes = NULL;
+  size_t capacity = 0;
+  const char *p = data;
+  const char *end = data + size;
+  size_t line = 0;
+  *error_line = 0;
+  while (p < end) {
+    const char *next;
+    const char *eol = line_end(p, end, &next);
+    line++;
+    if (skip_blanks(p, eol) == eol) {
+      p = next;
+      continue;
+    }
+    const char *colon = memchr(p, ':', (size_t)(eol - p));
+    uint64_t node;
+    const char *q = colon ? read_u64(colon + 1, eol, &node) : NULL;
+    if (!q || colon == p || skip_blanks(q, eol) != eol || node == 0 ||
+        node > (uint64_t)node_count) {
+      *error_line = line;
+      return -1;
+    }
+    int count = cities->count;
+    int index = city_table_intern(cities, p, (size_t)(colon - p));
+    if (index < 0) {
+      return -1;
+    }
+    if (index < count) {
+      *error_line = line; // The same stop twice.
+      return -1;
+    }
+    if ((size_t)cities->count > capacity) {
+      size_t grown = capacity ? 2 * capacity : 64;
+      nodes = arena_grow(arena, nodes, capacity * sizeof(uint32_t),
+                         grown * sizeof(uint32_t), 64);
+      capacity = grown;
+      if (!nodes) {
+        return -1;
+      }
+    }
+    nodes[index] = (uint32_t)(node - 1);
+    p = next;
+  }
+  *stops = nodes;
+  return 0;
+}
+
+// The scratch space of the oracle searches. Every thread has one of its own,
+// kept across instances, so loading an instance costs nothing and a search
+// only pays for the nodes it reaches. Between searches every entry of
+// node_distances is NO_PATH.
+struct road_search {
+  uint64_t *node_distances;
+  size_t node_capacity;
+  uint32_t *touched;
+  size_t touched_capacity;
+  struct road_heap heap;
+};
+
+static pthread_key_t search_key;
+static pthread_once_t search_once = PTHREAD_ONCE_INIT;
+
+static void search_free(void *p) {
+  struct road_search *search = p;
+  free(search->node_distances);
+  free(search->touched);
+  free(search->heap.items);
+  free(search);
+}
+
+static void search_key_create(void) {
+  pthread_key_create(&search_key, search_free);
+}
+
+// A function to return the calling thread's scratch space with room for
+// node_count nodes, or NULL if we run out of memory.
+static struct road_search *thread_search(size_t node_count) {
+  pthread_once(&search_once, search_key_create);
+  struct road_search *search = pthread_getspecific(search_key);
+  if (!search) {
+    search = calloc(1, sizeof(*search));
+    if (!search) {
+      return NULL;
+    }
+    if (pthread_setspecific(search_key, search) != 0) {
+      free(search);
+      return NULL;
+    }
+  }
+  if (search->node_capacity < node_count) {
+    uint64_t *grown =
+        realloc(search->node_distances, node_count * sizeof(uint64_t));
+    if (!grown) {
+      return NULL;
+    }
+    for (size_t v = search->node_capacity; v < node_count; v++) {
+      grown[v] = NO_PATH;
+    }
+    search->node_distances = grown;
+    search->node_capacity = node_count;
+  }
+  return search;
+}
+
+// A function to remember that a search reached node. Returns 0 on success.
+static int search_touch(struct road_search *search, size_t *count,
+                        uint32_t node) {
+  if (*count == search->touched_capacity) {
+    size_t capacity = *count ? 2 * *count : 1024;
+    uint32_t *grown = realloc(search->touched, capacity * sizeof(uint32_t));
+    if (!grown) {
+      return -1;
+    }
+    search->touched = grown;
+    search->touched_capacity = capacity;
+  }
+  search->touched[(*count)++] = node;
+  return 0;
+}
+
+// A function to search upwards from node through one half of the hierarchy
+// and call visit for every node it settles with that node's distance. There is
+// no target to stop at: the upward search space is small, and we need all of
+// it. Returns 0 on success and -1 if we run out of memory.
+static int upward_search(struct road_oracle *o, uint32_t node,
+                         const uint64_t *offsets, const uint32_t *heads,
+                         const uint64_t *weights,
+                         void (*visit)(struct road_oracle *, uint32_t,
+                                       uint64_t, void *),
+                         void *context) {
+  struct road_search *search = thread_search((size_t)o->graph->node_count);
+  if (!search) {
+    return -1;
+  }
+  if (!search->heap.items) {
+    search->heap.items = malloc(64 * sizeof(*search->heap.items));
+    if (!search->heap.items) {
+      return -1;
+    }
+    search->heap.capacity = 64;
+  }
+  uint64_t *node_distances = search->node_distances;
+  struct road_heap *heap = &search->heap;
+  heap->size = 0;
+  size_t touched_count = 0;
+  int status = search_touch(search, &touched_count, node);
+  if (status == 0) {
+    node_distances[node] = 0;
+    status = heap_push(heap, 0, node);
+  }
+  while (status == 0 && heap->size > 0) {
+    struct road_heap_entry e = heap_pop(heap);
+    if (e.key > node_distances[e.node]) {
+      continue;
+    }
+    visit(o, e.node, e.key, context);
+    for (uint64_t a = offsets[e.node];
+         status == 0 && a < offsets[e.node + 1]; a++) {
+      uint32_t next = heads[a];
+      uint64_t d = add_weights(e.key, weights[a]);
+      if (d >= node_distances[next]) {
+        continue;
+      }
+      if (node_distances[next] == NO_PATH &&
+          search_touch(search, &touched_count, next) != 0) {
+        status = -1;
+        break;
+      }
+      node_distances[next] = d;
+      status = heap_push(heap, d, next);
+    }
+  }
+  for (size_t k = 0; k < touched_count; k++) {
+    node_distances[search->touched[k]] = NO_PATH;
+  }
+  return status;
+}
+
+// The bucket entries while we collect them, before they are sorted by node.
+struct bucket_fill {
+  uint32_t stop;
+  uint32_t *nodes;
+  uint32_t *stops;
+  uint64_t *distances;
+  size_t count;
+  size_t capacity;
+  int failed;
+};
+
+static void collect_bucket(struct road_oracle *o, uint32_t node,
+                           uint64_t distance, void *context) {
+  (void)o;
+  struct bucket_fill *fill = context;
+  if (fill->count == fill->capacity) {
+    size_t capacity = fill->capacity ? 2 * fill->capacity : 1024;
+    uint32_t *nodes = realloc(fill->nodes, capacity * sizeof(uint32_t));
+    if (nodes) {
+      fill->nodes = nodes;
+    }
+    uint32_t *stops = realloc(fill->stops, capacity * sizeof(uint32_t));
+    if (stops) {
+      fill->stops = stops;
+    }
+    uint64_t *distances =
+        realloc(fill->distances, capacity * sizeof(uint64_t));
+    if (distances) {
+      fill->distances = distances;
+    }
+    if (!nodes || !stops || !distances) {
+      fill->failed = 1;
+      return;
+    }
+    fill->capacity = capacity;
+  }
+  fill->nodes[fill->count] = node;
+  fill->stops[fill->count] = fill->stop;
+  fill->distances[fill->count] = distance;
+  fill->count++;
+}
+
+// A function to run the backward search of every stop once and file what it
+// reaches into per-node buckets. A row then takes one forward search: every
+// node it settles is a meeting point with each stop in that node's bucket.
+static int build_buckets(struct road_oracle *o) {
+  const struct road_graph *g = o->graph;
+  struct bucket_fill fill;
+  memset(&fill, 0, sizeof(fill));
+  for (int t = 0; t < o->stop_count && !fill.failed; t++) {
+    fill.stop = (uint32_t)t;
+    if (upward_search(o, o->stops[t], g->down_offsets, g->down_tails,
+                      g->down_weights, collect_bucket, &fill) != 0) {
+      fill.failed = 1;
+    }
+  }
+  int status = fill.failed ? -1 : 0;
+  size_t n = (size_t)g->node_count;
+  o->bucket_offsets = status == 0
+                          ? arena_calloc(o->arena, (n + 1) * sizeof(uint64_t),
+                                         64)
+                          : NULL;
+  o->bucket_stops = arena_alloc(o->arena, fill.count * sizeof(uint32_t), 64);
+  o->bucket_distances =
+      arena_alloc(o->arena, fill.count * sizeof(uint64_t), 64);
+  if (!o->bucket_offsets ||
+      ((!o->bucket_stops || !o->bucket_distances) && fill.count > 0)) {
+    status = -1;
+  }
+  if (status == 0) {
+    // A counting sort by node, as for the CSR graphs.
+    for (size_t e = 0; e < fill.count; e++) {
+      o->bucket_offsets[fill.nodes[e] + 1]++;
+    }
+    for (size_t v = 0; v < n; v++) {
+      o->bucket_offsets[v + 1] += o->bucket_offsets[v];
+    }
+    for (size_t e = 0; e < fill.count; e++) {
+      uint64_t at = o->bucket_offsets[fill.nodes[e]]++;
+      o->bucket_stops[at] = fill.stops[e];
+      o->bucket_distances[at] = fill.distances[e];
+    }
+    for (size_t v = n; v > 0; v--) {
+      o->bucket_offsets[v] = o->bucket_offsets[v - 1];
+    }
+    o->bucket_offsets[0] = 0;
+    o->buckets_ready = 1;
+  }
+  free(fill.nodes);
+  free(fill.stops);
+  free(fill.distances);
+  return status;
+}
+
+static void scan_bucket(struct road_oracle *o, uint32_t node,
+                        uint64_t distance, void *context) {
+  uint64_t *row = context;
+  for (uint64_t e = o->bucket_offsets[node]; e < o->bucket_offsets[node + 1];
+       e++) {
+    uint64_t d = add_weights(distance, o->bucket_distances[e]);
+    if (d < row[o->bucket_stops[e]]) {
+      row[o->bucket_stops[e]] = d;
+    }
+  }
+}
+
+// A function to return row i of the stop-to-stop distances, computing it
+// with a single forward search the first time it is asked for.
+static const uint64_t *oracle_row(struct road_oracle *o, int i) {
+  if (o->rows[i]) {
+    return o->rows[i];
+  }
+  if (!o->buckets_ready && build_buckets(o) != 0) {
+    return NULL;
+  }
+  uint64_t *row =
+      arena_alloc(o->arena, (size_t)o->stop_count * sizeof(uint64_t), 64);
+  o->rows[i] = row;
+  if (!row) {
+    row = o->scratch_row; // We can still answer, we just cannot keep it.
+  }
+  for (int j = 0; j < o->stop_count; j++) {
+    row[j] = NO_PATH;
+  }
+  const struct road_graph *g = o->graph;
+  if (upward_search(o, o->stops[i], g->up_offsets, g->up_heads, g->up_weights,
+                    scan_bucket, row) != 0) {
+    o->rows[i] = NULL;
+    return NULL;
+  }
+  return row;
+}
+
+int road_oracle_init(struct road_oracle *oracle, const struct road_graph *graph,
+                     const uint32_t *stops, int stop_count,
+                     struct arena *arena) {
+  memset(oracle, 0, sizeof(*oracle));
+  oracle->graph = graph;
+  oracle->arena = arena;
+  oracle->stops = stops;
+  oracle->stop_count = stop_count;
+  oracle->rows = arena_calloc(arena, (size_t)stop_count * sizeof(uint64_t *),
+                              64);
+  oracle->scratch_row =
+      arena_alloc(arena, (size_t)stop_count * sizeof(uint64_t), 64);
+  if ((!oracle->rows || !oracle->scratch_row) && stop_count > 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static uint64_t road_get(const struct distance *d, int i, int j) {
+  struct road_oracle *oracle = ((const struct road_distance *)d)->oracle;
+  const uint64_t *row = oracle_row(oracle, i);
+  return row ? row[j] : NO_PATH;
+}
+
+static void road_batch(const struct distance *d, int i, const int *js,
+                       int count, uint64_t *out) {
+  struct road_oracle *oracle = ((const struct road_distance *)d)->oracle;
+  const uint64_t *row = oracle_row(oracle, i);
+  for (int k = 0; k < count; k++) {
+    out[k] = row ? row[js[k]] : NO_PATH;
+  }
+}
+
+static const struct distance_ops road_ops = {road_get, road_batch,
+                                             scan_neighbors};
+
+void road_distance_init(struct road_distance *d, struct road_oracle *oracle) {
+  d->base.ops = &road_ops;
+  d->base.city_count = oracle->stop_count;
+  d->base.complete = 0;
+  d->oracle = oracle;
+}
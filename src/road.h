@@ -0,0 +1,89 @@
+// Distances on a road network. We load a road graph in the DIMACS shortest
+// path format ("p sp <nodes> <arcs>", then one "a <from> <to> <weight>" line
+// per arc, nodes numbered from 1), contract it into a contraction hierarchy
+// once, and then answer queries between the stops of an instance on demand.
+//
+// A contraction hierarchy ranks the nodes and adds shortcut arcs, so that
+// every shortest path goes up the ranking and then down again. A query then
+// only searches upwards from both ends, which touches a few hundred nodes
+// instead of the whole network.
+#ifndef TSP_ROAD_H
+#define TSP_ROAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "distance.h"
+#include "intern.h"
+
+#define ROAD_WITNESS_LIMIT 500 // Nodes a witness search may settle.
+#define ROAD_ESTIMATE_LIMIT 50 // The same while we only rank the nodes.
+
+// The hierarchy. Upward arcs from u, towards higher ranked nodes, are
+// up_heads[up_offsets[u] .. up_offsets[u + 1]); the arcs into v from higher
+// ranked nodes are down_tails[down_offsets[v] .. down_offsets[v + 1]). A
+// forward search follows the first, a backward search the second.
+struct road_graph {
+  int node_count;
+  int symmetric; // 1 if every arc has a twin in the other direction.
+  const uint64_t *up_offsets;
+  const uint32_t *up_heads;
+  const uint64_t *up_weights;
+  const uint64_t *down_offsets;
+  const uint32_t *down_tails;
+  const uint64_t *down_weights;
+};
+
+// A heap entry of the searches.
+struct road_heap_entry {
+  uint64_t key;
+  uint32_t node;
+};
+
+// The stops of an instance and the distances between them we have computed so
+// far. Rows are computed when an engine first asks for one and kept for later.
+// It is not thread-safe: the lookups fill in the rows and the buckets.
+struct road_oracle {
+  const struct road_graph *graph;
+  struct arena *arena;
+  int stop_count;
+  const uint32_t *stops; // The road node of every stop.
+  // For every node, the stops whose backward search reached it and how far
+  // that node is from them. Built with the first row.
+  int buckets_ready;
+  uint64_t *bucket_offsets;
+  uint32_t *bucket_stops;
+  uint64_t *bucket_distances;
+  uint64_t **rows; // rows[i] is NULL until row i has been computed.
+  uint64_t *scratch_row; // Used when there is no memory left for a new row.
+};
+
+// Distances between the stops of an oracle.
+struct road_distance {
+  struct distance base;
+  struct road_oracle *oracle;
+};
+
+// Parses a DIMACS graph and contracts it. Parallel arcs keep the shortest
+// one. Returns 0 on success, or -1 with error_line set to the bad line (0 if
+// we ran out of memory).
+int road_graph_build(struct road_graph *graph, const char *data, size_t size,
+                     struct arena *arena, size_t *error_line);
+
+// Parses a stop list: one `Name: node` line per stop. The names are interned
+// into cities and the nodes stored in *stops. Returns 0 on success, or -1
+// with error_line set (0 if we ran out of memory).
+int road_stops_parse(const char *data, size_t size, int node_count,
+                     struct arena *arena, struct city_table *cities,
+                     uint32_t **stops, size_t *error_line);
+
+// Sets up the memo for stop_count stops. Returns 0 on success and -1 if we
+// run out of memory.
+int road_oracle_init(struct road_oracle *oracle, const struct road_graph *graph,
+                     const uint32_t *stops, int stop_count,
+                     struct arena *arena);
+
+void road_distance_init(struct road_distance *d, struct road_oracle *oracle);
+
+#endif
@@ -0,0 +1,282 @@
+// The solver daemon: the socket, the worker pool and the framing.
+#include "serve.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "output.h"
+
+// The statistics every worker adds to, guarded by lock.
+struct serve_stats {
+  pthread_mutex_t lock;
+  uint64_t requests;
+  uint64_t errors;
+  uint64_t latencies[SERVE_LATENCY_SAMPLES]; // A ring, in nanoseconds.
+};
+
+struct serve_worker {
+  int listener;
+  struct serve_stats *stats;
+  struct tsp_context *ctx;
+  char *request; // Aligned, so binary instances are used in place.
+  size_t request_capacity;
+  struct out_buffer response;
+  uint64_t sorted[SERVE_LATENCY_SAMPLES]; // Room to sort the latencies.
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// A function to read exactly len bytes. Returns 0 on success and -1 if the
+// connection closed or failed first.
+static int read_all(int fd, void *buffer, size_t len) {
+  char *p = buffer;
+  while (len > 0) {
+    ssize_t got = read(fd, p, len);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return -1;
+    }
+    p += got;
+    len -= (size_t)got;
+  }
+  return 0;
+}
+
+static int write_all(int fd, const void *buffer, size_t len) {
+  const char *p = buffer;
+  while (len > 0) {
+    ssize_t sent = send(fd, p, len, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      return -1;
+    }
+    p += sent;
+    len -= (size_t)sent;
+  }
+  return 0;
+}
+
+// A function to solve the instance in the request and build the response.
+// Returns the status we answer with.
+static enum tsp_status solve_request(struct serve_worker *worker,
+                                     size_t size) {
+  struct tsp_context *ctx = worker->ctx;
+  enum tsp_status status = tsp_load_buffer(ctx, worker->request, size);
+  if (status == TSP_OK) {
+    status = tsp_solve(ctx);
+  }
+  worker->response.len = 0;
+  output_binary(&worker->response, ctx, status);
+  return status;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// A function to build the statistics response.
+static void stats_request(struct serve_worker *worker) {
+  uint64_t *sorted = worker->sorted;
+  struct serve_stats *stats = worker->stats;
+  pthread_mutex_lock(&stats->lock);
+  uint64_t requests = stats->requests;
+  uint64_t errors = stats->errors;
+  size_t count = requests < SERVE_LATENCY_SAMPLES ? (size_t)requests
+                                                  : SERVE_LATENCY_SAMPLES;
+  memcpy(sorted, stats->latencies, count * sizeof(uint64_t));
+  pthread_mutex_unlock(&stats->lock);
+  qsort(sorted, count, sizeof(uint64_t), compare_u64);
+
+  char text[512];
+  int len = snprintf(text, sizeof(text), "requests %llu\nerrors %llu\n",
+                     (unsigned long long)requests,
+                     (unsigned long long)errors);
+  static const struct {
+    const char *name;
+    int permille;
+  } percentiles[] = {{"p50", 500}, {"p90", 900}, {"p99", 990},
+                     {"p999", 999}, {"max", 1000}};
+  for (size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++) {
+    uint64_t value = 0;
+    if (count > 0) {
+      size_t rank = (count * percentiles[p].permille + 999) / 1000;
+      value = sorted[rank > 0 ? rank - 1 : 0];
+    }
+    len += snprintf(text + len, sizeof(text) - len, "latency_%s_us %llu\n",
+                    percentiles[p].name,
+                    (unsigned long long)((value + 500) / 1000));
+  }
+  worker->response.len = 0;
+  unsigned char status = TSP_OK;
+  out_bytes(&worker->response, &status, 1);
+  out_le32(&worker->response, (uint32_t)len);
+  out_bytes(&worker->response, text, (size_t)len);
+}
+
+// A function to make room for a request payload. The old contents are not
+// kept.
+static int reserve_request(struct serve_worker *worker, size_t size) {
+  if (size <= worker->request_capacity) {
+    return 0;
+  }
+  size_t capacity = worker->request_capacity * 2;
+  if (capacity < size) {
+    capacity = size;
+  }
+  capacity = (capacity + 63) & ~(size_t)63;
+  char *request = aligned_alloc(64, capacity);
+  if (!request) {
+    return -1;
+  }
+  free(worker->request);
+  worker->request = request;
+  worker->request_capacity = capacity;
+  return 0;
+}
+
+// A function to serve the requests of one connection until it closes.
+static void serve_connection(struct serve_worker *worker, int fd) {
+  unsigned char header[5];
+  while (read_all(fd, header, sizeof(header)) == 0) {
+    uint64_t start = now_ns();
+    uint32_t size = 0;
+    for (int i = 0; i < 4; i++) {
+      size |= (uint32_t)header[1 + i] << (8 * i);
+    }
+    int known = header[0] == SERVE_SOLVE || header[0] == SERVE_STATS;
+    if (!known || size > SERVE_MAX_PAYLOAD) {
+      unsigned char bad[5] = {SERVE_BAD_REQUEST, 0, 0, 0, 0};
+      write_all(fd, bad, sizeof(bad));
+      return; // We cannot tell where the next frame starts.
+    }
+    enum tsp_status status = TSP_OK;
+    if (reserve_request(worker, size > 0 ? size : 1) != 0) {
+      return; // Without room we cannot read the payload.
+    }
+    if (read_all(fd, worker->request, size) != 0) {
+      return;
+    }
+    if (header[0] == SERVE_STATS) {
+      stats_request(worker);
+    } else {
+      status = solve_request(worker, size);
+    }
+    if (worker->response.failed) {
+      return; // We ran out of memory for the response.
+    }
+    if (write_all(fd, worker->response.data, worker->response.len) != 0) {
+      return;
+    }
+    if (header[0] == SERVE_SOLVE) {
+      struct serve_stats *stats = worker->stats;
+      uint64_t latency = now_ns() - start;
+      pthread_mutex_lock(&stats->lock);
+      stats->latencies[stats->requests % SERVE_LATENCY_SAMPLES] = latency;
+      stats->requests++;
+      stats->errors += status != TSP_OK && status != TSP_NO_ROUTE;
+      pthread_mutex_unlock(&stats->lock);
+    }
+  }
+}
+
+static void *serve_thread(void *arg) {
+  struct serve_worker *worker = arg;
+  while (1) {
+    int fd = accept(worker->listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        usleep(1000); // Out of descriptors, most likely; let others finish.
+      }
+      continue;
+    }
+    serve_connection(worker, fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+// A function to create the listening socket. Returns the descriptor, or -1.
+static int listen_on(const char *path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  unlink(path); // A socket file left behind by an earlier run.
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int serve_run(const char *path, int threads,
+              const struct tsp_options *options) {
+  if (threads > SERVE_MAX_THREADS) {
+    threads = SERVE_MAX_THREADS;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+  struct serve_stats *stats = calloc(1, sizeof(*stats));
+  struct serve_worker *workers = calloc(threads, sizeof(*workers));
+  int listener = stats && workers ? listen_on(path) : -1;
+  int created = 0;
+  for (; listener >= 0 && created < threads; created++) {
+    workers[created].listener = listener;
+    workers[created].stats = stats;
+    workers[created].ctx = tsp_context_create();
+    if (!workers[created].ctx) {
+      break;
+    }
+    tsp_set_options(workers[created].ctx, options);
+  }
+  if (listener < 0 || created < threads) {
+    for (int t = 0; t < created; t++) {
+      tsp_context_destroy(workers[t].ctx);
+    }
+    if (listener >= 0) {
+      close(listener);
+    }
+    free(workers);
+    free(stats);
+    return -1;
+  }
+  pthread_mutex_init(&stats->lock, NULL);
+
+  // The first worker runs on the calling thread. Workers that fail to start
+  // leave their share of the connections to the others.
+  for (int t = 1; t < threads; t++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, serve_thread, &workers[t]) == 0) {
+      pthread_detach(thread);
+    }
+  }
+  serve_thread(&workers[0]);
+  return 0;
+}
@@ -0,0 +1,44 @@
+// The solver daemon. It listens on a Unix domain socket and solves instances
+// sent by clients on a pool of worker threads. Every worker keeps one context
+// for its whole life, so its arenas, candidate lists and DP tables stay
+// allocated and warm from one request to the next.
+//
+// Requests and responses are frames: a 1-byte type (requests) or status
+// (responses), a 4-byte little-endian payload length, then the payload. A
+// connection can send any number of requests, one after the other.
+//
+//   'S' <instance>  Solve an instance in the text or binary (.tspb) format.
+//   'T'             Report statistics.
+//
+// The status of a response is a tsp_status. The payload of a solved instance
+// (TSP_OK) is, with all integers little-endian:
+//
+//   uint32 n, uint64 total cost
+//   n times: uint32 city, uint32 name length, the name
+//   n - 1 times: uint64 cost of the leg leaving that city
+//
+// A route with a closure can visit a city more than once, as in tsp.h.
+// TSP_NO_ROUTE has an empty payload. Other errors carry a uint64 with the
+// line that failed to parse (0 if unknown) and, for plugin errors, a message.
+// Statistics are text, one `name value` pair per line, with the latency
+// percentiles of the last SERVE_LATENCY_SAMPLES requests in microseconds.
+// A frame with an unknown type gets the status SERVE_BAD_REQUEST, and the
+// connection is closed.
+#ifndef TSP_SERVE_H
+#define TSP_SERVE_H
+
+#include "tsp.h"
+
+#define SERVE_SOLVE 'S'
+#define SERVE_STATS 'T'
+#define SERVE_BAD_REQUEST 0xff
+#define SERVE_MAX_PAYLOAD (1U << 30)
+#define SERVE_MAX_THREADS 64
+#define SERVE_LATENCY_SAMPLES 8192
+
+// Listens on path and serves requests on threads workers, each with a context
+// set to options. A stale socket file at path is replaced. Only returns, with
+// -1, if the socket cannot be set up or we run out of memory.
+int serve_run(const char *path, int threads, const struct tsp_options *options);
+
+#endif
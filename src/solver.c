@@ -0,0 +1,1196 @@
+// The solver library behind tsp.h: loading, the engines and the results.
+#include "tsp.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allpairs.h"
+#include "binfmt.h"
+#include "cache.h"
+#include "candidates.h"
+#include "closure.h"
+#include "distance.h"
+#include "heuristic.h"
+#include "instance.h"
+#include "lanes.h"
+#include "live.h"
+#include "matrix.h"
+#include "plugin.h"
+#include "progress.h"
+#include "quantized.h"
+
+// A contracted road graph and the memory behind it.
+struct tsp_road {
+  struct arena arena;
+  struct road_graph graph;
+  char *path; // The file it was read from.
+};
+
+// The state tables of the DP engine, which grow with the largest instance
+// solved. Contexts that share tables (see tsp_share_tables) use one set.
+struct dp_tables {
+  uint64_t *costs; // capacity entries, in city_count rows of 2^city_count.
+  int *nexts;
+  size_t capacity;
+  const struct dp_buffers *filled_by; // Whose states they hold, or NULL.
+};
+
+// The small tables of the DP engine, with room for the most cities the DP
+// accepts.
+struct dp_buffers {
+  uint64_t di[TSP_DP_MAX_CITIES * TSP_DP_MAX_CITIES];
+  uint64_t adjacency[TSP_DP_MAX_CITIES];
+  int neighbors[TSP_DP_MAX_CITIES];
+  uint64_t weights[TSP_DP_MAX_CITIES];
+  uint64_t *dp[TSP_DP_MAX_CITIES];
+  int *next_city[TSP_DP_MAX_CITIES];
+  int greedy[TSP_DP_MAX_CITIES]; // The nearest neighbour route, our first
+                                 // incumbent.
+  int table_cities; // The instance size the tables hold states of, or 0.
+};
+
+struct tsp_context {
+  struct tsp_options options;
+  struct arena arena;   // The instance and everything built from it.
+  struct arena scratch; // Scratch memory of one solve, reset afterwards.
+  // The context whose scratch memory, DP tables and lane tables we use:
+  // ourselves, unless tsp_share_tables lent us those of another.
+  struct tsp_context *tables;
+  int opened;           // 1 once instance needs instance_close.
+  int loaded;           // 1 while instance holds a loaded instance.
+  struct instance instance;
+  const struct distance *exact; // Where leg costs are looked up.
+  struct closure closure;
+  const struct closure *expand; // The closure legs go through, or NULL.
+  struct quantized_distance quantized;
+  int quantized_used;
+  struct plugin_distance plugin;
+  int plugin_open;
+  struct live_instance live;
+  int live_ready;
+  // The graph of options.road, contracted on the first load that needs it
+  // and kept for the next ones.
+  struct tsp_road *road;
+  const struct tsp_road *loaded_road; // The graph the instance is on, if any.
+  size_t error_line;
+  const char *error_message;
+
+  // The result of the last solve. The buffers only ever grow, so solving
+  // instances of similar sizes one after another allocates nothing.
+  int *order; // The cities in the order the engine visits them.
+  int order_capacity;
+  int *route; // order with closure legs expanded.
+  uint64_t *legs;
+  int route_length;
+  int route_capacity;
+  uint64_t cost;
+  struct tsp_solve_stats stats;
+  struct dp_buffers dp;
+  struct dp_tables dp_tables;
+  struct all_pairs pairs;
+  struct lanes *lanes; // The tables of tsp_solve_many, made on first use.
+  atomic_int cancel; // Set by tsp_cancel, cleared when a solve ends.
+  struct monitor monitor;
+};
+
+// What the DP keeps track of besides its tables: how far it got, and the
+// best complete route so far, which is what a cancelled solve returns.
+struct dp_search {
+  struct monitor *monitor;
+  struct tsp_progress progress;
+  uint64_t states; // The states computed so far.
+  double total;    // How many states there are at most.
+  int cancelled;
+  int best_first; // The city after 0 on the incumbent if the DP found it, -1
+                  // if it is the greedy route.
+};
+
+// A function to determine the minimum-cost path. We divide the problem into sub
+// problems by simulating all possible visits, then summing the costs to find
+// the best route. We store minimum distances in a db table to avoid recomputing
+// the same distances.
+//
+// Every MONITOR_STEPS states we report progress and check for cancellation.
+// Once cancelled we unwind without storing anything, since the states we
+// were computing are incomplete, and return NO_PATH all the way up.
+uint64_t tsp_dp(int current, uint64_t visited, int city_count,
+                const uint64_t *di, const uint64_t *adjacency, uint64_t **dp,
+                int **next_city, struct dp_search *search) {
+  if (visited == (1ULL << city_count) -
+                     1) { // This is a binary representation of cities visited
+                          // (bitmask). If all cities have been visited, then it
+                          // will assign all cities with 1 and since we exclude
+                          // the cost to return to the first city, we return 0.
+    return 0;
+  }
+
+  if (next_city[current][visited] != -2) {
+    return dp[current]
+             [visited]; // If the solution has already be computed and the
+                        // distance is stored in dp array, we get the distance
+                        // value instead of recalculating it again. We look at
+                        // next_city rather than dp, since NO_PATH is also a
+                        // valid answer for a state with no way forward.
+  }
+
+  uint64_t min_cost = NO_PATH; // Initialize minimum cost.
+  int best_next_city = -1;     // Initialize the best next city cost.
+
+  // We loop through the cities we can still visit, simulating all possible
+  // routes to find the minimum cost. adjacency[current] has a bit for every
+  // city with a path from current, so we only look at real neighbours.
+  uint64_t candidates = adjacency[current] & ~visited;
+  while (candidates) {
+    int next = __builtin_ctzll(candidates);
+    candidates &= candidates - 1;
+    uint64_t step = di[current * city_count + next];
+    uint64_t rest = tsp_dp(
+        next,
+        visited | (1ULL << next), // We recursively do the same for the next
+                                  // city until all possible routes have been
+                                  // covered and we sum the cost.
+        city_count, di, adjacency, dp, next_city, search);
+    if (search->cancelled) {
+      return NO_PATH;
+    }
+    if (rest == NO_PATH) {
+      continue; // There is no way to finish the trip from there, and adding
+                // to NO_PATH would wrap around to a tiny cost.
+    }
+    uint64_t cost = step + rest;
+
+    // We find the minimum cost route and according to this the next city that
+    // we will visit. Doing this for all routes, we can compare all costs to
+    // find the minimum.
+    if (cost < min_cost) {
+      min_cost = cost;
+      best_next_city = next;
+    }
+    // At the first city, every finished branch is a complete route, which
+    // may beat the incumbent.
+    if (visited == 1 && cost < search->progress.incumbent) {
+      search->progress.incumbent = cost;
+      search->best_first = next;
+    }
+  }
+  // Finally we fill the dp array with the minimum cost routes and we get the
+  // minimum cost. Since we recursively call this function, min_cost will be
+  // updated to the minimum cost, while next_city will be filled with the best
+  // route.
+  dp[current][visited] = min_cost;
+  next_city[current][visited] = best_next_city;
+  if (++search->states % MONITOR_STEPS == 0) {
+    search->progress.done = search->states / search->total;
+    search->cancelled = monitor_tick(search->monitor, &search->progress, 0);
+  }
+  return min_cost;
+}
+
+// A function to start the search with an incumbent and a bound, both cheap
+// to get from the distance table: the nearest neighbour route, if it does
+// not get stuck, and the sum of the cheapest edge leaving every city, less
+// the largest of them, since the last city of the route leaves by none.
+static void dp_search_init(struct dp_search *search, struct monitor *monitor,
+                           int city_count, const uint64_t *di,
+                           int *greedy) {
+  memset(search, 0, sizeof(*search));
+  search->monitor = monitor;
+  search->progress.engine = TSP_ENGINE_DP;
+  search->progress.incumbent = NO_PATH;
+  search->best_first = -1;
+  // The first city plus, for every other city, the subsets of the rest.
+  search->total = 1 + (city_count - 1) * ((1ULL << (city_count - 1)) / 2.0);
+
+  uint64_t sum = 0;
+  uint64_t largest = 0;
+  for (int i = 0; i < city_count; i++) {
+    uint64_t cheapest = NO_PATH;
+    for (int j = 0; j < city_count; j++) {
+      if (j != i && di[i * city_count + j] < cheapest) {
+        cheapest = di[i * city_count + j];
+      }
+    }
+    if (cheapest != NO_PATH) {
+      sum += cheapest;
+      largest = cheapest > largest ? cheapest : largest;
+    }
+  }
+  search->progress.bound = sum - largest;
+
+  uint64_t visited = 1;
+  uint64_t cost = 0;
+  greedy[0] = 0;
+  for (int step = 1; step < city_count; step++) {
+    const uint64_t *row = di + greedy[step - 1] * city_count;
+    int best = -1;
+    for (int j = 0; j < city_count; j++) {
+      if (!(visited >> j & 1) && row[j] != NO_PATH &&
+          (best < 0 || row[j] < row[best])) {
+        best = j;
+      }
+    }
+    if (best < 0) {
+      return; // Stuck; we have no incumbent yet.
+    }
+    greedy[step] = best;
+    visited |= 1ULL << best;
+    cost += row[best];
+  }
+  search->progress.incumbent = cost;
+}
+
+// A function to fill the distance table and adjacency masks of the DP. The
+// DP looks up every pair of cities many times, so we fetch each city's
+// neighbours once into a small local table plus a bitmask of the cities it
+// has a path to. The DP only runs on a few dozen cities, so this stays tiny
+// even when the instance itself is coordinate-based or sparse. A live
+// instance passes itself, so we use the adjacency masks it keeps up to date,
+// and only look up the pairs that have a path.
+static void dp_distances(const struct instance *instance,
+                         const struct live_instance *live,
+                         struct dp_buffers *buffers) {
+  const struct distance *distance = instance->distance;
+  int city_count = distance->city_count;
+  const uint64_t *live_adjacency = live ? live->adjacency : NULL;
+  uint64_t *di = buffers->di;
+  uint64_t *adjacency = buffers->adjacency;
+  int *neighbors = buffers->neighbors;
+  uint64_t *weights = buffers->weights;
+  for (int i = 0; i < city_count; i++) {
+    uint64_t *row = di + (size_t)i * city_count;
+    for (int j = 0; j < city_count; j++) {
+      row[j] = NO_PATH;
+    }
+    adjacency[i] = 0;
+    if (live_adjacency) {
+      adjacency[i] = live_adjacency[i];
+      for (uint64_t rest = adjacency[i]; rest; rest &= rest - 1) {
+        int j = __builtin_ctzll(rest);
+        row[j] = distance_get(distance, i, j);
+      }
+      continue;
+    }
+    int degree = distance_neighbors(distance, i, neighbors, weights);
+    for (int k = 0; k < degree; k++) {
+      row[neighbors[k]] = weights[k];
+      adjacency[i] |= 1ULL << neighbors[k];
+    }
+  }
+}
+
+// A function to mark the states a change of edges affects as not computed,
+// so the next search recomputes them and nothing else. The value of state
+// (current, visited) depends on the edges from current and from the
+// unvisited cities into the unvisited cities:
+//   - An edge that got cheaper can improve any state that depends on it, so
+//     all of those go.
+//   - An edge that got dearer only changes states whose optimal path uses
+//     it; other paths were no better before and are no better now. That is
+//     the case if the state's next step is the edge, or if the state it
+//     leads to is affected, so we visit the states in decreasing order of
+//     visited, which puts each state after the one it leads to.
+// Both sets contain every state that leads to one of their states, which
+// keeps the tables consistent: a state we keep never leads to one we drop.
+// This is a scan of the tables, much cheaper than the search that fills
+// them.
+static void dp_invalidate(struct dp_buffers *buffers, int city_count,
+                          const uint64_t *cheaper, const uint64_t *dearer) {
+  uint64_t all = (1ULL << city_count) - 1;
+  int sources[TSP_DP_MAX_CITIES]; // The cities with a cheaper edge.
+  int source_count = 0;
+  for (int i = 0; i < city_count; i++) {
+    if (cheaper[i] & all) {
+      sources[source_count++] = i;
+    }
+  }
+  int **next_city = buffers->next_city;
+  for (uint64_t visited = all; visited >= 1; visited--) {
+    if (!(visited & 1)) {
+      continue; // The first city is always visited.
+    }
+    uint64_t unvisited = all & ~visited;
+    uint64_t reached = 0; // Unvisited cities a cheaper edge leads to from
+                          // another unvisited city.
+    for (int k = 0; k < source_count; k++) {
+      if (unvisited >> sources[k] & 1) {
+        reached |= cheaper[sources[k]];
+      }
+    }
+    reached &= unvisited;
+    // The first city is only current at the start, with nothing visited.
+    for (uint64_t rest = visited == 1 ? 1 : visited & ~1ULL; rest;
+         rest &= rest - 1) {
+      int current = __builtin_ctzll(rest);
+      int next = next_city[current][visited];
+      if (next == -2) {
+        continue;
+      }
+      int affected = reached || (cheaper[current] & unvisited);
+      if (!affected && next >= 0) {
+        uint64_t after = visited | 1ULL << next;
+        affected = (dearer[current] >> next & 1) ||
+                   (after != all && next_city[next][after] == -2);
+      }
+      if (affected) {
+        next_city[current][visited] = -2;
+      }
+    }
+  }
+}
+
+// A function to run the DP engine. It fills route with the cities in the
+// order we visit them and returns how many there are, 0 if there is no route
+// or -1 if we run out of memory. live is the live instance, if any. If the
+// monitor cancels the search, route receives the incumbent instead, if we
+// have one.
+//
+// The tables are kept after the search. The next solve of the same instance
+// reuses them, and after changes to a live instance recomputes only the
+// states the changes affect, unless cities were added or removed.
+static int solve_dp(const struct instance *instance,
+                    const struct live_instance *live,
+                    struct dp_buffers *buffers, struct dp_tables *tables,
+                    struct monitor *monitor, int *route) {
+  int city_count = instance->distance->city_count;
+  uint64_t *di = buffers->di;
+  uint64_t *adjacency = buffers->adjacency;
+  dp_distances(instance, live, buffers);
+
+  // The dp and next_city tables. dp stores the minimum cost of every state,
+  // next_city the city to visit next from it. Their memory is kept for the
+  // next solve and only grows, so solving many instances of similar sizes
+  // allocates it once.
+  size_t states = (size_t)1 << city_count;
+  size_t entries = (size_t)city_count * states;
+  int reuse = tables->filled_by == buffers &&
+              buffers->table_cities == city_count &&
+              !(live && live->cities_changed);
+  buffers->table_cities = 0;
+  if (entries > tables->capacity) {
+    free(tables->costs);
+    free(tables->nexts);
+    tables->costs = malloc(entries * sizeof(uint64_t));
+    tables->nexts = malloc(entries * sizeof(int));
+    tables->capacity = entries;
+    if (!tables->costs || !tables->nexts) {
+      free(tables->costs);
+      free(tables->nexts);
+      tables->costs = NULL;
+      tables->nexts = NULL;
+      tables->capacity = 0;
+      return -1;
+    }
+  }
+  uint64_t **dp = buffers->dp;
+  int **next_city = buffers->next_city;
+  for (int i = 0; i < city_count; i++) {
+    dp[i] = tables->costs + i * states;
+    next_city[i] = tables->nexts + i * states;
+    for (size_t j = 0; j < states && !reuse; j++) {
+      dp[i][j] = NO_PATH;   // We initialize all possible combination distances
+                            // to NO PATH.
+      next_city[i][j] = -2; // We mark every state as not computed yet.
+    }
+  }
+  if (reuse && live) {
+    dp_invalidate(buffers, city_count, live->cheaper, live->dearer);
+  }
+  // Even a cancelled search leaves only complete states behind.
+  buffers->table_cities = city_count;
+  tables->filled_by = buffers;
+
+  struct dp_search search;
+  dp_search_init(&search, monitor, city_count, di, buffers->greedy);
+  uint64_t result =
+      tsp_dp(0, 1, city_count, di, adjacency, dp, next_city,
+             &search); // We compute the minimum cost route.
+
+  int count = 0;
+  if (search.cancelled && search.best_first < 0) {
+    if (search.progress.incumbent != NO_PATH) {
+      memcpy(route, buffers->greedy, city_count * sizeof(int));
+      count = city_count;
+    }
+  } else if (search.cancelled || result != NO_PATH) {
+    // The branch of the incumbent was finished, so its states are complete.
+    int current = 0;
+    uint64_t visited = 1;
+    route[count++] = 0;
+    if (search.cancelled) {
+      current = search.best_first;
+      visited |= 1ULL << current;
+      route[count++] = current;
+    }
+    while (1) {
+      int next = next_city[current][visited]; // Initialize next city.
+      if (next < 0) {
+        break; // Make sure there is path to the next city.
+      }
+      route[count++] = next;
+      visited |= (1ULL << next);
+      current = next;
+    }
+  }
+  if (!search.cancelled) {
+    search.progress.done = 1;
+    search.progress.incumbent = result;
+    search.progress.bound = result == NO_PATH ? 0 : result;
+    monitor_tick(monitor, &search.progress, 1);
+  }
+  return count;
+}
+
+// A function to replace the distances the engines search on, as the options
+// ask. With a matrix option the distances of a coordinate instance are
+// computed once into a matrix instead of on every lookup. With a closure a
+// missing edge no longer rules a route out: the engines see shortest path
+// distances, and we expand the legs again in the result. Complete instances
+// are left alone, since every pair already has an edge. With quantization
+// the engines search on a 16-bit copy of the matrix; we only compress
+// matrices, since sparse graphs and coordinates are already smaller than one.
+// Returns 0 on success and -1 if we run out of memory.
+static int prepare_distances(struct tsp_context *ctx) {
+  struct instance *instance = &ctx->instance;
+  const struct tsp_options *options = &ctx->options;
+  struct arena *arena = &ctx->arena;
+  int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1) {
+    threads = 1;
+  }
+  if (options->matrix == TSP_MATRIX_DENSE &&
+      instance->distance == &instance->coord.base) {
+    if (matrix_build_dense(&instance->dense, instance->coord.instance, threads,
+                           arena) != 0) {
+      return -1;
+    }
+    instance->distance = &instance->dense.base;
+  } else if (options->matrix == TSP_MATRIX_TRIANGULAR &&
+             instance->distance == &instance->coord.base) {
+    if (matrix_build_triangular(&instance->triangular, instance->coord.instance,
+                                threads, arena) != 0) {
+      return -1;
+    }
+    instance->distance = &instance->triangular.base;
+  }
+  if (options->closure && !instance->distance->complete) {
+    if (closure_build(&ctx->closure, instance->distance, threads, arena) !=
+        0) {
+      return -1;
+    }
+    instance->distance = &ctx->closure.dense.base;
+    ctx->expand = &ctx->closure;
+  }
+  int matrix = instance->distance == &instance->dense.base ||
+               instance->distance == &instance->triangular.base ||
+               ctx->expand;
+  if (options->quantize && matrix) {
+    if (quantized_distance_build(&ctx->quantized, instance->distance, arena) !=
+        0) {
+      return -1;
+    }
+    instance->distance = &ctx->quantized.base;
+    ctx->quantized_used = 1;
+  }
+  return 0;
+}
+
+// A function to drop the loaded instance and everything built from it.
+static void unload(struct tsp_context *ctx) {
+  if (ctx->plugin_open) {
+    plugin_distance_close(&ctx->plugin);
+  }
+  if (ctx->opened) {
+    instance_close(&ctx->instance);
+  }
+  arena_reset(&ctx->arena);
+  ctx->opened = 0;
+  ctx->loaded = 0;
+  ctx->exact = NULL;
+  ctx->expand = NULL;
+  ctx->quantized_used = 0;
+  ctx->plugin_open = 0;
+  ctx->live_ready = 0;
+  ctx->loaded_road = NULL;
+  ctx->dp.table_cities = 0;
+  ctx->pairs.city_count = 0;
+  ctx->error_line = 0;
+  ctx->error_message = NULL;
+  ctx->route_length = 0;
+  ctx->cost = 0;
+}
+
+// A function to finish a load: we open the cost plugin and build the
+// distances the options ask for.
+static enum tsp_status finish_load(struct tsp_context *ctx,
+                                   enum instance_status status) {
+  ctx->opened = 1;
+  if (status == INSTANCE_OPEN_ERROR) {
+    return TSP_OPEN_ERROR;
+  } else if (status == INSTANCE_PARSE_ERROR) {
+    return TSP_PARSE_ERROR;
+  } else if (status != INSTANCE_OK) {
+    return TSP_NO_MEMORY;
+  }
+  struct instance *instance = &ctx->instance;
+  ctx->loaded = 1;
+  ctx->exact = instance->distance;
+  if (instance->city_count == 0) {
+    return TSP_EMPTY;
+  }
+
+  // A cost plugin replaces the distances of the input altogether, so its
+  // costs are the exact ones.
+  if (ctx->options.cost) {
+    const char *error;
+    if (plugin_distance_open(&ctx->plugin, ctx->options.cost,
+                             ctx->options.cost_args, instance, &ctx->arena,
+                             &error) != 0) {
+      ctx->loaded = 0;
+      ctx->error_message = error;
+      return error ? TSP_PLUGIN_ERROR : TSP_NO_MEMORY;
+    }
+    ctx->plugin_open = 1;
+    instance->distance = &ctx->plugin.base;
+    instance->symmetric = ctx->plugin.symmetric;
+    ctx->exact = instance->distance;
+  }
+  if (prepare_distances(ctx) != 0) {
+    ctx->loaded = 0;
+    return TSP_NO_MEMORY;
+  }
+  return TSP_OK;
+}
+
+struct tsp_context *tsp_context_create(void) {
+  struct tsp_context *ctx = calloc(1, sizeof(*ctx));
+  if (!ctx) {
+    return NULL;
+  }
+  tsp_default_options(&ctx->options);
+  atomic_init(&ctx->cancel, 0);
+  ctx->monitor.cancel = &ctx->cancel;
+  arena_init(&ctx->arena, 0);
+  arena_init(&ctx->scratch, 0);
+  ctx->tables = ctx;
+  return ctx;
+}
+
+void tsp_context_destroy(struct tsp_context *ctx) {
+  if (!ctx) {
+    return;
+  }
+  unload(ctx);
+  arena_free(&ctx->arena);
+  arena_free(&ctx->scratch);
+  free(ctx->order);
+  free(ctx->route);
+  free(ctx->legs);
+  free(ctx->dp_tables.costs);
+  free(ctx->dp_tables.nexts);
+  all_pairs_free(&ctx->pairs);
+  tsp_road_close(ctx->road);
+  if (ctx->lanes) {
+    lanes_free(ctx->lanes);
+    free(ctx->lanes);
+  }
+  free(ctx);
+}
+
+void tsp_default_options(struct tsp_options *options) {
+  memset(options, 0, sizeof(*options));
+  options->engine = TSP_ENGINE_AUTO;
+  options->matrix = TSP_MATRIX_NONE;
+}
+
+void tsp_set_options(struct tsp_context *ctx,
+                     const struct tsp_options *options) {
+  ctx->options = *options;
+}
+
+void tsp_share_tables(struct tsp_context *ctx, struct tsp_context *owner) {
+  owner = owner ? owner->tables : ctx;
+  if (ctx->tables == owner) {
+    return;
+  }
+  // Our own tables are of no use any more.
+  free(ctx->dp_tables.costs);
+  free(ctx->dp_tables.nexts);
+  memset(&ctx->dp_tables, 0, sizeof(ctx->dp_tables));
+  arena_free(&ctx->scratch);
+  if (ctx->lanes) {
+    lanes_free(ctx->lanes);
+    free(ctx->lanes);
+    ctx->lanes = NULL;
+  }
+  ctx->tables = owner;
+}
+
+// A function to load and contract the road graph at path. Returns
+// INSTANCE_OK with *road set, or why it failed.
+static enum instance_status road_open(const char *path, struct tsp_road **road,
+                                      size_t *error_line) {
+  *road = NULL;
+  *error_line = 0;
+  struct tsp_road *opened = calloc(1, sizeof(*opened));
+  if (!opened) {
+    return INSTANCE_NO_MEMORY;
+  }
+  arena_init(&opened->arena, 0);
+  size_t len = strlen(path);
+  opened->path = malloc(len + 1);
+  if (!opened->path) {
+    tsp_road_close(opened);
+    return INSTANCE_NO_MEMORY;
+  }
+  memcpy(opened->path, path, len + 1);
+  enum instance_status status = instance_load_road_graph(
+      &opened->graph, path, &opened->arena, error_line);
+  if (status != INSTANCE_OK) {
+    tsp_road_close(opened);
+    return status;
+  }
+  *road = opened;
+  return INSTANCE_OK;
+}
+
+enum tsp_status tsp_road_open(const char *path, struct tsp_road **road,
+                              size_t *error_line) {
+  enum instance_status status = road_open(path, road, error_line);
+  if (status == INSTANCE_OPEN_ERROR) {
+    return TSP_OPEN_ERROR;
+  } else if (status == INSTANCE_PARSE_ERROR) {
+    return TSP_PARSE_ERROR;
+  } else if (status != INSTANCE_OK) {
+    return TSP_NO_MEMORY;
+  }
+  return TSP_OK;
+}
+
+void tsp_road_close(struct tsp_road *road) {
+  if (!road) {
+    return;
+  }
+  arena_free(&road->arena);
+  free(road->path);
+  free(road);
+}
+
+// A function to find the road graph stop lists are read on: the shared one
+// of the options, or the one this context contracted for options.road. We
+// contract that on the first load and keep it for the next ones, as long as
+// options.road names the same file.
+static enum instance_status find_road_graph(struct tsp_context *ctx,
+                                            const struct tsp_road **road) {
+  if (ctx->options.road_graph) {
+    *road = ctx->options.road_graph;
+    return INSTANCE_OK;
+  }
+  const char *path = ctx->options.road;
+  if (!ctx->road || strcmp(ctx->road->path, path) != 0) {
+    tsp_road_close(ctx->road);
+    ctx->road = NULL;
+    enum instance_status status = road_open(path, &ctx->road, &ctx->error_line);
+    if (status != INSTANCE_OK) {
+      return status;
+    }
+  }
+  *road = ctx->road;
+  return INSTANCE_OK;
+}
+
+enum tsp_status tsp_load_file(struct tsp_context *ctx, const char *path) {
+  unload(ctx);
+  if (!ctx->options.road && !ctx->options.road_graph) {
+    return finish_load(ctx, instance_load(&ctx->instance, path, &ctx->arena,
+                                          &ctx->error_line));
+  }
+  const struct tsp_road *road;
+  enum instance_status status = find_road_graph(ctx, &road);
+  if (status == INSTANCE_OK) {
+    ctx->loaded_road = road;
+    status = instance_load_road(&ctx->instance, &road->graph, path,
+                                &ctx->arena, &ctx->error_line);
+  } else {
+    memset(&ctx->instance, 0, sizeof(ctx->instance)); // Nothing is mapped.
+  }
+  return finish_load(ctx, status);
+}
+
+enum tsp_status tsp_load_buffer(struct tsp_context *ctx, const void *data,
+                                size_t size) {
+  unload(ctx);
+  return finish_load(ctx, instance_load_buffer(&ctx->instance, data, size,
+                                               &ctx->arena, &ctx->error_line));
+}
+
+enum tsp_status tsp_write_binary(struct tsp_context *ctx, const char *path) {
+  if (!ctx->loaded) {
+    return TSP_NO_INSTANCE;
+  }
+  FILE *out = fopen(path, "wb");
+  int failed = !out || tspb_write(out, &ctx->instance, &ctx->arena) != 0;
+  if (out && fclose(out) != 0) {
+    failed = 1;
+  }
+  return failed ? TSP_WRITE_ERROR : TSP_OK;
+}
+
+enum tsp_status tsp_update(struct tsp_context *ctx, const char *line,
+                           size_t len) {
+  if (!ctx->loaded) {
+    return TSP_NO_INSTANCE;
+  }
+  if (!ctx->live_ready) {
+    // Those build a new matrix from the distances, which a change would
+    // invalidate.
+    if (ctx->expand || ctx->quantized_used ||
+        ctx->options.matrix != TSP_MATRIX_NONE) {
+      return TSP_NOT_UPDATABLE;
+    }
+    if (live_instance_init(&ctx->live, &ctx->instance, TSP_CANDIDATES,
+                           &ctx->arena) != 0) {
+      return TSP_NO_MEMORY;
+    }
+    ctx->live_ready = 1;
+    ctx->exact = ctx->instance.distance;
+  }
+  ctx->route_length = 0;
+  ctx->pairs.city_count = 0;
+  switch (live_apply_line(&ctx->live, line, len)) {
+  case LIVE_OK:
+    return TSP_OK;
+  case LIVE_SOLVE:
+    return TSP_SOLVE_LINE;
+  case LIVE_BAD_LINE:
+    return TSP_BAD_UPDATE;
+  default:
+    return TSP_NO_MEMORY;
+  }
+}
+
+// A function to run the heuristic engine. Live instances pass the candidate
+// lists they keep up to date; otherwise we build them in the scratch arena.
+// Returns 0 if route is complete, 1 if the engine got stuck and -1 if we run
+// out of memory.
+static int solve_heuristic(struct tsp_context *ctx, int *route) {
+  const struct instance *instance = &ctx->instance;
+  struct arena *scratch = &ctx->tables->scratch;
+  struct candidates built;
+  const struct candidates *candidates =
+      ctx->live_ready ? &ctx->live.candidates : NULL;
+  int status = 0;
+  if (!candidates) {
+    status = candidates_build(&built, instance, TSP_CANDIDATES, scratch);
+    candidates = &built;
+  }
+  if (status == 0) {
+    status = heuristic_route(instance->distance, candidates,
+                             instance->symmetric, route, &ctx->monitor);
+  }
+  arena_reset(scratch);
+  return status;
+}
+
+// A function to make room for count route entries.
+static int reserve_route(struct tsp_context *ctx, int count) {
+  if (count <= ctx->route_capacity) {
+    return 0;
+  }
+  int capacity = ctx->route_capacity * 2 > count ? ctx->route_capacity * 2
+                                                  : count;
+  int *route = realloc(ctx->route, capacity * sizeof(int));
+  if (route) {
+    ctx->route = route;
+  }
+  uint64_t *legs = realloc(ctx->legs, capacity * sizeof(uint64_t));
+  if (legs) {
+    ctx->legs = legs;
+  }
+  if (!route || !legs) {
+    return -1;
+  }
+  ctx->route_capacity = capacity;
+  return 0;
+}
+
+// A function to turn the engine's order into the route we report, with the
+// cost of every leg looked up in the exact distances even when the engines
+// searched on approximate ones. When the engines ran on a metric closure, a
+// leg can stand for a path through other cities, so we expand it into the
+// real edges.
+static enum tsp_status build_route(struct tsp_context *ctx, int count) {
+  int n = ctx->instance.city_count;
+  struct arena *scratch = &ctx->tables->scratch;
+  int *path = ctx->expand ? arena_alloc(scratch, n * sizeof(int), 64) : NULL;
+  if ((ctx->expand && !path) || reserve_route(ctx, count) != 0) {
+    arena_reset(scratch);
+    return TSP_NO_MEMORY;
+  }
+  ctx->route[0] = ctx->order[0];
+  ctx->route_length = 1;
+  ctx->cost = 0;
+  for (int i = 0; i + 1 < count; i++) {
+    int current = ctx->order[i];
+    int next = ctx->order[i + 1];
+    int length = 1;
+    if (ctx->expand) {
+      length = closure_expand(ctx->expand, current, next, path);
+    }
+    if (reserve_route(ctx, ctx->route_length + length) != 0) {
+      arena_reset(scratch);
+      return TSP_NO_MEMORY;
+    }
+    for (int k = 0; k < length; k++) {
+      next = ctx->expand ? path[k] : next;
+      uint64_t step = distance_get(ctx->exact, current, next);
+      ctx->legs[ctx->route_length - 1] = step;
+      ctx->route[ctx->route_length++] = next;
+      ctx->cost += step; // Total cost = sum of all min costs.
+      current = next;
+    }
+  }
+  arena_reset(scratch);
+  return TSP_OK;
+}
+
+// A function to make room for size entries in order.
+static int reserve_order(struct tsp_context *ctx, int size) {
+  if (size > ctx->order_capacity) {
+    int *order = realloc(ctx->order, (size_t)size * sizeof(int));
+    if (!order) {
+      return -1;
+    }
+    ctx->order = order;
+    ctx->order_capacity = size;
+  }
+  return 0;
+}
+
+// A function to find the route of the loaded instance, as tsp_solve.
+static enum tsp_status solve(struct tsp_context *ctx) {
+  if (!ctx->loaded) {
+    return TSP_NO_INSTANCE;
+  }
+  const struct instance *instance = &ctx->instance;
+  int city_count = instance->city_count;
+  ctx->route_length = 0;
+  ctx->cost = 0;
+  if (city_count == 0) {
+    return TSP_NO_ROUTE; // Every city was removed by updates.
+  }
+  enum tsp_engine engine = ctx->options.engine;
+  if (engine == TSP_ENGINE_AUTO) {
+    engine =
+        city_count <= TSP_DP_AUTO_CITIES ? TSP_ENGINE_DP : TSP_ENGINE_HEURISTIC;
+  }
+  if (engine == TSP_ENGINE_DP && city_count > TSP_DP_MAX_CITIES) {
+    return TSP_TOO_MANY_CITIES; // The DP keeps the visited cities in a mask.
+  }
+  ctx->stats.engine = engine;
+
+  // The engine's route goes into order. With a cache, the second third holds
+  // the canonical city order and the last the position of each city in it.
+  if (reserve_order(ctx, ctx->options.cache ? 3 * city_count : city_count) !=
+      0) {
+    return TSP_NO_MEMORY;
+  }
+
+  // An instance solved before, with its cities in whatever order, gets its
+  // route from the cache.
+  struct tsp_cache *cache =
+      city_count <= CACHE_MAX_CITIES ? ctx->options.cache : NULL;
+  int *canonical = ctx->order + city_count;
+  struct cache_key key;
+  if (cache) {
+    struct cache_source source = {
+        ctx->exact,
+        ctx->plugin_open ? ctx->options.cost : NULL,
+        ctx->options.cost_args,
+        ctx->loaded_road ? ctx->loaded_road->path : NULL,
+        ctx->live_ready,
+        ctx->expand != NULL,
+        ctx->quantized_used};
+    int status = cache_key_build(instance, engine, &source,
+                                 &ctx->tables->scratch, canonical, &key);
+    arena_reset(&ctx->tables->scratch);
+    if (status != 0) {
+      return TSP_NO_MEMORY;
+    }
+    int count = cache_find(cache, &key, city_count, ctx->order);
+    if (count >= 0) {
+      ctx->stats.cached = 1;
+      for (int i = 0; i < count; i++) {
+        ctx->order[i] = canonical[ctx->order[i]];
+      }
+      return count == 0 ? TSP_NO_ROUTE : build_route(ctx, count);
+    }
+  }
+
+  if (monitor_cancelled(&ctx->monitor)) {
+    return TSP_CANCELLED;
+  }
+
+  // Sparse inputs often have no route at all (a city nobody connects to, or
+  // several dead ends). We check that in O(E) before running an engine.
+  int feasible = route_feasible(instance->distance, 0, instance->symmetric);
+  if (feasible < 0) {
+    return TSP_NO_MEMORY;
+  }
+
+  int count = 0;
+  if (feasible && engine == TSP_ENGINE_DP) {
+    const struct live_instance *live =
+        ctx->live_ready && city_count <= LIVE_MASK_CITIES ? &ctx->live : NULL;
+    count = solve_dp(instance, live, &ctx->dp, &ctx->tables->dp_tables,
+                     &ctx->monitor, ctx->order);
+    if (ctx->live_ready) {
+      live_forget_changes(&ctx->live); // The tables are up to date now.
+    }
+    if (count < 0) {
+      return TSP_NO_MEMORY;
+    }
+  } else if (feasible) {
+    int status = solve_heuristic(ctx, ctx->order);
+    if (status < 0) {
+      return TSP_NO_MEMORY;
+    }
+    count = status == 0 ? city_count : 0;
+  }
+  // A cancelled engine returns the best route it had, which we report but
+  // do not cache.
+  int cancelled = monitor_cancelled(&ctx->monitor);
+  if (cache && !cancelled) {
+    int *position = canonical + city_count;
+    for (int c = 0; c < city_count; c++) {
+      position[canonical[c]] = c;
+    }
+    for (int i = 0; i < count; i++) {
+      canonical[i] = position[ctx->order[i]];
+    }
+    cache_store(cache, &key, city_count, canonical, count);
+  }
+  if (count == 0) {
+    return cancelled ? TSP_CANCELLED : TSP_NO_ROUTE;
+  }
+  enum tsp_status status = build_route(ctx, count);
+  return status == TSP_OK && cancelled ? TSP_CANCELLED : status;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+enum tsp_status tsp_solve(struct tsp_context *ctx) {
+  uint64_t start = now_ns();
+  ctx->stats.engine = ctx->options.engine;
+  ctx->stats.cached = 0;
+  ctx->monitor.last_ns = start; // The first report comes after an interval.
+  enum tsp_status status = solve(ctx);
+  ctx->stats.nanoseconds = now_ns() - start;
+  atomic_store(&ctx->cancel, 0);
+  return status;
+}
+
+// An instance can go in a lane if tsp_solve would hand it to the DP, without
+// a cache lookup or the tables of a live instance to reuse.
+int tsp_lanes_eligible(const struct tsp_context *ctx) {
+  int n = ctx->instance.city_count;
+  enum tsp_engine engine = ctx->options.engine;
+  return ctx->loaded && n > 0 && n <= TSP_LANES_MAX_CITIES &&
+         (engine == TSP_ENGINE_DP ||
+          (engine == TSP_ENGINE_AUTO && n <= TSP_DP_AUTO_CITIES)) &&
+         !ctx->options.cache && !ctx->live_ready;
+}
+
+// A function to solve size instances of the same city count together, those
+// of ctxs[group[0]] to ctxs[group[size - 1]], with the lane tables of
+// ctxs[0]. Instances cancelled before we start are left out.
+static void solve_lanes(struct tsp_context *const *ctxs, const int *group,
+                        int size, enum tsp_status *statuses) {
+  uint64_t start = now_ns();
+  struct tsp_context *owner = ctxs[0]->tables;
+  int n = ctxs[group[0]]->instance.city_count;
+  int solving[TSP_LANES]; // The instance of every lane.
+  int lanes = 0;
+  for (int k = 0; k < size; k++) {
+    struct tsp_context *ctx = ctxs[group[k]];
+    ctx->route_length = 0;
+    ctx->cost = 0;
+    ctx->stats.engine = TSP_ENGINE_DP;
+    ctx->stats.cached = 0;
+    ctx->stats.nanoseconds = 0;
+    if (monitor_cancelled(&ctx->monitor)) {
+      statuses[group[k]] = TSP_CANCELLED;
+      atomic_store(&ctx->cancel, 0);
+    } else {
+      solving[lanes++] = group[k];
+    }
+  }
+  if (lanes == 0) {
+    return;
+  }
+  if (!owner->lanes) {
+    owner->lanes = calloc(1, sizeof(struct lanes));
+  }
+  int solved = 0;
+  if (owner->lanes) {
+    lanes_reset(owner->lanes, n);
+    for (int lane = 0; lane < lanes; lane++) {
+      struct tsp_context *ctx = ctxs[solving[lane]];
+      dp_distances(&ctx->instance, NULL, &ctx->dp);
+      lanes_set(owner->lanes, lane, ctx->dp.di);
+    }
+    solved = lanes_solve(owner->lanes) == 0;
+  }
+  uint64_t share = (now_ns() - start) / lanes;
+  for (int lane = 0; lane < lanes; lane++) {
+    struct tsp_context *ctx = ctxs[solving[lane]];
+    enum tsp_status status;
+    if (!solved || reserve_order(ctx, n) != 0) {
+      status = TSP_NO_MEMORY;
+    } else {
+      int count = lanes_route(owner->lanes, lane, ctx->order);
+      status = count == 0 ? TSP_NO_ROUTE : build_route(ctx, count);
+    }
+    ctx->stats.nanoseconds = share;
+    atomic_store(&ctx->cancel, 0);
+    statuses[solving[lane]] = status;
+  }
+}
+
+void tsp_solve_many(struct tsp_context *const *ctxs, int count,
+                    enum tsp_status *statuses) {
+  // We gather the instances of each size in turn, which keeps them in input
+  // order within a size, and solve a group whenever it is full. A lone
+  // instance goes into the lanes too: a single lane takes about as long as
+  // tsp_solve, and leaves the DP tables of its context alone.
+  for (int n = 1; n <= TSP_LANES_MAX_CITIES; n++) {
+    int group[TSP_LANES];
+    int size = 0;
+    for (int i = 0; i < count; i++) {
+      if (!tsp_lanes_eligible(ctxs[i]) || ctxs[i]->instance.city_count != n) {
+        continue;
+      }
+      group[size++] = i;
+      if (size == TSP_LANES) {
+        solve_lanes(ctxs, group, size, statuses);
+        size = 0;
+      }
+    }
+    if (size > 0) {
+      solve_lanes(ctxs, group, size, statuses);
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    if (!tsp_lanes_eligible(ctxs[i])) {
+      statuses[i] = tsp_solve(ctxs[i]);
+    }
+  }
+}
+
+enum tsp_status tsp_solve_all_pairs(struct tsp_context *ctx, uint64_t *costs) {
+  if (!ctx->loaded) {
+    return TSP_NO_INSTANCE;
+  }
+  int n = ctx->instance.city_count;
+  uint64_t start = now_ns();
+  ctx->stats.engine = TSP_ENGINE_DP;
+  ctx->stats.cached = 0;
+  ctx->monitor.last_ns = start;
+  ctx->route_length = 0;
+  ctx->cost = 0;
+  ctx->pairs.city_count = 0;
+  enum tsp_status status = TSP_OK;
+  if (n == 0) {
+    status = TSP_NO_ROUTE; // Every city was removed by updates.
+  } else if (n > TSP_ALL_PAIRS_MAX_CITIES) {
+    status = TSP_TOO_MANY_CITIES;
+  } else {
+    const struct live_instance *live = ctx->live_ready ? &ctx->live : NULL;
+    dp_distances(&ctx->instance, live, &ctx->dp);
+    int swept = all_pairs_sweep(&ctx->pairs, ctx->dp.di, n, &ctx->monitor);
+    status = swept < 0   ? TSP_NO_MEMORY
+             : swept > 0 ? TSP_CANCELLED
+                         : TSP_OK;
+  }
+  for (int from = 0; status == TSP_OK && from < n; from++) {
+    for (int to = 0; to < n; to++) {
+      costs[from * n + to] = all_pairs_cost(&ctx->pairs, from, to);
+    }
+  }
+  ctx->stats.nanoseconds = now_ns() - start;
+  atomic_store(&ctx->cancel, 0);
+  return status;
+}
+
+enum tsp_status tsp_all_pairs_route(struct tsp_context *ctx, int start,
+                                    int end) {
+  int n = ctx->pairs.city_count;
+  if (!ctx->loaded || n == 0 || n != ctx->instance.city_count) {
+    return TSP_NO_INSTANCE;
+  }
+  ctx->route_length = 0;
+  ctx->cost = 0;
+  if (reserve_order(ctx, n) != 0) {
+    return TSP_NO_MEMORY;
+  }
+  int count = all_pairs_route(&ctx->pairs, start, end, ctx->order);
+  return count == 0 ? TSP_NO_ROUTE : build_route(ctx, count);
+}
+
+void tsp_set_progress(struct tsp_context *ctx, tsp_progress_fn fn,
+                      void *user) {
+  ctx->monitor.fn = fn;
+  ctx->monitor.user = user;
+}
+
+void tsp_cancel(struct tsp_context *ctx) { atomic_store(&ctx->cancel, 1); }
+
+void tsp_solve_stats(const struct tsp_context *ctx,
+                     struct tsp_solve_stats *stats) {
+  *stats = ctx->stats;
+}
+
+int tsp_city_count(const struct tsp_context *ctx) {
+  return ctx->loaded ? ctx->instance.city_count : 0;
+}
+
+const char *tsp_city_name(const struct tsp_context *ctx, int city,
+                          size_t *len) {
+  *len = ctx->instance.cities[city].len;
+  return ctx->instance.cities[city].ptr;
+}
+
+int tsp_route_length(const struct tsp_context *ctx) {
+  return ctx->route_length;
+}
+
+const int *tsp_route(const struct tsp_context *ctx) { return ctx->route; }
+
+const uint64_t *tsp_leg_costs(const struct tsp_context *ctx) {
+  return ctx->legs;
+}
+
+uint64_t tsp_route_cost(const struct tsp_context *ctx) { return ctx->cost; }
+
+size_t tsp_error_line(const struct tsp_context *ctx) {
+  return ctx->error_line;
+}
+
+const char *tsp_error_message(const struct tsp_context *ctx) {
+  return ctx->error_message;
+}
+
+int tsp_quantization(const struct tsp_context *ctx, uint64_t *scale,
+                     uint64_t *max_error) {
+  if (!ctx->quantized_used) {
+    return 0;
+  }
+  *scale = ctx->quantized.scale;
+  *max_error = ctx->quantized.max_error;
+  return 1;
+}
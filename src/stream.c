@@ -0,0 +1,235 @@
+// The reader thread and block queue behind struct stream.
+#include "stream.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define RAW_CHUNK (1 << 18) // How much compressed input we read at a time.
+
+int is_gzip_file(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  unsigned char magic[2];
+  int gzip = read(fd, magic, 2) == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+  close(fd);
+  return gzip;
+}
+
+// A function to take a free block for the reader. Returns -1 when the
+// consumer has stopped.
+static int acquire_free(struct stream *s) {
+  pthread_mutex_lock(&s->lock);
+  while (s->free_count == 0 && !s->stop) {
+    pthread_cond_wait(&s->changed, &s->lock);
+  }
+  int block = -1;
+  if (!s->stop) {
+    block = s->free_list[s->free_head];
+    s->free_head = (s->free_head + 1) % STREAM_BLOCKS;
+    s->free_count--;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return block;
+}
+
+static void publish_full(struct stream *s, int block) {
+  pthread_mutex_lock(&s->lock);
+  s->full[(s->full_head + s->full_count) % STREAM_BLOCKS] = block;
+  s->full_count++;
+  pthread_cond_broadcast(&s->changed);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void finish(struct stream *s, int error) {
+  pthread_mutex_lock(&s->lock);
+  s->done = 1;
+  s->error = error;
+  pthread_cond_broadcast(&s->changed);
+  pthread_mutex_unlock(&s->lock);
+}
+
+// A function to read exactly as much as is available up to size bytes,
+// retrying short reads from pipes. Returns the byte count, or -1 on error.
+static ssize_t read_full(int fd, char *buffer, size_t size) {
+  size_t total = 0;
+  while (total < size) {
+    ssize_t n = read(fd, buffer + total, size - total);
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    total += (size_t)n;
+  }
+  return (ssize_t)total;
+}
+
+// The reader thread. We look at the first bytes to decide whether the input is
+// compressed; plain input is copied into blocks as is, compressed input is
+// inflated into them. Concatenated gzip members are all decompressed, as gzip
+// itself does.
+static void *reader_thread(void *arg) {
+  struct stream *s = arg;
+  unsigned char *raw = malloc(RAW_CHUNK);
+  if (!raw) {
+    finish(s, 1);
+    return NULL;
+  }
+  ssize_t raw_len = read_full(s->fd, (char *)raw, RAW_CHUNK);
+  if (raw_len < 0) {
+    free(raw);
+    finish(s, 1);
+    return NULL;
+  }
+  s->compressed = raw_len >= 2 && raw[0] == 0x1f && raw[1] == 0x8b;
+
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if (s->compressed && inflateInit2(&z, 15 + 32) != Z_OK) {
+    free(raw);
+    finish(s, 1);
+    return NULL;
+  }
+  z.next_in = raw;
+  z.avail_in = (uInt)raw_len;
+  int input_done = raw_len < RAW_CHUNK;
+  int error = 0;
+  int finished = 0;
+
+  while (!finished && !error) {
+    int block = acquire_free(s);
+    if (block < 0) {
+      break; // The consumer does not want any more data.
+    }
+    struct stream_block *b = &s->blocks[block];
+    b->len = 0;
+
+    while (b->len < STREAM_BLOCK_SIZE && !finished && !error) {
+      if (z.avail_in == 0 && !input_done) {
+        raw_len = read_full(s->fd, (char *)raw, RAW_CHUNK);
+        if (raw_len < 0) {
+          error = 1;
+          break;
+        }
+        input_done = raw_len < RAW_CHUNK;
+        z.next_in = raw;
+        z.avail_in = (uInt)raw_len;
+      }
+      if (!s->compressed) {
+        size_t n = STREAM_BLOCK_SIZE - b->len;
+        if (n > z.avail_in) {
+          n = z.avail_in;
+        }
+        memcpy(b->data + b->len, z.next_in, n);
+        b->len += n;
+        z.next_in += n;
+        z.avail_in -= (uInt)n;
+        finished = input_done && z.avail_in == 0;
+        continue;
+      }
+
+      z.next_out = (unsigned char *)b->data + b->len;
+      z.avail_out = (uInt)(STREAM_BLOCK_SIZE - b->len);
+      int rc = inflate(&z, Z_NO_FLUSH);
+      b->len = STREAM_BLOCK_SIZE - z.avail_out;
+      if (rc == Z_STREAM_END) {
+        if (z.avail_in == 0 && input_done) {
+          finished = 1;
+        } else if (inflateReset(&z) != Z_OK) {
+          error = 1; // Another gzip member follows.
+        }
+      } else if (rc == Z_BUF_ERROR && z.avail_in == 0 && input_done) {
+        error = 1; // The input ended in the middle of a member.
+      } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+        error = 1;
+      }
+    }
+    publish_full(s, block);
+  }
+
+  if (s->compressed) {
+    inflateEnd(&z);
+  }
+  free(raw);
+  finish(s, error);
+  return NULL;
+}
+
+int stream_open(struct stream *stream, int fd) {
+  memset(stream, 0, sizeof(*stream));
+  stream->fd = fd;
+  stream->current = -1;
+  for (int i = 0; i < STREAM_BLOCKS; i++) {
+    stream->blocks[i].data = malloc(STREAM_BLOCK_SIZE);
+    if (!stream->blocks[i].data) {
+      stream_close(stream);
+      return -1;
+    }
+    stream->free_list[i] = i;
+  }
+  stream->free_count = STREAM_BLOCKS;
+  pthread_mutex_init(&stream->lock, NULL);
+  pthread_cond_init(&stream->changed, NULL);
+  if (pthread_create(&stream->thread, NULL, reader_thread, stream) != 0) {
+    stream_close(stream);
+    return -1;
+  }
+  stream->thread_started = 1;
+  return 0;
+}
+
+int stream_next(struct stream *s) {
+  pthread_mutex_lock(&s->lock);
+  if (s->current >= 0) {
+    s->free_list[(s->free_head + s->free_count) % STREAM_BLOCKS] = s->current;
+    s->free_count++;
+    s->current = -1;
+    pthread_cond_broadcast(&s->changed);
+  }
+  while (s->full_count == 0 && !s->done) {
+    pthread_cond_wait(&s->changed, &s->lock);
+  }
+  int status = 0;
+  if (s->full_count > 0) {
+    s->current = s->full[s->full_head];
+    s->full_head = (s->full_head + 1) % STREAM_BLOCKS;
+    s->full_count--;
+    s->data = s->blocks[s->current].data;
+    s->len = s->blocks[s->current].len;
+    status = 1;
+  } else {
+    s->data = NULL;
+    s->len = 0;
+    status = s->error ? -1 : 0;
+  }
+  pthread_mutex_unlock(&s->lock);
+  return status;
+}
+
+void stream_close(struct stream *stream) {
+  if (stream->thread_started) {
+    pthread_mutex_lock(&stream->lock);
+    stream->stop = 1;
+    pthread_cond_broadcast(&stream->changed);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->thread, NULL);
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->changed);
+    stream->thread_started = 0;
+  }
+  for (int i = 0; i < STREAM_BLOCKS; i++) {
+    free(stream->blocks[i].data);
+    stream->blocks[i].data = NULL;
+  }
+  if (stream->fd > 2) {
+    close(stream->fd);
+  }
+  stream->fd = -1;
+}
@@ -0,0 +1,59 @@
+// Streaming input for pipes and gzip-compressed files. A reader thread pulls
+// raw bytes from the file descriptor, inflates them when the input is gzip
+// (or zlib) compressed, and hands fixed-size blocks to the parsing thread
+// through a small queue, so decompression runs while we parse.
+#ifndef TSP_STREAM_H
+#define TSP_STREAM_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define STREAM_BLOCK_SIZE (1 << 20)
+#define STREAM_BLOCKS 4 // Blocks in flight between the two threads.
+
+struct stream_block {
+  char *data;
+  size_t len;
+};
+
+struct stream {
+  int fd;
+  int compressed;
+  pthread_t thread;
+  int thread_started;
+
+  // The queue: blocks cycle from free to full and back. Both are FIFO rings of
+  // block indices guarded by lock.
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  struct stream_block blocks[STREAM_BLOCKS];
+  int full[STREAM_BLOCKS];
+  int full_head;
+  int full_count;
+  int free_list[STREAM_BLOCKS];
+  int free_head;
+  int free_count;
+  int done;  // The reader thread has queued its last block.
+  int error; // Reading or inflating failed.
+  int stop;  // The consumer gave up; the reader should exit.
+
+  // The block the consumer is working on.
+  int current;
+  const char *data;
+  size_t len;
+};
+
+// Returns 1 if the file at path starts with the gzip magic bytes.
+int is_gzip_file(const char *path);
+
+// Starts reading fd on a background thread. The stream takes ownership of fd.
+int stream_open(struct stream *stream, int fd);
+
+// Releases the current block and waits for the next one, which is then in
+// stream->data and stream->len. Returns 1 if a block is available, 0 at the
+// end of the input and -1 on a read or decompression error.
+int stream_next(struct stream *stream);
+
+void stream_close(struct stream *stream);
+
+#endif
@@ -0,0 +1,250 @@
+// libtsp: the solver as a library. Everything a solve needs lives in an opaque
+// context: the options, the loaded instance with the memory behind it, and the
+// result buffers of the last solve, which are reused by the next one. There is
+// no state shared between contexts, so a process can run as many solves at
+// once as it has contexts; a single context must only be used by one thread
+// at a time.
+//
+//   struct tsp_context *ctx = tsp_context_create();
+//   if (ctx && tsp_load_file(ctx, "input.txt") == TSP_OK &&
+//       tsp_solve(ctx) == TSP_OK) {
+//     ... tsp_route(ctx), tsp_leg_costs(ctx), tsp_route_cost(ctx) ...
+//   }
+//   tsp_context_destroy(ctx);
+//
+// The library is every file in src/ except TSP.c, which is the command line
+// front end built on top of it.
+#ifndef TSP_H
+#define TSP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TSP_DP_MAX_CITIES 64  // The DP keeps the visited cities in a bitmask.
+#define TSP_DP_AUTO_CITIES 20 // TSP_ENGINE_AUTO uses the DP up to this many.
+#define TSP_CANDIDATES 10     // The candidate list length of the heuristic.
+#define TSP_ALL_PAIRS_MAX_CITIES 20 // tsp_solve_all_pairs keeps n^2 2^n / 4
+                                    // costs.
+#define TSP_LANES 8             // tsp_solve_many solves this many at once,
+#define TSP_LANES_MAX_CITIES 16 // of up to this many cities each.
+
+enum tsp_engine {
+  TSP_ENGINE_AUTO,      // The DP for small instances, the heuristic otherwise.
+  TSP_ENGINE_DP,        // Exact, but exponential in the number of cities.
+  TSP_ENGINE_HEURISTIC, // Nearest neighbour and 2-opt, for any size.
+};
+
+enum tsp_matrix {
+  TSP_MATRIX_NONE,
+  TSP_MATRIX_DENSE,      // Precompute coordinate distances into a matrix.
+  TSP_MATRIX_TRIANGULAR, // The same, one triangle only.
+};
+
+enum tsp_status {
+  TSP_OK,
+  TSP_NO_ROUTE,        // The instance has no route through every city.
+  TSP_OPEN_ERROR,      // The file could not be opened.
+  TSP_PARSE_ERROR,     // See tsp_error_line.
+  TSP_NO_MEMORY,
+  TSP_EMPTY,           // The input has no cities.
+  TSP_TOO_MANY_CITIES, // The DP was asked to solve more than 64 cities.
+  TSP_PLUGIN_ERROR,    // See tsp_error_message.
+  TSP_NO_INSTANCE,     // Nothing has been loaded yet.
+  TSP_BAD_UPDATE,      // An update line we cannot read, or an unknown city.
+  TSP_NOT_UPDATABLE,   // Updates do not mix with closure, quantize or matrix.
+  TSP_SOLVE_LINE,      // The update was a `solve` line; nothing changed.
+  TSP_WRITE_ERROR,     // The compiled instance could not be written.
+  TSP_CANCELLED,       // tsp_cancel stopped the solve; see tsp_solve.
+};
+
+// A result cache, which any number of contexts and threads can share.
+struct tsp_cache;
+
+// A contracted road graph, which any number of contexts and threads can
+// share.
+struct tsp_road;
+
+// How instances are loaded and solved. The strings are not copied, so they
+// must stay valid while the context uses them.
+struct tsp_options {
+  enum tsp_engine engine;
+  int closure;  // Search on the metric closure of incomplete instances.
+  int quantize; // Search on a 16-bit copy of matrices.
+  enum tsp_matrix matrix;
+  const char *road;      // A DIMACS road graph; loads then read stop lists.
+  const char *cost;      // A cost plugin that replaces the distances.
+  const char *cost_args; // Passed on to the plugin.
+  struct tsp_cache *cache; // Solves look their route up here first, or NULL.
+  // The road graph, contracted once by tsp_road_open, or NULL. If set, road
+  // is not needed.
+  struct tsp_road *road_graph;
+};
+
+struct tsp_context;
+
+// Opens a result cache that holds up to entries routes in memory (0 for the
+// default) and, if path is not NULL, keeps routes of up to 64 cities in that
+// file too, so other runs and processes can use them. Instances of more than
+// 2048 cities are not cached. Returns NULL if the file cannot be opened or we
+// run out of memory.
+struct tsp_cache *tsp_cache_open(const char *path, int entries);
+
+// Closes the cache. No context may use it any more.
+void tsp_cache_close(struct tsp_cache *cache);
+
+// Loads the DIMACS road graph at path and contracts it into *road, for the
+// road_graph option. Without it, every context contracts the graph of the
+// road option on its first load, and keeps it for later loads. Returns
+// TSP_OK, TSP_OPEN_ERROR, TSP_PARSE_ERROR with *error_line set to the bad
+// line, or TSP_NO_MEMORY.
+enum tsp_status tsp_road_open(const char *path, struct tsp_road **road,
+                              size_t *error_line);
+
+// Frees the graph. No context may use it any more.
+void tsp_road_close(struct tsp_road *road);
+
+// Returns a new context with the default options, or NULL if we run out of
+// memory.
+struct tsp_context *tsp_context_create(void);
+
+// Releases the context, its instance and its results.
+void tsp_context_destroy(struct tsp_context *ctx);
+
+void tsp_default_options(struct tsp_options *options);
+
+// Sets the options for the next load. The engine also applies to later
+// solves of the current instance.
+void tsp_set_options(struct tsp_context *ctx,
+                     const struct tsp_options *options);
+
+// Makes ctx solve with the scratch memory, DP tables and lane tables of
+// owner, or with its own again if owner is NULL, and frees those it had. A
+// thread that uses several contexts in turn then grows one set of tables
+// instead of one per context. The two contexts must not solve at the same
+// time, and owner must not be destroyed while ctx still solves.
+void tsp_share_tables(struct tsp_context *ctx, struct tsp_context *owner);
+
+// Loads an instance in any supported format, replacing the previous one.
+// "-" reads standard input. The options (road graph, cost plugin, closure,
+// quantization, matrix) are applied here, so solving is all that is left.
+// An input without cities loads, but returns TSP_EMPTY.
+enum tsp_status tsp_load_file(struct tsp_context *ctx, const char *path);
+
+// The same for an input that is already in memory (but not gzip, and not a
+// road stop list). City names point into data, so it must stay valid until
+// the next load or tsp_context_destroy.
+enum tsp_status tsp_load_buffer(struct tsp_context *ctx, const void *data,
+                                size_t size);
+
+// Writes the loaded instance in the binary format of `--compile`. Use it
+// with the default options, so the original distances are written.
+enum tsp_status tsp_write_binary(struct tsp_context *ctx, const char *path);
+
+// Applies one line of changes in the format of `--updates` (see live.h) to
+// the loaded instance. The first update copies the distances into an
+// updatable matrix, which takes O(n^2) time and memory once.
+enum tsp_status tsp_update(struct tsp_context *ctx, const char *line,
+                           size_t len);
+
+// Solves the loaded instance. On TSP_OK the route is available until the
+// next solve, load or update. On TSP_CANCELLED it holds the best route found
+// before the cancellation, if there is one (tsp_route_length is 0 if not).
+enum tsp_status tsp_solve(struct tsp_context *ctx);
+
+// Returns 1 if tsp_solve_many would solve the loaded instance of ctx in a
+// lane (see below), 0 if it would solve it with tsp_solve.
+int tsp_lanes_eligible(const struct tsp_context *ctx);
+
+// Solves the loaded instances of count distinct contexts, as tsp_solve on
+// each, and puts the status of ctxs[i] in statuses[i]. Instances the DP
+// would solve (with TSP_ENGINE_DP or TSP_ENGINE_AUTO) that have up to
+// TSP_LANES_MAX_CITIES cities, and use neither a cache nor updates, are
+// grouped by city count and solved TSP_LANES at a time, each in a vector
+// lane of one run of the DP; that is several times faster than solving them
+// one by one, and finds the same routes. The rest are solved with tsp_solve.
+// Instances solved in lanes send no progress reports. One cancelled before
+// its group starts is left out of the group and returns TSP_CANCELLED; later
+// cancellations are ignored. The time in their tsp_solve_stats is their
+// share of the group's. The tables of the lanes are kept in ctxs[0], or in
+// the context it shares tables with.
+void tsp_solve_many(struct tsp_context *const *ctxs, int count,
+                    enum tsp_status *statuses);
+
+// Finds the cheapest path through every city for every pair of first and
+// last city, in one sweep of the DP over the subsets of cities. costs
+// receives n x n entries: costs[start * n + end] is the cost of the cheapest
+// path from start to end, or UINT64_MAX if there is none (and for start ==
+// end, unless there is only one city). The costs are those the engine
+// searches on. This takes about as long as n solves with the DP, and memory
+// for n^2 2^n / 4 costs, 180 MB for 18 cities, so it is limited to
+// TSP_ALL_PAIRS_MAX_CITIES cities. Progress and cancellation work as with
+// tsp_solve, but a cancelled sweep has no costs at all.
+enum tsp_status tsp_solve_all_pairs(struct tsp_context *ctx, uint64_t *costs);
+
+// Makes the cheapest path from start to end, as found by the last
+// tsp_solve_all_pairs, the route of ctx (see tsp_route). Returns TSP_NO_ROUTE
+// if there is no such path, and TSP_NO_INSTANCE if the instance was loaded or
+// updated since the sweep.
+enum tsp_status tsp_all_pairs_route(struct tsp_context *ctx, int start,
+                                    int end);
+
+// What an engine reports while it runs.
+struct tsp_progress {
+  enum tsp_engine engine; // TSP_ENGINE_DP or TSP_ENGINE_HEURISTIC.
+  double done;            // The share of the work done, from 0 to 1. The
+                          // heuristic can only estimate it.
+  uint64_t incumbent;     // The cost of the best route so far, or UINT64_MAX
+                          // if there is none yet.
+  uint64_t bound;         // No route costs less than this; 0 if unknown.
+};
+typedef void (*tsp_progress_fn)(const struct tsp_progress *progress,
+                                void *user);
+
+// Calls fn from the solving thread a few times a second during later solves
+// (never more than five times a second, and once at the end), or stops the
+// reports if fn is NULL. Costs are those the engine searches on, so they are
+// approximate with quantization.
+void tsp_set_progress(struct tsp_context *ctx, tsp_progress_fn fn,
+                      void *user);
+
+// Asks the running solve of ctx to stop as soon as it can, which returns
+// TSP_CANCELLED. If no solve is running, the next one stops at once. Unlike
+// the rest of the API, this may be called from any thread and from a signal
+// handler.
+void tsp_cancel(struct tsp_context *ctx);
+
+// The cities of the loaded instance. Names are not NUL terminated.
+int tsp_city_count(const struct tsp_context *ctx);
+const char *tsp_city_name(const struct tsp_context *ctx, int city,
+                          size_t *len);
+
+// The route of the last solve, as travelled: with a closure, a leg through
+// other cities is expanded into the edges it uses, so cities may repeat.
+// tsp_leg_costs has one entry less than the route, for the edge that leaves
+// each city; the costs are the exact ones even when the engine searched on
+// quantized distances.
+int tsp_route_length(const struct tsp_context *ctx);
+const int *tsp_route(const struct tsp_context *ctx);
+const uint64_t *tsp_leg_costs(const struct tsp_context *ctx);
+uint64_t tsp_route_cost(const struct tsp_context *ctx);
+
+// How the last solve went.
+struct tsp_solve_stats {
+  enum tsp_engine engine; // The engine that ran: TSP_ENGINE_DP or _HEURISTIC.
+  int cached;             // 1 if the route came from the cache.
+  uint64_t nanoseconds;   // The time tsp_solve took.
+};
+void tsp_solve_stats(const struct tsp_context *ctx,
+                     struct tsp_solve_stats *stats);
+
+// The line of the input that failed to parse (0 if unknown), and a
+// description of the last plugin error (NULL if there is none).
+size_t tsp_error_line(const struct tsp_context *ctx);
+const char *tsp_error_message(const struct tsp_context *ctx);
+
+// Returns 1 and the step and error bound if the loaded instance is searched
+// on quantized distances, 0 otherwise.
+int tsp_quantization(const struct tsp_context *ctx, uint64_t *scale,
+                     uint64_t *max_error);
+
+#endif
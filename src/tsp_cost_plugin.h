@@ -0,0 +1,52 @@
+// The interface of cost plugins. A plugin is a shared object that computes
+// the cost between cities with a model of its own (tolls, time of day,
+// vehicle class, ...), so the model can change without rebuilding the solver:
+//
+//   ./tsp_solver --cost=./tolls.so --cost-args="truck" input.txt
+//
+// The plugin exports one function, tsp_cost_plugin, that returns a pointer to
+// a struct tsp_cost_plugin. The solver asks it for costs in batches and keeps
+// every answer in a memo, so each pair is computed at most once (unless the
+// memo is full) and no full matrix is ever built. This header is all a plugin
+// needs; build it with something like
+//
+//   gcc -O2 -shared -fPIC -o tolls.so tolls.c
+#ifndef TSP_COST_PLUGIN_H
+#define TSP_COST_PLUGIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TSP_COST_PLUGIN_VERSION 1
+
+// The cost of a pair with no connection at all.
+#define TSP_COST_NO_PATH UINT64_MAX
+
+struct tsp_cost_plugin {
+  // Must be TSP_COST_PLUGIN_VERSION.
+  uint32_t version;
+  // 1 if the cost from i to j is always the cost from j to i. The solver then
+  // only asks for one of the two and can use symmetric moves.
+  uint32_t symmetric;
+
+  // Sets up the plugin for one instance. names[i] is the name of city i; the
+  // names are not NUL terminated, so use name_lengths[i]. args is the string
+  // given with --cost-args, or "" without one. The names stay valid until
+  // close. Returns 0 on success and stores the plugin's state in *state.
+  int (*open)(void **state, int city_count, const char *const *names,
+              const size_t *name_lengths, const char *args);
+
+  // Writes the cost from city from[k] to city to[k] to out[k] for every
+  // k < count. It may be called from several threads at once. Returns 0 on
+  // success; on failure every pair of the batch counts as unconnected.
+  int (*cost_batch)(void *state, const int32_t *from, const int32_t *to,
+                    size_t count, uint64_t *out);
+
+  // Releases the state. May be NULL.
+  void (*close)(void *state);
+};
+
+// The function every plugin exports.
+const struct tsp_cost_plugin *tsp_cost_plugin(void);
+
+#endif
@@ -0,0 +1,479 @@
+// TSPLIB reader. The header is read line by line, the sections as a stream of
+// whitespace separated numbers, which is how TSPLIB defines them.
+#include "tsplib.h"
+
+#include "distance.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+struct scanner {
+  const char *p;
+  const char *end;
+  size_t line; // 1-based, for error messages.
+};
+
+static int is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// A function to skip blanks and newlines in front of the next number.
+static void skip_space(struct scanner *sc) {
+  while (sc->p < sc->end && (is_blank(*sc->p) || *sc->p == '\n')) {
+    if (*sc->p == '\n') {
+      sc->line++;
+    }
+    sc->p++;
+  }
+}
+
+// A function to read a decimal number, with optional sign, fraction and
+// exponent. We build the mantissa as an integer and apply the power of ten
+// with a single multiplication or division, which is exact for the short
+// numbers found in TSPLIB files. Returns 0 on success.
+static int read_number(struct scanner *sc, double *value) {
+  static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                  1e18, 1e19, 1e20, 1e21, 1e22};
+  skip_space(sc);
+  const char *p = sc->p;
+  int negative = 0;
+  if (p < sc->end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  while (p < sc->end && *p >= '0' && *p <= '9') {
+    if (mantissa < 100000000000000000ULL) {
+      mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+    } else {
+      exponent++; // Digits past the precision of a double are dropped.
+    }
+    p++;
+    digits++;
+  }
+  if (p < sc->end && *p == '.') {
+    p++;
+    while (p < sc->end && *p >= '0' && *p <= '9') {
+      if (mantissa < 100000000000000000ULL) {
+        mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        exponent--;
+      }
+      p++;
+      digits++;
+    }
+  }
+  if (digits == 0) {
+    return -1;
+  }
+  if (p < sc->end && (*p == 'e' || *p == 'E')) {
+    p++;
+    int exp_negative = 0;
+    if (p < sc->end && (*p == '-' || *p == '+')) {
+      exp_negative = *p == '-';
+      p++;
+    }
+    int e = 0;
+    if (p == sc->end || *p < '0' || *p > '9') {
+      return -1;
+    }
+    while (p < sc->end && *p >= '0' && *p <= '9') {
+      if (e < 10000) {
+        e = e * 10 + (*p - '0');
+      }
+      p++;
+    }
+    exponent += exp_negative ? -e : e;
+  }
+  if (p < sc->end && !is_blank(*p) && *p != '\n') {
+    return -1; // Garbage glued to the number.
+  }
+
+  double v = (double)mantissa;
+  while (exponent > 22) {
+    v *= 1e22;
+    exponent -= 22;
+  }
+  while (exponent < -22) {
+    v /= 1e22;
+    exponent += 22;
+  }
+  v = exponent >= 0 ? v * powers[exponent] : v / powers[-exponent];
+  *value = negative ? -v : v;
+  sc->p = p;
+  return 0;
+}
+
+// A function to read a keyword at the start of a line. The keyword is a run of
+// letters, digits and underscores.
+static size_t keyword_length(const char *p, const char *end) {
+  const char *start = p;
+  while (p < end && ((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') ||
+                     (*p >= '0' && *p <= '9') || *p == '_')) {
+    p++;
+  }
+  return (size_t)(p - start);
+}
+
+static int keyword_is(const char *keyword, size_t len, const char *expected) {
+  return strlen(expected) == len && memcmp(keyword, expected, len) == 0;
+}
+
+static const char *const header_keywords[] = {
+    "NAME", "TYPE", "COMMENT", "DIMENSION", "EDGE_WEIGHT_TYPE", "CAPACITY"};
+
+int is_tsplib(const char *data, size_t size) {
+  struct scanner sc = {data, data + size, 1};
+  skip_space(&sc);
+  size_t len = keyword_length(sc.p, sc.end);
+  const char *p = sc.p + len;
+  while (p < sc.end && is_blank(*p)) {
+    p++;
+  }
+  if (p < sc.end && *p != ':' && *p != '\n') {
+    return 0; // An edge list line has a '-' right after the first name.
+  }
+  for (size_t i = 0; i < sizeof(header_keywords) / sizeof(*header_keywords);
+       i++) {
+    if (keyword_is(sc.p, len, header_keywords[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// The order in which EDGE_WEIGHT_SECTION lists the matrix entries.
+enum weight_format {
+  FORMAT_FULL_MATRIX,
+  FORMAT_UPPER_ROW,
+  FORMAT_LOWER_ROW,
+  FORMAT_UPPER_DIAG_ROW,
+  FORMAT_LOWER_DIAG_ROW,
+  FORMAT_UPPER_COL,
+  FORMAT_LOWER_COL,
+  FORMAT_UPPER_DIAG_COL,
+  FORMAT_LOWER_DIAG_COL,
+  FORMAT_UNKNOWN,
+};
+
+static const char *const format_names[] = {
+    "FULL_MATRIX",    "UPPER_ROW", "LOWER_ROW",      "UPPER_DIAG_ROW",
+    "LOWER_DIAG_ROW", "UPPER_COL", "LOWER_COL",      "UPPER_DIAG_COL",
+    "LOWER_DIAG_COL"};
+
+static const char *const type_names[] = {"EXPLICIT", "EUC_2D", "CEIL_2D",
+                                         "MAN_2D",   "MAX_2D", "GEO",
+                                         "ATT"};
+
+// A function to read the EDGE_WEIGHT_SECTION. Every format is a walk over
+// one triangle (or the whole matrix) either row by row or column by column, so
+// we loop over (outer, inner) and swap the roles for the column formats. For
+// symmetric instances every entry is mirrored.
+static int read_weights(struct scanner *sc, struct tsplib_instance *out,
+                        enum weight_format format) {
+  int n = out->dimension;
+  int by_column = format >= FORMAT_UPPER_COL && format <= FORMAT_LOWER_DIAG_COL;
+  for (int outer = 0; outer < n; outer++) {
+    int first = 0;
+    int last = n - 1;
+    switch (format) {
+    case FORMAT_UPPER_ROW:
+    case FORMAT_LOWER_COL:
+      first = outer + 1;
+      break;
+    case FORMAT_LOWER_ROW:
+    case FORMAT_UPPER_COL:
+      last = outer - 1;
+      break;
+    case FORMAT_UPPER_DIAG_ROW:
+    case FORMAT_LOWER_DIAG_COL:
+      first = outer;
+      break;
+    case FORMAT_LOWER_DIAG_ROW:
+    case FORMAT_UPPER_DIAG_COL:
+      last = outer;
+      break;
+    default:
+      break;
+    }
+    for (int inner = first; inner <= last; inner++) {
+      double w;
+      if (read_number(sc, &w) != 0 || w < 0) {
+        return -1;
+      }
+      size_t row = (size_t)(by_column ? inner : outer);
+      size_t col = (size_t)(by_column ? outer : inner);
+      uint64_t weight = (uint64_t)(w + 0.5);
+      if (out->matrix) {
+        out->matrix[row * out->stride + col] = weight;
+        if (format != FORMAT_FULL_MATRIX) {
+          out->matrix[col * out->stride + row] = weight;
+        }
+      } else if (row != col && (format != FORMAT_FULL_MATRIX || row < col)) {
+        // A symmetric full matrix lists every pair twice; we keep the copy
+        // from the upper triangle.
+        size_t i = row < col ? row : col;
+        size_t j = row < col ? col : row;
+        out->triangle[triangular_index((size_t)n, i, j)] = weight;
+      }
+    }
+  }
+  return 0;
+}
+
+// A function to read NODE_COORD_SECTION. Each node is `id x y`; we keep the id
+// as the node's name and store the nodes in the order they appear.
+static int read_coords(struct scanner *sc, struct tsplib_instance *out) {
+  for (int i = 0; i < out->dimension; i++) {
+    skip_space(sc);
+    const char *id = sc->p;
+    double ignored;
+    if (read_number(sc, &ignored) != 0) {
+      return -1;
+    }
+    out->names[i].ptr = id;
+    out->names[i].len = (size_t)(sc->p - id);
+    if (read_number(sc, &out->x[i]) != 0 || read_number(sc, &out->y[i]) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int parse_tsplib(const char *data, size_t size, struct arena *arena,
+                 struct tsplib_instance *out, size_t *error_line) {
+  memset(out, 0, sizeof(*out));
+  out->symmetric = 1;
+  out->weight_type = TSPLIB_EXPLICIT;
+  enum weight_format format = FORMAT_UNKNOWN;
+  int have_weights = 0;
+  int have_coords = 0;
+  struct scanner sc = {data, data + size, 1};
+
+  while (sc.p < sc.end) {
+    while (sc.p < sc.end && is_blank(*sc.p)) {
+      sc.p++;
+    }
+    const char *keyword = sc.p;
+    size_t len = keyword_length(sc.p, sc.end);
+    const char *value = sc.p + len;
+    while (value < sc.end && is_blank(*value)) {
+      value++;
+    }
+    if (value < sc.end && *value == ':') {
+      value++;
+      while (value < sc.end && is_blank(*value)) {
+        value++;
+      }
+    }
+    const char *eol = memchr(value, '\n', (size_t)(sc.end - value));
+    if (!eol) {
+      eol = sc.end;
+    }
+    const char *value_end = eol;
+    while (value_end > value && is_blank(value_end[-1])) {
+      value_end--;
+    }
+    size_t value_len = (size_t)(value_end - value);
+
+    if (keyword_is(keyword, len, "EOF")) {
+      break;
+    }
+    if (len == 0 && keyword == eol) {
+      // A blank line.
+    } else if (keyword_is(keyword, len, "TYPE")) {
+      if (keyword_is(value, value_len, "ATSP")) {
+        out->symmetric = 0;
+      } else if (!keyword_is(value, value_len, "TSP")) {
+        *error_line = sc.line; // HCP, CVRP and tours are not instances we solve.
+        return -1;
+      }
+    } else if (keyword_is(keyword, len, "DIMENSION")) {
+      struct scanner number = {value, value_end, sc.line};
+      double dimension;
+      if (out->dimension != 0 || read_number(&number, &dimension) != 0 ||
+          dimension < 1 || dimension > INT32_MAX) {
+        *error_line = sc.line;
+        return -1;
+      }
+      out->dimension = (int)dimension;
+    } else if (keyword_is(keyword, len, "EDGE_WEIGHT_TYPE")) {
+      size_t types = sizeof(type_names) / sizeof(*type_names);
+      size_t t = 0;
+      while (t < types && !keyword_is(value, value_len, type_names[t])) {
+        t++;
+      }
+      if (t == types) {
+        *error_line = sc.line;
+        return -1;
+      }
+      out->weight_type = (enum tsplib_weight_type)t;
+    } else if (keyword_is(keyword, len, "EDGE_WEIGHT_FORMAT")) {
+      size_t f = 0;
+      while (f < FORMAT_UNKNOWN &&
+             !keyword_is(value, value_len, format_names[f])) {
+        f++;
+      }
+      if (f == FORMAT_UNKNOWN && !keyword_is(value, value_len, "FUNCTION")) {
+        *error_line = sc.line;
+        return -1;
+      }
+      format = (enum weight_format)f;
+    } else if (keyword_is(keyword, len, "NODE_COORD_SECTION") ||
+               keyword_is(keyword, len, "EDGE_WEIGHT_SECTION") ||
+               keyword_is(keyword, len, "DISPLAY_DATA_SECTION")) {
+      size_t section_line = sc.line;
+      if (out->dimension == 0) {
+        *error_line = section_line; // We need DIMENSION to size the section.
+        return -1;
+      }
+      size_t n = (size_t)out->dimension;
+      sc.p = eol;
+      int status = 0;
+      if (keyword_is(keyword, len, "NODE_COORD_SECTION")) {
+        out->x = arena_alloc(arena, n * sizeof(double), 64);
+        out->y = arena_alloc(arena, n * sizeof(double), 64);
+        out->names = arena_alloc(arena, n * sizeof(struct span), 8);
+        status = !out->x || !out->y || !out->names || read_coords(&sc, out);
+        have_coords = 1;
+      } else if (keyword_is(keyword, len, "EDGE_WEIGHT_SECTION")) {
+        if (format == FORMAT_UNKNOWN) {
+          format = FORMAT_FULL_MATRIX; // The TSPLIB default.
+        }
+        // Symmetric instances only need one triangle, which halves the
+        // memory. Asymmetric ones get a full matrix with cache-aligned rows.
+        if (out->symmetric) {
+          out->triangle =
+              arena_calloc(arena, n * (n - 1) / 2 * sizeof(uint64_t), 64);
+          status = (!out->triangle && n > 1) || read_weights(&sc, out, format);
+        } else {
+          out->matrix = matrix_alloc(arena, (int)n, &out->stride);
+          status = !out->matrix || read_weights(&sc, out, format);
+        }
+        have_weights = 1;
+      } else {
+        for (size_t i = 0; i < 3 * n && status == 0; i++) {
+          double ignored; // Display coordinates play no part in the distances.
+          status = read_number(&sc, &ignored);
+        }
+      }
+      if (status != 0) {
+        *error_line = sc.line;
+        return -1;
+      }
+      // Finish the line the last number was on.
+      eol = memchr(sc.p, '\n', (size_t)(sc.end - sc.p));
+      if (!eol) {
+        eol = sc.end;
+      }
+    } else if (keyword_is(keyword, len, "FIXED_EDGES_SECTION")) {
+      sc.p = eol;
+      double node = 0;
+      while (read_number(&sc, &node) == 0 && node != -1) {
+      }
+      eol = memchr(sc.p, '\n', (size_t)(sc.end - sc.p));
+      if (!eol) {
+        eol = sc.end;
+      }
+    } else if (!keyword_is(keyword, len, "NAME") &&
+               !keyword_is(keyword, len, "COMMENT") &&
+               !keyword_is(keyword, len, "CAPACITY") &&
+               !keyword_is(keyword, len, "NODE_COORD_TYPE") &&
+               !keyword_is(keyword, len, "DISPLAY_DATA_TYPE")) {
+      *error_line = sc.line;
+      return -1;
+    }
+
+    sc.p = eol < sc.end ? eol + 1 : sc.end;
+    sc.line++;
+  }
+
+  if (out->dimension == 0 ||
+      (out->weight_type == TSPLIB_EXPLICIT ? !have_weights : !have_coords)) {
+    *error_line = sc.line; // The section with the distances is missing.
+    return -1;
+  }
+
+  if (!out->names) {
+    // EXPLICIT instances carry no node ids, so we number the nodes from 1.
+    out->names =
+        arena_alloc(arena, (size_t)out->dimension * sizeof(struct span), 8);
+    if (!out->names) {
+      return -1;
+    }
+    for (int i = 0; i < out->dimension; i++) {
+      char id[16];
+      int len = snprintf(id, sizeof(id), "%d", i + 1);
+      out->names[i].ptr = arena_strndup(arena, id, (size_t)len);
+      out->names[i].len = (size_t)len;
+      if (!out->names[i].ptr) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+// TSPLIB's nint: round half up and truncate to an integer.
+static uint64_t nint(double x) { return (uint64_t)(x + 0.5); }
+
+// A function to convert a TSPLIB GEO coordinate (DDD.MM, degrees and minutes)
+// to radians. The reference implementation truncates to whole degrees.
+static double geo_radians(double x) {
+  const double pi = 3.141592;
+  double degrees = (double)(int64_t)x;
+  double minutes = x - degrees;
+  return pi * (degrees + 5.0 * minutes / 3.0) / 180.0;
+}
+
+uint64_t tsplib_distance(const struct tsplib_instance *instance, int i, int j) {
+  if (instance->weight_type == TSPLIB_EXPLICIT && instance->matrix) {
+    return instance->matrix[(size_t)i * instance->stride + j];
+  }
+  if (i == j) {
+    return 0;
+  }
+  if (instance->weight_type == TSPLIB_EXPLICIT) {
+    size_t lo = (size_t)(i < j ? i : j);
+    size_t hi = (size_t)(i < j ? j : i);
+    return instance->triangle[triangular_index(
+        (size_t)instance->dimension, lo, hi)];
+  }
+  double xd = instance->x[i] - instance->x[j];
+  double yd = instance->y[i] - instance->y[j];
+  switch (instance->weight_type) {
+  case TSPLIB_EUC_2D:
+    return nint(sqrt(xd * xd + yd * yd));
+  case TSPLIB_CEIL_2D:
+    return (uint64_t)ceil(sqrt(xd * xd + yd * yd));
+  case TSPLIB_MAN_2D:
+    return nint(fabs(xd) + fabs(yd));
+  case TSPLIB_MAX_2D: {
+    uint64_t dx = nint(fabs(xd));
+    uint64_t dy = nint(fabs(yd));
+    return dx > dy ? dx : dy;
+  }
+  case TSPLIB_ATT: {
+    // The pseudo-Euclidean distance of the att48 and att532 instances.
+    double r = sqrt((xd * xd + yd * yd) / 10.0);
+    uint64_t t = nint(r);
+    return (double)t < r ? t + 1 : t;
+  }
+  case TSPLIB_GEO: {
+    const double radius = 6378.388;
+    double lat_i = geo_radians(instance->x[i]);
+    double lon_i = geo_radians(instance->y[i]);
+    double lat_j = geo_radians(instance->x[j]);
+    double lon_j = geo_radians(instance->y[j]);
+    double q1 = cos(lon_i - lon_j);
+    double q2 = cos(lat_i - lat_j);
+    double q3 = cos(lat_i + lat_j);
+    return (uint64_t)(radius * acos(0.5 * ((1.0 + q1) * q2 - (1.0 - q1) * q3)) +
+                      1.0);
+  }
+  default:
+    return 0;
+  }
+}
@@ -0,0 +1,51 @@
+// A reader for TSPLIB instances. Coordinate instances (EUC_2D, CEIL_2D, GEO,
+// ATT and friends) keep their node coordinates and compute distances on
+// demand with the TSPLIB rounding rules; EXPLICIT instances are read into one
+// triangle (TSP) or a full matrix (ATSP) whatever EDGE_WEIGHT_FORMAT they were
+// written in.
+#ifndef TSP_TSPLIB_H
+#define TSP_TSPLIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "intern.h"
+
+enum tsplib_weight_type {
+  TSPLIB_EXPLICIT,
+  TSPLIB_EUC_2D,
+  TSPLIB_CEIL_2D,
+  TSPLIB_MAN_2D,
+  TSPLIB_MAX_2D,
+  TSPLIB_GEO,
+  TSPLIB_ATT,
+};
+
+struct tsplib_instance {
+  int dimension;
+  int symmetric; // 0 for TYPE: ATSP.
+  enum tsplib_weight_type weight_type;
+  double *x; // Node coordinates, for every type except EXPLICIT.
+  double *y;
+  // The weights of EXPLICIT instances: the strict upper triangle for TSP, or
+  // a full matrix with rows stride entries apart for ATSP.
+  uint64_t *triangle;
+  uint64_t *matrix;
+  size_t stride;
+  struct span *names; // The node numbers as written in the file.
+};
+
+// Returns 1 if the buffer starts like a TSPLIB file (a `KEYWORD :` header).
+int is_tsplib(const char *data, size_t size);
+
+// Parses a TSPLIB buffer. Returns 0 on success, or -1 with the 1-based number
+// of the offending line stored in error_line. Everything is allocated from
+// the arena.
+int parse_tsplib(const char *data, size_t size, struct arena *arena,
+                 struct tsplib_instance *out, size_t *error_line);
+
+// The distance between nodes i and j (0-based), rounded as TSPLIB specifies.
+uint64_t tsplib_distance(const struct tsplib_instance *instance, int i, int j);
+
+#endif